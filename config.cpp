@@ -0,0 +1,184 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#include "config.h"
+#include "rules.h"
+#include "main.h"
+#include "log.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+ProxySettings proxy_settings;
+
+static std::string config_path;
+static int inotify_fd = -1;
+
+struct WatchedDir {
+    std::string config_name; // File names in the directory we reload on, "" for none
+    std::string rules_name;
+};
+static std::unordered_map<int, WatchedDir> watches;
+
+static std::string default_config_path() {
+    const char *xdg_config_home = getenv("XDG_CONFIG_HOME");
+    const char *home = getenv("HOME");
+    if (xdg_config_home && *xdg_config_home)
+        return std::string(xdg_config_home) + "/fix_x11_docks/config";
+    if (home)
+        return std::string(home) + "/.config/fix_x11_docks/config";
+    return "";
+}
+
+static std::string trim(const std::string &s) {
+    size_t start = s.find_first_not_of(" \t");
+    if (start == std::string::npos)
+        return "";
+    size_t end = s.find_last_not_of(" \t");
+    return s.substr(start, end - start + 1);
+}
+
+static bool parse_int(const std::string &value, int min, int *out) {
+    char *end;
+    errno = 0;
+    long n = strtol(value.c_str(), &end, 10);
+    if (errno != 0 || end == value.c_str() || *end != '\0' || n < min || n > 65535)
+        return false;
+    *out = (int) n;
+    return true;
+}
+
+/** A missing file gives the defaults, bad lines are logged and skipped. */
+static ProxySettings load_config() {
+    ProxySettings settings;
+    if (config_path.empty())
+        return settings;
+    FILE *f = fopen(config_path.c_str(), "r");
+    if (!f)
+        return settings;
+    
+    char line[4096];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line_number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        std::string l = trim(line);
+        if (l.empty() || l[0] == '#')
+            continue;
+        size_t equals = l.find('=');
+        if (equals == std::string::npos) {
+            log_warn("config: %s:%d: expected key = value, skipping it", config_path.c_str(), line_number);
+            continue;
+        }
+        std::string key = trim(l.substr(0, equals));
+        std::string value = trim(l.substr(equals + 1));
+        
+        bool ok = true;
+        if (key == "tag")
+            settings.tag = value;
+        else if (key == "x")
+            ok = parse_int(value, -65535, &settings.x);
+        else if (key == "y")
+            ok = parse_int(value, -65535, &settings.y);
+        else if (key == "width")
+            ok = parse_int(value, 1, &settings.width);
+        else if (key == "height")
+            ok = parse_int(value, 1, &settings.height);
+        else
+            log_warn("config: %s:%d: unknown key '%s', skipping it", config_path.c_str(), line_number, key.c_str());
+        if (!ok)
+            log_warn("config: %s:%d: bad value '%s' for %s, skipping it",
+                     config_path.c_str(), line_number, value.c_str(), key.c_str());
+    }
+    fclose(f);
+    return settings;
+}
+
+static void split_path(const std::string &path, std::string *dir, std::string *name) {
+    size_t slash = path.rfind('/');
+    *dir = slash == std::string::npos ? "." : path.substr(0, slash);
+    *name = slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+/** Watch the directory rather than the file, editors save by renaming a new file over the old one. */
+static void watch(const std::string &path, bool is_rules) {
+    if (path.empty() || inotify_fd < 0)
+        return;
+    std::string dir, name;
+    split_path(path, &dir, &name);
+    int wd = inotify_add_watch(inotify_fd, dir.c_str(),
+                               IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ONLYDIR);
+    if (wd < 0) {
+        log_debug("config: not watching %s: %s", dir.c_str(), strerror(errno));
+        return;
+    }
+    allow_path_after_landlock(dir, false);
+    (is_rules ? watches[wd].rules_name : watches[wd].config_name) = name;
+}
+
+void config_init(const char *path_override) {
+    config_path = path_override ? path_override : default_config_path();
+    proxy_settings = load_config();
+    if (path_override && access(config_path.c_str(), R_OK) != 0)
+        log_warn("config: could not read %s: %s", config_path.c_str(), strerror(errno));
+    
+    inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (inotify_fd < 0) {
+        log_warn("config: inotify unavailable, changes need a restart");
+        return;
+    }
+    watch(config_path, false);
+    watch(rules_file(), true);
+    if (watches.empty()) {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+}
+
+int config_watch_fd() {
+    return inotify_fd;
+}
+
+unsigned config_handle_changes() {
+    bool config_touched = false;
+    bool rules_touched = false;
+    alignas(inotify_event) char buffer[4096];
+    ssize_t len;
+    while ((len = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *p = buffer; p < buffer + len;) {
+            auto event = (inotify_event *) p;
+            p += sizeof(inotify_event) + event->len;
+            auto watched = watches.find(event->wd);
+            if (watched == watches.end() || event->len == 0)
+                continue;
+            if (watched->second.config_name == event->name)
+                config_touched = true;
+            if (watched->second.rules_name == event->name)
+                rules_touched = true;
+        }
+    }
+    
+    unsigned changed = 0;
+    if (config_touched) {
+        ProxySettings settings = load_config();
+        if (settings.tag != proxy_settings.tag)
+            changed |= CONFIG_CHANGED_TAG;
+        if (settings.x != proxy_settings.x || settings.y != proxy_settings.y ||
+            settings.width != proxy_settings.width || settings.height != proxy_settings.height)
+            changed |= CONFIG_CHANGED_GEOMETRY;
+        proxy_settings = settings;
+    }
+    if (rules_touched && rules_reload())
+        changed |= CONFIG_CHANGED_RULES;
+    if (config_touched || rules_touched)
+        log_info("config: reloaded,%s%s%s%s", changed ? "" : " nothing changed",
+                 changed & CONFIG_CHANGED_TAG ? " new tag" : "",
+                 changed & CONFIG_CHANGED_GEOMETRY ? " new geometry" : "",
+                 changed & CONFIG_CHANGED_RULES ? " new rules" : "");
+    return changed;
+}
@@ -0,0 +1,54 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef FIX_X11_DOCKS_ON_WAYLAND_CONFIG_H
+#define FIX_X11_DOCKS_ON_WAYLAND_CONFIG_H
+
+#include <string>
+
+/**
+ * What every proxy looks like, from $XDG_CONFIG_HOME/fix_x11_docks/config
+ * (or --config <file>), `key = value` per line:
+ *
+ *     tag = [PROXY]
+ *     x = 0
+ *     y = 1
+ *     width = 1
+ *     height = 1
+ */
+struct ProxySettings {
+    /** Appended to every proxy title, how docks (and our next run) tell proxies apart. */
+    std::string tag = "[PROXY]";
+    /** Where proxies go, relative to the top left of their window's monitor. */
+    int x = 0;
+    int y = 1;
+    int width = 1;
+    int height = 1;
+};
+
+/** As last loaded. Wayland thread, the X thread gets its copy through set_proxy_settings(). */
+extern ProxySettings proxy_settings;
+
+/**
+ * Load the config and watch the directories of it and of the rules file
+ * through inotify. Call after rules_init() and before lock_the_land().
+ */
+void config_init(const char *path_override);
+
+/** The inotify descriptor to poll for POLLIN, -1 if there's nothing to watch. */
+int config_watch_fd();
+
+enum ConfigChange {
+    CONFIG_CHANGED_TAG = 1 << 0,
+    CONFIG_CHANGED_GEOMETRY = 1 << 1,
+    CONFIG_CHANGED_RULES = 1 << 2,
+};
+
+/**
+ * Read what config_watch_fd() has, reload the files that changed and
+ * return what is actually different now, as ConfigChange bits. Wayland thread.
+ */
+unsigned config_handle_changes();
+
+#endif //FIX_X11_DOCKS_ON_WAYLAND_CONFIG_H
@@ -0,0 +1,277 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#include "desktop_entries.h"
+#include "main.h"
+#include "log.h"
+#include "x_proxy_windows.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+static std::mutex index_mutex;
+static std::unordered_map<std::string, DesktopEntry> by_id;      // Lowercase id -> entry
+static std::unordered_map<std::string, std::string> by_wm_class; // Lowercase StartupWMClass -> lowercase id
+static std::atomic<uint64_t> generation(0);
+
+// Only touched by the indexing thread
+static std::vector<std::string> application_dirs; // In xdg_data_dirs() order, which is also priority order
+static int inotify_fd = -1;
+struct Watch {
+    int priority;
+    std::string relative_dir; // "" or "kde4/"
+};
+static std::unordered_map<int, Watch> watches;
+
+static std::string lowercase(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+    return s;
+}
+
+static bool ends_with(const std::string &s, const char *suffix) {
+    size_t len = strlen(suffix);
+    return s.size() >= len && s.compare(s.size() - len, len, suffix) == 0;
+}
+
+/** Desktop file id as defined by the spec: path below applications/ with '/' turned into '-', minus .desktop. */
+static std::string desktop_file_id(const std::string &relative_path) {
+    std::string id = relative_path.substr(0, relative_path.size() - strlen(".desktop"));
+    std::replace(id.begin(), id.end(), '/', '-');
+    return id;
+}
+
+static bool parse_desktop_file(const std::string &path, DesktopEntry *entry) {
+    FILE *f = fopen(path.c_str(), "r");
+    if (!f)
+        return false;
+
+    bool in_main_group = false;
+    bool hidden = false;
+    char line[2048];
+    while (fgets(line, sizeof(line), f)) {
+        size_t len = strcspn(line, "\r\n");
+        line[len] = '\0';
+        if (line[0] == '[') {
+            in_main_group = strcmp(line, "[Desktop Entry]") == 0;
+            continue;
+        }
+        if (!in_main_group)
+            continue;
+
+        char *equals = strchr(line, '=');
+        if (!equals)
+            continue;
+        *equals = '\0';
+        const char *key = line;
+        const char *value = equals + 1;
+        // Keys may be padded with spaces around '='
+        std::string k(key);
+        while (!k.empty() && k.back() == ' ')
+            k.pop_back();
+        while (*value == ' ')
+            value++;
+
+        if (k == "Name")
+            entry->name = value;
+        else if (k == "Icon")
+            entry->icon = value;
+        else if (k == "StartupWMClass")
+            entry->wm_class = value;
+        else if (k == "Hidden" && strcmp(value, "true") == 0)
+            hidden = true;
+    }
+    fclose(f);
+    return !hidden && !entry->name.empty();
+}
+
+static void index_file(int priority, const std::string &relative_path) {
+    DesktopEntry entry;
+    entry.id = desktop_file_id(relative_path);
+    entry.path = application_dirs[priority] + "/" + relative_path;
+    entry.priority = priority;
+    if (!parse_desktop_file(entry.path, &entry))
+        return;
+
+    std::string key = lowercase(entry.id);
+    std::lock_guard<std::mutex> lock(index_mutex);
+    auto existing = by_id.find(key);
+    if (existing != by_id.end()) {
+        // Shadowed by the same id in a more important data dir
+        if (existing->second.priority < priority)
+            return;
+        if (!existing->second.wm_class.empty())
+            by_wm_class.erase(lowercase(existing->second.wm_class));
+    }
+    if (!entry.wm_class.empty())
+        by_wm_class[lowercase(entry.wm_class)] = key;
+    by_id[key] = std::move(entry);
+}
+
+static void unindex_file(int priority, const std::string &relative_path) {
+    std::string key = lowercase(desktop_file_id(relative_path));
+    {
+        std::lock_guard<std::mutex> lock(index_mutex);
+        auto existing = by_id.find(key);
+        if (existing == by_id.end() || existing->second.priority != priority)
+            return;
+        if (!existing->second.wm_class.empty())
+            by_wm_class.erase(lowercase(existing->second.wm_class));
+        by_id.erase(existing);
+    }
+
+    // Uncover the same id in a less important data dir, if there is one
+    for (int p = priority + 1; p < (int) application_dirs.size(); p++) {
+        if (access((application_dirs[p] + "/" + relative_path).c_str(), R_OK) == 0) {
+            index_file(p, relative_path);
+            break;
+        }
+    }
+}
+
+static void index_dir(int priority, const std::string &relative_dir) {
+    std::string dir = application_dirs[priority] + "/" + relative_dir;
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return;
+
+    int wd = inotify_add_watch(inotify_fd, dir.c_str(),
+                               IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR);
+    if (wd >= 0)
+        watches[wd] = {priority, relative_dir};
+
+    while (dirent *entry = readdir(d)) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..")
+            continue;
+        bool is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = stat((dir + name).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        if (is_dir)
+            index_dir(priority, relative_dir + name + "/");
+        else if (ends_with(name, ".desktop"))
+            index_file(priority, relative_dir + name);
+    }
+    closedir(d);
+}
+
+/** Let lookups that missed try again, see desktop_entries_generation(). */
+static void index_changed() {
+    generation++;
+    wakeup();
+    wakeup_wayland();
+}
+
+static void handle_inotify_events() {
+    alignas(inotify_event) char buffer[16 * 1024];
+    while (true) {
+        ssize_t len = read(inotify_fd, buffer, sizeof(buffer));
+        if (len <= 0) {
+            if (len < 0 && errno == EINTR)
+                continue;
+            log_error("desktop entries: inotify read failed, index will no longer update");
+            return;
+        }
+
+        bool changed = false;
+        for (char *p = buffer; p < buffer + len;) {
+            auto event = (inotify_event *) p;
+            p += sizeof(inotify_event) + event->len;
+
+            auto watch = watches.find(event->wd);
+            if (watch == watches.end())
+                continue;
+            if (event->mask & IN_IGNORED) {
+                watches.erase(watch);
+                continue;
+            }
+            if (event->len == 0)
+                continue;
+
+            // Copy, index_dir() below may rehash watches
+            Watch w = watch->second;
+            std::string relative_path = w.relative_dir + event->name;
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                    index_dir(w.priority, relative_path + "/");
+                changed = true;
+            } else if (ends_with(relative_path, ".desktop")) {
+                if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+                    unindex_file(w.priority, relative_path);
+                else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+                    index_file(w.priority, relative_path);
+                log_debug("desktop entries: %s changed", relative_path.c_str());
+                changed = true;
+            }
+        }
+        if (changed)
+            index_changed();
+    }
+}
+
+static void indexer_main() {
+    for (int p = 0; p < (int) application_dirs.size(); p++)
+        index_dir(p, "");
+    {
+        std::lock_guard<std::mutex> lock(index_mutex);
+        log_debug("desktop entries: indexed %zu applications", by_id.size());
+    }
+    index_changed();
+    if (inotify_fd >= 0)
+        handle_inotify_events();
+}
+
+void desktop_entries_init() {
+    for (auto &data_dir: xdg_data_dirs()) {
+        application_dirs.push_back(data_dir + "/applications");
+        allow_path_after_landlock(application_dirs.back(), false);
+    }
+
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd < 0)
+        log_warn("desktop entries: inotify unavailable, new applications won't be picked up");
+}
+
+void desktop_entries_start() {
+    std::thread t(indexer_main);
+    t.detach();
+}
+
+uint64_t desktop_entries_generation() {
+    return generation;
+}
+
+bool desktop_entry_for_app_id(const std::string &app_id, DesktopEntry *entry) {
+    std::string key = lowercase(app_id);
+    std::lock_guard<std::mutex> lock(index_mutex);
+
+    auto found = by_id.find(key);
+    if (found == by_id.end()) {
+        auto wm_class = by_wm_class.find(key);
+        if (wm_class != by_wm_class.end())
+            found = by_id.find(wm_class->second);
+    }
+    if (found == by_id.end()) {
+        // "org.kde.dolphin" is often installed as plain "dolphin.desktop" and the other way around
+        auto dot = key.rfind('.');
+        if (dot != std::string::npos)
+            found = by_id.find(key.substr(dot + 1));
+    }
+    if (found == by_id.end())
+        return false;
+
+    *entry = found->second;
+    return true;
+}
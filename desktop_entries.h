@@ -0,0 +1,44 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef FIX_X11_DOCKS_ON_WAYLAND_DESKTOP_ENTRIES_H
+#define FIX_X11_DOCKS_ON_WAYLAND_DESKTOP_ENTRIES_H
+
+#include <string>
+#include <cstdint>
+
+struct DesktopEntry {
+    std::string id;       // "org.gnome.Nautilus" for .../applications/org.gnome.Nautilus.desktop
+    std::string path;
+    std::string name;
+    std::string icon;     // Theme icon name or absolute path
+    std::string wm_class; // StartupWMClass
+    int priority = 0;     // Index into xdg_data_dirs(), lower wins
+};
+
+/** Find the applications directories and allow them. Call before lock_the_land(). */
+void desktop_entries_init();
+
+/**
+ * Index every .desktop file under $XDG_DATA_DIRS/applications on a
+ * background thread, then keep the index current through inotify as
+ * packages come and go. Call after lock_the_land(), so the thread is
+ * sandboxed.
+ */
+void desktop_entries_start();
+
+/**
+ * Entry for a Wayland app_id, matched against the desktop file id and
+ * StartupWMClass (case-insensitively). Hash lookups only, safe from any thread.
+ */
+bool desktop_entry_for_app_id(const std::string &app_id, DesktopEntry *entry);
+
+/**
+ * 0 until the first full index is done, then bumped (and both wakeup() and
+ * wakeup_wayland() called) every time inotify changes it. A lookup that missed at an older
+ * generation is worth trying again.
+ */
+uint64_t desktop_entries_generation();
+
+#endif //FIX_X11_DOCKS_ON_WAYLAND_DESKTOP_ENTRIES_H
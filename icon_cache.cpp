@@ -0,0 +1,207 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#include "icon_cache.h"
+#include "log.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char icon_cache_magic[8] = {'F', 'X', 'D', 'I', 'C', 'O', 'N', '1'};
+static const uint32_t icon_record_magic = 0x4e4f4349; // "ICON"
+
+// Past this we start over instead of appending forever
+static const size_t icon_cache_max_size = 32 * 1024 * 1024;
+
+struct IconCacheHeader {
+    char magic[8];
+    uint32_t record_alignment; // Doubles as a check that the file was written with our struct layout
+    uint32_t unused;
+};
+
+/**
+ * Followed by app_id, theme and path (not null-terminated), padding to a
+ * multiple of 4, width * height pixels, then the _NET_WM_ICON words, all
+ * 32-bit so the payload can be handed to X as is once widened to longs.
+ */
+struct IconCacheRecord {
+    uint32_t magic;
+    uint32_t size; // Of the whole record, a multiple of 8
+    int64_t mtime_ns;
+    uint32_t width;
+    uint32_t height;
+    uint32_t net_wm_icon_words;
+    uint16_t app_id_length;
+    uint16_t theme_length;
+    uint16_t path_length;
+    uint16_t unused[3];
+};
+
+static const unsigned char *mapping = nullptr;
+static size_t mapping_size = 0;
+static int append_fd = -1;
+
+// app_id + '\n' + theme -> newest record, filled once by icon_cache_open()
+static std::unordered_map<std::string, const IconCacheRecord *> records_by_key;
+
+static std::string index_key(const std::string &app_id, const std::string &theme) {
+    return app_id + '\n' + theme;
+}
+
+static size_t strings_size(const IconCacheRecord *record) {
+    size_t size = (size_t) record->app_id_length + record->theme_length + record->path_length;
+    return (size + 3) & ~(size_t) 3;
+}
+
+static size_t record_size(size_t strings, size_t pixels, size_t words) {
+    size_t size = sizeof(IconCacheRecord) + strings + (pixels + words) * sizeof(uint32_t);
+    return (size + 7) & ~(size_t) 7;
+}
+
+static std::string cache_dir() {
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    if (cache_home && *cache_home)
+        return std::string(cache_home) + "/fix_x11_docks";
+    const char *home = getenv("HOME");
+    if (home)
+        return std::string(home) + "/.cache/fix_x11_docks";
+    return "";
+}
+
+/** Index every complete record; returns the size of the valid prefix of the file. */
+static size_t index_records() {
+    size_t offset = sizeof(IconCacheHeader);
+    while (offset + sizeof(IconCacheRecord) <= mapping_size) {
+        auto record = (const IconCacheRecord *) (mapping + offset);
+        if (record->magic != icon_record_magic || record->size % 8 != 0 ||
+            record->size > mapping_size - offset ||
+            record->size != record_size(strings_size(record), (size_t) record->width * record->height,
+                                        record->net_wm_icon_words))
+            break; // Torn by a crash halfway through an append
+        auto strings = (const char *) (record + 1);
+        records_by_key[index_key(std::string(strings, record->app_id_length),
+                        std::string(strings + record->app_id_length, record->theme_length))] = record;
+        offset += record->size;
+    }
+    return offset;
+}
+
+void icon_cache_open() {
+    std::string dir = cache_dir();
+    if (dir.empty())
+        return;
+    mkdir(dir.substr(0, dir.rfind('/')).c_str(), 0700);
+    mkdir(dir.c_str(), 0700);
+    std::string path = dir + "/icons.cache";
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        log_warn("icon cache: could not open %s: %s", path.c_str(), strerror(errno));
+        return;
+    }
+
+    struct stat st;
+    bool usable = fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(IconCacheHeader) &&
+                  (size_t) st.st_size <= icon_cache_max_size;
+    if (usable) {
+        void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m != MAP_FAILED) {
+            mapping = (const unsigned char *) m;
+            mapping_size = (size_t) st.st_size;
+            auto header = (const IconCacheHeader *) mapping;
+            usable = memcmp(header->magic, icon_cache_magic, sizeof(icon_cache_magic)) == 0 &&
+                     header->record_alignment == alignof(IconCacheRecord);
+        } else {
+            usable = false;
+        }
+    }
+
+    if (usable) {
+        size_t valid = index_records();
+        // Drop a torn tail so the next append starts on a record boundary
+        if (valid != mapping_size && ftruncate(fd, (off_t) valid) != 0)
+            usable = false;
+        log_debug("icon cache: %zu icons in %s", records_by_key.size(), path.c_str());
+    }
+    if (!usable) {
+        records_by_key.clear();
+        IconCacheHeader header = {};
+        memcpy(header.magic, icon_cache_magic, sizeof(icon_cache_magic));
+        header.record_alignment = alignof(IconCacheRecord);
+        if (ftruncate(fd, 0) != 0 || pwrite(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)) {
+            log_warn("icon cache: could not reset %s: %s", path.c_str(), strerror(errno));
+            close(fd);
+            return;
+        }
+    }
+
+    // The mapping only ever sees what was there at startup, appends go through the fd
+    append_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    close(fd);
+    if (append_fd >= 0)
+        fcntl(append_fd, F_SETFL, fcntl(append_fd, F_GETFL) | O_APPEND);
+}
+
+bool icon_cache_lookup(const std::string &app_id, const std::string &theme, const std::string &path,
+                       int64_t mtime_ns, Icon *icon) {
+    auto found = records_by_key.find(index_key(app_id, theme));
+    if (found == records_by_key.end())
+        return false;
+    const IconCacheRecord *record = found->second;
+    auto strings = (const char *) (record + 1);
+    if (record->mtime_ns != mtime_ns ||
+        path.compare(0, std::string::npos, strings + record->app_id_length + record->theme_length,
+                     record->path_length) != 0)
+        return false; // The theme now resolves to another file, or the file changed
+
+    auto words = (const uint32_t *) (strings + strings_size(record));
+    size_t pixel_count = (size_t) record->width * record->height;
+    icon->width = (int) record->width;
+    icon->height = (int) record->height;
+    icon->pixels.assign(words, words + pixel_count);
+    icon->net_wm_icon.assign(words + pixel_count, words + pixel_count + record->net_wm_icon_words);
+    return true;
+}
+
+void icon_cache_store(const std::string &app_id, const std::string &theme, const std::string &path,
+                      int64_t mtime_ns, const Icon &icon) {
+    if (append_fd < 0 || app_id.size() > UINT16_MAX || theme.size() > UINT16_MAX || path.size() > UINT16_MAX)
+        return;
+
+    IconCacheRecord record = {};
+    record.magic = icon_record_magic;
+    record.mtime_ns = mtime_ns;
+    record.width = (uint32_t) icon.width;
+    record.height = (uint32_t) icon.height;
+    record.net_wm_icon_words = (uint32_t) icon.net_wm_icon.size();
+    record.app_id_length = (uint16_t) app_id.size();
+    record.theme_length = (uint16_t) theme.size();
+    record.path_length = (uint16_t) path.size();
+    size_t strings = strings_size(&record);
+    record.size = (uint32_t) record_size(strings, icon.pixels.size(), icon.net_wm_icon.size());
+
+    // One write() per record, so concurrent appends from the workers never interleave
+    std::vector<unsigned char> buffer(record.size, 0);
+    unsigned char *p = buffer.data();
+    memcpy(p, &record, sizeof(record));
+    p += sizeof(record);
+    memcpy(p, app_id.data(), app_id.size());
+    memcpy(p + app_id.size(), theme.data(), theme.size());
+    memcpy(p + app_id.size() + theme.size(), path.data(), path.size());
+    auto words = (uint32_t *) (p + strings);
+    memcpy(words, icon.pixels.data(), icon.pixels.size() * sizeof(uint32_t));
+    words += icon.pixels.size();
+    for (unsigned long word: icon.net_wm_icon)
+        *words++ = (uint32_t) word;
+
+    if (write(append_fd, buffer.data(), buffer.size()) != (ssize_t) buffer.size())
+        log_warn("icon cache: append failed: %s", strerror(errno));
+}
@@ -0,0 +1,33 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef FIX_X11_DOCKS_ON_WAYLAND_ICON_CACHE_H
+#define FIX_X11_DOCKS_ON_WAYLAND_ICON_CACHE_H
+
+#include "icons.h"
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Decoded icons kept across runs in $XDG_CACHE_HOME/fix_x11_docks/icons.cache,
+ * so after the first start a proxy gets its icon without touching libpng.
+ *
+ * The file is a header followed by records that are only ever appended. It
+ * is mapped read-only at startup and indexed by (app_id, theme); a record
+ * only counts as a hit if it was made from the same PNG with the same mtime.
+ */
+
+/** Map the cache and open it for appending. Must be called before lock_the_land(). */
+void icon_cache_open();
+
+/** Fill `icon` from the cache. Safe from any thread. */
+bool icon_cache_lookup(const std::string &app_id, const std::string &theme, const std::string &path,
+                       int64_t mtime_ns, Icon *icon);
+
+/** Append `icon` for the next run. Safe from any thread. */
+void icon_cache_store(const std::string &app_id, const std::string &theme, const std::string &path,
+                      int64_t mtime_ns, const Icon &icon);
+
+#endif //FIX_X11_DOCKS_ON_WAYLAND_ICON_CACHE_H
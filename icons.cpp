@@ -0,0 +1,541 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#include "icons.h"
+#include "main.h"
+#include "log.h"
+#include "desktop_entries.h"
+#include "resample.h"
+#include "icon_cache.h"
+#include "trace.h"
+#include "x_proxy_windows.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <dirent.h>
+#include <fcntl.h>
+#include <png.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * A mapped GTK icon-theme.cache. The format (see gtk/gtkiconcache.c) is a
+ * big-endian hash table from icon name to the list of theme directories
+ * that contain that icon, which lets us answer lookups with a few reads
+ * from the mapping instead of stat()ing every size directory of every theme.
+ */
+struct ThemeCache {
+    std::string theme_dir;
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+};
+
+// Searched in order: the theme, the themes it inherits from, hicolor
+static std::vector<ThemeCache> theme_caches;
+
+// The theme the user picked, part of the on-disk cache key
+static std::string theme_name;
+
+// Names of the PNGs in $XDG_DATA_DIRS/pixmaps, the last resort of many apps
+static std::unordered_map<std::string, std::string> pixmaps;
+
+static const uint16_t icon_flag_has_png = 4;
+static const uint32_t no_offset = 0xffffffff;
+
+static bool read_u16(const ThemeCache &cache, uint32_t offset, uint16_t *out) {
+    if ((size_t) offset + 2 > cache.size)
+        return false;
+    *out = (uint16_t) (cache.data[offset] << 8 | cache.data[offset + 1]);
+    return true;
+}
+
+static bool read_u32(const ThemeCache &cache, uint32_t offset, uint32_t *out) {
+    if ((size_t) offset + 4 > cache.size)
+        return false;
+    const unsigned char *p = cache.data + offset;
+    *out = (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | (uint32_t) p[3];
+    return true;
+}
+
+/** Null-terminated string at `offset`, or nullptr if it runs past the end of the mapping. */
+static const char *read_string(const ThemeCache &cache, uint32_t offset) {
+    if (offset >= cache.size)
+        return nullptr;
+    const char *s = (const char *) cache.data + offset;
+    if (!memchr(s, '\0', cache.size - offset))
+        return nullptr;
+    return s;
+}
+
+/** Same hash gtk uses when writing the cache. */
+static uint32_t icon_name_hash(const char *name) {
+    const signed char *p = (const signed char *) name;
+    uint32_t h = *p;
+    if (h)
+        for (p += 1; *p != '\0'; p++)
+            h = (h << 5) - h + *p;
+    return h;
+}
+
+/** "48x48/apps" -> 48, "32x32@2/apps" -> 64, "scalable/apps" -> 0. */
+static int directory_pixel_size(const char *dir) {
+    char *end;
+    long size = strtol(dir, &end, 10);
+    if (end == dir || *end != 'x')
+        return 0;
+    const char *scale = strchr(dir, '@');
+    const char *slash = strchr(dir, '/');
+    if (scale && (!slash || scale < slash))
+        size *= atoi(scale + 1);
+    return (int) size;
+}
+
+/** Best directory of `cache` holding a PNG of `name`, or "" if it has none. */
+static std::string lookup_in_cache(const ThemeCache &cache, const std::string &name, int size) {
+    uint32_t hash_offset, directory_list_offset, bucket_count;
+    if (!read_u32(cache, 4, &hash_offset) || !read_u32(cache, 8, &directory_list_offset) ||
+        !read_u32(cache, hash_offset, &bucket_count) || bucket_count == 0)
+        return "";
+
+    uint32_t offset;
+    if (!read_u32(cache, hash_offset + 4 + 4 * (icon_name_hash(name.c_str()) % bucket_count), &offset))
+        return "";
+
+    // Chains are short, the bound only protects against a corrupt cache looping forever
+    for (int steps = 0; offset != no_offset && steps < 1024; steps++) {
+        uint32_t chain_offset, name_offset, image_list_offset;
+        if (!read_u32(cache, offset, &chain_offset) || !read_u32(cache, offset + 4, &name_offset) ||
+            !read_u32(cache, offset + 8, &image_list_offset))
+            return "";
+
+        const char *icon_name = read_string(cache, name_offset);
+        if (!icon_name || name != icon_name) {
+            offset = chain_offset;
+            continue;
+        }
+
+        uint32_t image_count, directory_count;
+        if (!read_u32(cache, image_list_offset, &image_count) ||
+            !read_u32(cache, directory_list_offset, &directory_count))
+            return "";
+
+        const char *best_dir = nullptr;
+        int best_size = 0;
+        for (uint32_t i = 0; i < image_count; i++) {
+            uint16_t directory_index, flags;
+            uint32_t directory_offset;
+            if (!read_u16(cache, image_list_offset + 4 + 8 * i, &directory_index) ||
+                !read_u16(cache, image_list_offset + 4 + 8 * i + 2, &flags))
+                return "";
+            if (!(flags & icon_flag_has_png) || directory_index >= directory_count)
+                continue;
+            if (!read_u32(cache, directory_list_offset + 4 + 4 * directory_index, &directory_offset))
+                return "";
+            const char *dir = read_string(cache, directory_offset);
+            int dir_size = dir ? directory_pixel_size(dir) : 0;
+            if (dir_size == 0)
+                continue;
+
+            // Smallest one at least as big as asked for, otherwise the biggest we have
+            bool better;
+            if (!best_dir)
+                better = true;
+            else if (best_size >= size)
+                better = dir_size >= size && dir_size < best_size;
+            else
+                better = dir_size > best_size;
+            if (better) {
+                best_dir = dir;
+                best_size = dir_size;
+            }
+        }
+        if (!best_dir)
+            return "";
+        return cache.theme_dir + "/" + best_dir + "/" + name + ".png";
+    }
+    return "";
+}
+
+std::string icon_theme_lookup(const std::string &name, int size) {
+    for (auto &cache: theme_caches) {
+        std::string path = lookup_in_cache(cache, name, size);
+        if (!path.empty())
+            return path;
+    }
+    auto pixmap = pixmaps.find(name);
+    if (pixmap != pixmaps.end())
+        return pixmap->second;
+    return "";
+}
+
+static std::vector<std::string> icon_base_dirs() {
+    std::vector<std::string> dirs;
+    const char *home = getenv("HOME");
+    const char *data_home = getenv("XDG_DATA_HOME");
+    if (data_home && *data_home)
+        dirs.push_back(std::string(data_home) + "/icons");
+    else if (home)
+        dirs.push_back(std::string(home) + "/.local/share/icons");
+    if (home)
+        dirs.push_back(std::string(home) + "/.icons");
+
+    for (auto &data_dir: xdg_data_dirs())
+        dirs.push_back(data_dir + "/icons");
+    return dirs;
+}
+
+static std::string configured_theme_name() {
+    std::string config_home;
+    const char *xdg_config_home = getenv("XDG_CONFIG_HOME");
+    const char *home = getenv("HOME");
+    if (xdg_config_home && *xdg_config_home)
+        config_home = xdg_config_home;
+    else if (home)
+        config_home = std::string(home) + "/.config";
+    else
+        return "";
+
+    for (const char *settings: {"/gtk-3.0/settings.ini", "/gtk-4.0/settings.ini"}) {
+        FILE *f = fopen((config_home + settings).c_str(), "r");
+        if (!f)
+            continue;
+        char line[512];
+        std::string theme;
+        while (fgets(line, sizeof(line), f)) {
+            const char *key = "gtk-icon-theme-name";
+            if (strncmp(line, key, strlen(key)) != 0)
+                continue;
+            char *value = strchr(line, '=');
+            if (!value)
+                continue;
+            value++;
+            while (*value == ' ' || *value == '"')
+                value++;
+            theme = value;
+            while (!theme.empty() && strchr(" \"\r\n", theme.back()))
+                theme.pop_back();
+        }
+        fclose(f);
+        if (!theme.empty())
+            return theme;
+    }
+    return "";
+}
+
+/** Themes listed by Inherits= in the first index.theme of `theme` we can find. */
+static std::vector<std::string> inherited_themes(const std::vector<std::string> &base_dirs, const std::string &theme) {
+    std::vector<std::string> parents;
+    for (auto &base: base_dirs) {
+        FILE *f = fopen((base + "/" + theme + "/index.theme").c_str(), "r");
+        if (!f)
+            continue;
+        char line[1024];
+        while (fgets(line, sizeof(line), f)) {
+            if (strncmp(line, "Inherits=", 9) != 0)
+                continue;
+            char *save;
+            for (char *t = strtok_r(line + 9, ",\r\n", &save); t; t = strtok_r(nullptr, ",\r\n", &save))
+                parents.emplace_back(t);
+            break;
+        }
+        fclose(f);
+        break;
+    }
+    return parents;
+}
+
+static void add_theme(const std::vector<std::string> &base_dirs, const std::string &theme, std::set<std::string> &seen) {
+    if (theme.empty() || !seen.insert(theme).second)
+        return;
+
+    for (auto &base: base_dirs) {
+        std::string theme_dir = base + "/" + theme;
+        int fd = open((theme_dir + "/icon-theme.cache").c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 12) {
+            void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (mapping != MAP_FAILED) {
+                theme_caches.push_back({theme_dir, (const unsigned char *) mapping, (size_t) st.st_size});
+                log_debug("Mapped icon cache of %s", theme_dir.c_str());
+            }
+        }
+        close(fd);
+    }
+
+    for (auto &parent: inherited_themes(base_dirs, theme))
+        add_theme(base_dirs, parent, seen);
+}
+
+void icons_init(const char *theme_override) {
+    std::vector<std::string> base_dirs = icon_base_dirs();
+    theme_name = theme_override ? theme_override : configured_theme_name();
+
+    std::set<std::string> seen;
+    add_theme(base_dirs, theme_name, seen);
+    add_theme(base_dirs, "hicolor", seen);
+
+    for (auto &data_dir: xdg_data_dirs()) {
+        std::string dir = data_dir + "/pixmaps";
+        DIR *d = opendir(dir.c_str());
+        if (!d)
+            continue;
+        while (dirent *entry = readdir(d)) {
+            size_t len = strlen(entry->d_name);
+            if (len > 4 && strcmp(entry->d_name + len - 4, ".png") == 0)
+                pixmaps.emplace(std::string(entry->d_name, len - 4), dir + "/" + entry->d_name);
+        }
+        closedir(d);
+        allow_path_after_landlock(dir, false);
+    }
+
+    // The caches are mapped already, but the PNGs they point to are read later
+    for (auto &base: base_dirs)
+        allow_path_after_landlock(base, false);
+
+    icon_cache_open();
+}
+
+static bool decode_png(const std::string &path, Icon *icon) {
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&image, path.c_str())) {
+        log_warn("Could not read icon %s: %s", path.c_str(), image.message);
+        return false;
+    }
+    if (image.width == 0 || image.height == 0 || image.width > 1024 || image.height > 1024) {
+        png_image_free(&image);
+        return false;
+    }
+
+    // Ask libpng for bytes that read back as 0xAARRGGBB words on this machine
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    image.format = PNG_FORMAT_BGRA;
+#else
+    image.format = PNG_FORMAT_ARGB;
+#endif
+    icon->width = (int) image.width;
+    icon->height = (int) image.height;
+    icon->pixels.resize((size_t) icon->width * icon->height);
+    if (!png_image_finish_read(&image, NULL, icon->pixels.data(), 0, NULL)) {
+        log_warn("Could not decode icon %s: %s", path.c_str(), image.message);
+        return false;
+    }
+    return true;
+}
+
+static void prepare_net_wm_icon(Icon *icon) {
+    // Scale in premultiplied space so transparent pixels don't bleed their color into the edges
+    std::vector<uint32_t> premultiplied = icon->pixels;
+    premultiply(premultiplied.data(), premultiplied.size());
+
+    int largest = std::max(icon->width, icon->height);
+    std::vector<uint32_t> scaled;
+    for (int size: net_wm_icon_sizes) {
+        if (size >= largest)
+            break;
+        int width = std::max(1, icon->width * size / largest);
+        int height = std::max(1, icon->height * size / largest);
+        scaled.resize((size_t) width * height);
+        resample_box(premultiplied.data(), icon->width, icon->height, scaled.data(), width, height);
+        // _NET_WM_ICON is read as straight alpha by everyone
+        unpremultiply(scaled.data(), scaled.size());
+
+        icon->net_wm_icon.push_back(width);
+        icon->net_wm_icon.push_back(height);
+        icon->net_wm_icon.insert(icon->net_wm_icon.end(), scaled.begin(), scaled.end());
+    }
+    if (largest <= net_wm_icon_sizes[std::size(net_wm_icon_sizes) - 1]) {
+        icon->net_wm_icon.push_back(icon->width);
+        icon->net_wm_icon.push_back(icon->height);
+        icon->net_wm_icon.insert(icon->net_wm_icon.end(), icon->pixels.begin(), icon->pixels.end());
+    }
+}
+
+/** Names (or paths) an app's icon is likely to be installed under, most specific first. */
+static std::vector<std::string> icon_name_candidates(const std::string &app_id) {
+    std::vector<std::string> names;
+    DesktopEntry entry;
+    if (desktop_entry_for_app_id(app_id, &entry) && !entry.icon.empty())
+        names.push_back(entry.icon);
+    names.push_back(app_id);
+    std::string lower = app_id;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    names.push_back(lower);
+    auto dot = lower.rfind('.');
+    if (dot != std::string::npos && dot + 1 < lower.size())
+        names.push_back(lower.substr(dot + 1));
+    return names;
+}
+
+static int64_t mtime_of(const std::string &path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return -1;
+    return (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+/** The icon the on-disk cache has for the first file `app_id` resolves to, if it's still current. */
+static std::unique_ptr<Icon> load_cached_icon(const std::string &app_id) {
+    for (auto &name: icon_name_candidates(app_id)) {
+        std::string path = name[0] == '/' ? name : icon_theme_lookup(name, preferred_icon_size);
+        if (path.empty())
+            continue;
+        int64_t mtime = mtime_of(path);
+        if (mtime < 0)
+            continue;
+        std::unique_ptr<Icon> icon(new Icon);
+        if (icon_cache_lookup(app_id, theme_name, path, mtime, icon.get()))
+            return icon;
+        return nullptr;
+    }
+    return nullptr;
+}
+
+static std::unique_ptr<Icon> load_icon(const std::string &app_id) {
+    if (std::unique_ptr<Icon> icon = load_cached_icon(app_id))
+        return icon;
+    TraceSpan span("icon_decode");
+    for (auto &name: icon_name_candidates(app_id)) {
+        std::string path = name[0] == '/' ? name : icon_theme_lookup(name, preferred_icon_size);
+        if (path.empty())
+            continue;
+        int64_t mtime = mtime_of(path);
+        std::unique_ptr<Icon> icon(new Icon);
+        if (decode_png(path, icon.get())) {
+            prepare_net_wm_icon(icon.get());
+            log_debug("Icon for '%s': %s", app_id.c_str(), path.c_str());
+            if (mtime >= 0)
+                icon_cache_store(app_id, theme_name, path, mtime, *icon);
+            return icon;
+        }
+    }
+    return nullptr;
+}
+
+// X thread only
+static std::unordered_map<std::string, std::unique_ptr<Icon>> cache;
+static std::unordered_set<std::string> in_flight;
+static uint64_t misses_generation = 0; // desktop_entries_generation() the nullptrs in cache missed at
+
+// Shared between x_main and the workers
+static std::mutex pool_mutex;
+static std::condition_variable pool_cv;
+static std::deque<std::string> pending;
+struct FinishedIcon {
+    std::string app_id;
+    std::unique_ptr<Icon> icon;
+    uint64_t generation; // desktop_entries_generation() when the lookup began
+};
+static std::vector<FinishedIcon> finished;
+static bool workers_started = false;
+
+static void worker_main() {
+    while (true) {
+        std::string app_id;
+        {
+            std::unique_lock<std::mutex> lock(pool_mutex);
+            pool_cv.wait(lock, [] { return !pending.empty(); });
+            app_id = std::move(pending.front());
+            pending.pop_front();
+        }
+
+        uint64_t generation = desktop_entries_generation();
+        std::unique_ptr<Icon> icon = load_icon(app_id);
+
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            finished.push_back({std::move(app_id), std::move(icon), generation});
+        }
+        wakeup();
+    }
+}
+
+void icons_start_workers() {
+    unsigned count = std::max(1u, std::min(4u, std::thread::hardware_concurrency()));
+    for (unsigned i = 0; i < count; i++) {
+        std::thread t(worker_main);
+        t.detach();
+    }
+    workers_started = true;
+}
+
+/** Hand `app_id` to the workers, its icon comes back through icons_take_ready(). */
+static void queue_icon(const std::string &app_id) {
+    in_flight.insert(app_id);
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        pending.push_back(app_id);
+    }
+    pool_cv.notify_one();
+}
+
+const Icon *icon_for_app_id(const std::string &app_id) {
+    auto cached = cache.find(app_id);
+    if (cached != cache.end())
+        return cached->second.get();
+    if (in_flight.count(app_id))
+        return nullptr;
+
+    if (!workers_started) {
+        // Nothing to hand it to, decode in place
+        return cache.emplace(app_id, load_icon(app_id)).first->second.get();
+    }
+    queue_icon(app_id);
+    return nullptr;
+}
+
+std::vector<std::string> icons_take_ready() {
+    std::vector<FinishedIcon> done;
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        done.swap(finished);
+    }
+
+    // The desktop entries changed (or finished indexing) since the misses
+    // were cached, an app installed since, or one we looked up too early,
+    // may have an icon now
+    uint64_t generation = desktop_entries_generation();
+    if (generation != misses_generation) {
+        misses_generation = generation;
+        for (auto it = cache.begin(); it != cache.end();) {
+            if (it->second) {
+                ++it;
+                continue;
+            }
+            if (workers_started)
+                queue_icon(it->first);
+            it = cache.erase(it);
+        }
+    }
+
+    std::vector<std::string> ready;
+    for (auto &f: done) {
+        in_flight.erase(f.app_id);
+        if (f.icon) {
+            ready.push_back(f.app_id);
+            cache[f.app_id] = std::move(f.icon);
+        } else if (f.generation != generation) {
+            // Missed against an index that has changed since, don't trust it
+            queue_icon(f.app_id);
+        } else {
+            cache[f.app_id] = nullptr;
+        }
+    }
+    return ready;
+}
@@ -0,0 +1,73 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef FIX_X11_DOCKS_ON_WAYLAND_ICONS_H
+#define FIX_X11_DOCKS_ON_WAYLAND_ICONS_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/** Size docks most commonly ask for, we pick the theme directory closest to it. */
+const int preferred_icon_size = 48;
+
+/**
+ * Sizes put into _NET_WM_ICON, the ones docks ask for. It's a per-window
+ * property, so its bytes go over the wire again for every proxy; the full
+ * resolution icon is uploaded once per app as a pixmap all proxies
+ * reference through WM_HINTS.
+ */
+const int net_wm_icon_sizes[] = {16, 32, 48, 64};
+
+struct Icon {
+    int width = 0;
+    int height = 0;
+
+    /** Non-premultiplied 0xAARRGGBB, row by row. */
+    std::vector<uint32_t> pixels;
+
+    /**
+     * Ready to hand to XChangeProperty(_NET_WM_ICON): for each of
+     * net_wm_icon_sizes smaller than the icon (and the icon itself if it's no
+     * bigger than the largest), width, height, then one pixel per long.
+     */
+    std::vector<unsigned long> net_wm_icon;
+};
+
+/**
+ * Map the icon-theme.cache of the icon theme (`theme_override`, or the one
+ * from gtk's settings.ini), the themes it inherits from and hicolor.
+ * Must be called before lock_the_land().
+ */
+void icons_init(const char *theme_override);
+
+/**
+ * Path of the PNG that best matches `name` at `size` pixels, or "" if no
+ * theme has one. Answered from the mapped caches, never touches the disk.
+ */
+std::string icon_theme_lookup(const std::string &name, int size);
+
+/**
+ * Start the threads that decode and scale icons, so x_main never stalls on
+ * a PNG. Call after icons_init() and lock_the_land(), so they're sandboxed.
+ */
+void icons_start_workers();
+
+/**
+ * Decoded icon for `app_id`, or nullptr if there is none or it isn't ready
+ * yet. The first call for an app_id queues it on the workers, which call
+ * wakeup() when done. Cached per app_id; misses only until the desktop
+ * entries change, see icons_take_ready(). X thread only.
+ */
+const Icon *icon_for_app_id(const std::string &app_id);
+
+/**
+ * App ids whose icon was queued by icon_for_app_id() and has since finished
+ * decoding; icon_for_app_id() returns it from now on. Also looks up every
+ * cached miss again once desktop_entries_generation() moves, so call it
+ * after each wakeup(). X thread only.
+ */
+std::vector<std::string> icons_take_ready();
+
+#endif //FIX_X11_DOCKS_ON_WAYLAND_ICONS_H
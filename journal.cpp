@@ -0,0 +1,179 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#include "journal.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+bool journal_enabled = false;
+
+static const char journal_magic[8] = {'F', 'X', 'D', 'J', 'R', 'N', 'L', '1'};
+const uint32_t journal_version = 1;
+
+static JournalHeader *header = nullptr;
+static JournalRecord *records = nullptr;
+
+static const char *event_names[JOURNAL_EVENT_COUNT] = {
+        "toplevel_new",
+        "toplevel_title",
+        "toplevel_app_id",
+        "toplevel_identifier",
+        "toplevel_state",
+        "toplevel_done",
+        "toplevel_closed",
+        "activate",
+        "close",
+        "x_event",
+        "proxy_create",
+        "proxy_title",
+        "proxy_destroy",
+};
+
+static size_t journal_size() {
+    return sizeof(JournalHeader) + journal_capacity * sizeof(JournalRecord);
+}
+
+bool journal_open(const char *path) {
+    std::string previous = std::string(path) + ".1";
+    if (access(path, F_OK) == 0 && rename(path, previous.c_str()) != 0)
+        fprintf(stderr, "ERROR: could not keep previous journal as %s: %s\n", previous.c_str(), strerror(errno));
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: could not open journal %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    // fallocate rather than ftruncate so a full disk fails here and not as a SIGBUS later
+    int err = posix_fallocate(fd, 0, (off_t) journal_size());
+    if (err != 0) {
+        fprintf(stderr, "ERROR: could not allocate journal %s: %s\n", path, strerror(err));
+        close(fd);
+        return false;
+    }
+    void *mapping = mmap(NULL, journal_size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "ERROR: could not map journal %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    header = (JournalHeader *) mapping;
+    memcpy(header->magic, journal_magic, sizeof(journal_magic));
+    header->version = journal_version;
+    header->record_size = sizeof(JournalRecord);
+    header->capacity = journal_capacity;
+    header->next_sequence.store(1, std::memory_order_relaxed);
+    records = (JournalRecord *) ((char *) mapping + sizeof(JournalHeader));
+
+    journal_enabled = true;
+    return true;
+}
+
+static int32_t current_tid() {
+    static thread_local int32_t tid = (int32_t) syscall(SYS_gettid);
+    return tid;
+}
+
+void journal_write(JournalEvent type, int64_t toplevel, uint64_t arg, const char *text, uint16_t detail) {
+    uint64_t sequence = header->next_sequence.fetch_add(1, std::memory_order_relaxed);
+    JournalRecord &record = records[(sequence - 1) % journal_capacity];
+
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts); // vDSO, no syscall
+
+    // Invalidate first so a reader never pairs the new sequence with stale fields
+    record.sequence = 0;
+    std::atomic_signal_fence(std::memory_order_release);
+    record.time_ns = (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+    record.type = type;
+    record.detail = detail;
+    record.tid = current_tid();
+    record.toplevel = toplevel;
+    record.arg = arg;
+    if (text) {
+        strncpy(record.text, text, sizeof(record.text) - 1);
+        record.text[sizeof(record.text) - 1] = '\0';
+    } else {
+        record.text[0] = '\0';
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    record.sequence = sequence;
+}
+
+int journal_dump(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: could not open journal %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(JournalHeader)) {
+        fprintf(stderr, "ERROR: %s is not a journal\n", path);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "ERROR: could not map journal %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    auto h = (const JournalHeader *) mapping;
+    if (memcmp(h->magic, journal_magic, sizeof(journal_magic)) != 0 || h->version != journal_version ||
+        h->record_size != sizeof(JournalRecord) ||
+        sizeof(JournalHeader) + h->capacity * sizeof(JournalRecord) > (size_t) st.st_size) {
+        fprintf(stderr, "ERROR: %s is not a journal written by this version\n", path);
+        munmap(mapping, st.st_size);
+        return EXIT_FAILURE;
+    }
+    auto r = (const JournalRecord *) ((const char *) mapping + sizeof(JournalHeader));
+
+    // The ring is ordered by sequence, so start right after the newest record
+    uint64_t next = h->next_sequence.load(std::memory_order_relaxed);
+    uint64_t first = next > h->capacity ? next - h->capacity : 1;
+    printf("# %llu events recorded, showing the last %llu\n",
+           (unsigned long long) (next - 1), (unsigned long long) (next - first));
+    for (uint64_t sequence = first; sequence < next; sequence++) {
+        const JournalRecord &record = r[(sequence - 1) % h->capacity];
+        if (record.sequence != sequence)
+            continue; // Torn by the crash
+
+        time_t seconds = (time_t) (record.time_ns / 1000000000ull);
+        struct tm tm;
+        localtime_r(&seconds, &tm);
+        char when[32];
+        strftime(when, sizeof(when), "%F %T", &tm);
+
+        const char *name = record.type < JOURNAL_EVENT_COUNT ? event_names[record.type] : "unknown";
+        char text[sizeof(record.text) + 1];
+        memcpy(text, record.text, sizeof(record.text));
+        text[sizeof(record.text)] = '\0';
+
+        printf("%s.%06llu tid=%d %-19s", when, (unsigned long long) (record.time_ns % 1000000000ull) / 1000,
+               record.tid, name);
+        if (record.toplevel >= 0)
+            printf(" toplevel=%lld", (long long) record.toplevel);
+        if (record.type == JOURNAL_X_EVENT)
+            printf(" x_type=%d", record.detail);
+        if (record.arg)
+            printf(" arg=0x%llx", (unsigned long long) record.arg);
+        if (text[0])
+            printf(" '%s'", text);
+        putchar('\n');
+    }
+
+    munmap(mapping, st.st_size);
+    return EXIT_SUCCESS;
+}
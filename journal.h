@@ -0,0 +1,80 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef FIX_X11_DOCKS_ON_WAYLAND_JOURNAL_H
+#define FIX_X11_DOCKS_ON_WAYLAND_JOURNAL_H
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Flight recorder for post-mortem analysis.
+ *
+ * The last journal_capacity Wayland and X events are kept in a ring that lives
+ * in a MAP_SHARED file mapping. Recording one is a handful of plain stores into
+ * page cache, so it costs no syscall, and whatever was written is still in the
+ * file after a SIGSEGV or SIGKILL. Read it back with --dump-journal.
+ */
+
+enum JournalEvent : uint16_t {
+    JOURNAL_TOPLEVEL_NEW,
+    JOURNAL_TOPLEVEL_TITLE,
+    JOURNAL_TOPLEVEL_APP_ID,
+    JOURNAL_TOPLEVEL_IDENTIFIER,
+    JOURNAL_TOPLEVEL_STATE,
+    JOURNAL_TOPLEVEL_DONE,
+    JOURNAL_TOPLEVEL_CLOSED,
+    JOURNAL_ACTIVATE,
+    JOURNAL_CLOSE,
+    JOURNAL_X_EVENT,
+    JOURNAL_PROXY_CREATE,
+    JOURNAL_PROXY_TITLE,
+    JOURNAL_PROXY_DESTROY,
+    JOURNAL_EVENT_COUNT,
+};
+
+const uint64_t journal_capacity = 16384;
+
+struct JournalRecord {
+    uint64_t sequence; // 1-based, 0 means the slot was never written
+    uint64_t time_ns;  // CLOCK_REALTIME
+    uint16_t type;
+    uint16_t detail;   // X event type for JOURNAL_X_EVENT
+    int32_t tid;
+    int64_t toplevel;  // -1 when not about a toplevel
+    uint64_t arg;      // Window id or state bits
+    char text[24];     // Truncated title or app-id
+};
+
+struct JournalHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t capacity;
+    std::atomic<uint64_t> next_sequence;
+    char reserved[32];
+};
+
+/** Set once from main() before any thread is started. */
+extern bool journal_enabled;
+
+/**
+ * Map the journal at `path`, moving a previous one to `path`.1 so a crash
+ * followed by a restart doesn't overwrite the evidence. Must be called
+ * before lock_the_land(). Returns false on error.
+ */
+bool journal_open(const char *path);
+
+void journal_write(JournalEvent type, int64_t toplevel, uint64_t arg, const char *text, uint16_t detail);
+
+inline void journal_record(JournalEvent type, int64_t toplevel, uint64_t arg = 0, const char *text = nullptr,
+                           uint16_t detail = 0) {
+    if (journal_enabled)
+        journal_write(type, toplevel, arg, text, detail);
+}
+
+/** Print the journal at `path` as text, oldest event first. Returns an exit status. */
+int journal_dump(const char *path);
+
+#endif //FIX_X11_DOCKS_ON_WAYLAND_JOURNAL_H
@@ -0,0 +1,170 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#include "log.h"
+
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <thread>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+int log_level = LOG_LEVEL_INFO;
+
+static const char *level_names[] = {"error", "warn", "info", "debug", "trace"};
+
+// Bounded multi-producer ring (Dmitry Vyukov's design). Each slot carries a
+// sequence number telling producers and the writer whose turn it is, so
+// neither side ever takes a lock to hand over a message.
+const size_t log_slot_count = 1024; // Must be a power of two
+const size_t log_message_size = 256;
+
+struct LogSlot {
+    std::atomic<size_t> sequence;
+    int level;
+    char text[log_message_size];
+};
+
+static LogSlot slots[log_slot_count];
+static std::atomic<size_t> enqueue_position{0};
+static size_t dequeue_position = 0; // Only touched by the writer thread
+static std::atomic<size_t> dropped{0};
+
+// The writer sleeps in read() on the eventfd only when the ring is empty,
+// producers write() to it only when they find it asleep. That write() never
+// blocks (only a counter at 2^64 - 1 would) and takes no lock; a wakeup too
+// many only costs the writer an empty drain().
+static std::atomic<bool> writer_idle{false};
+static int writer_wakeup_fd = -1;
+static std::thread writer;
+static bool writer_running = false;
+static std::atomic<bool> stopping{false};
+
+bool log_set_level(const char *name) {
+    for (int i = LOG_LEVEL_ERROR; i <= LOG_LEVEL_TRACE; i++) {
+        if (strcmp(name, level_names[i]) == 0) {
+            log_level = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void wake_writer() {
+    uint64_t one = 1;
+    if (writer_wakeup_fd >= 0)
+        write(writer_wakeup_fd, &one, sizeof(one));
+}
+
+void log_message(int level, const char *format, ...) {
+    size_t position = enqueue_position.load(std::memory_order_relaxed);
+    LogSlot *slot;
+    while (true) {
+        slot = &slots[position & (log_slot_count - 1)];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t) sequence - (intptr_t) position;
+        if (diff == 0) {
+            if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            // Full: the writer is behind, rather lose a message than stall the caller
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            position = enqueue_position.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->level = level;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(slot->text, log_message_size, format, args);
+    va_end(args);
+    slot->sequence.store(position + 1, std::memory_order_release);
+
+    if (writer_idle.load(std::memory_order_relaxed) && writer_idle.exchange(false))
+        wake_writer();
+}
+
+/** Write out every message that is ready. Returns false if there was nothing to write. */
+static bool drain() {
+    char batch[16 * 1024];
+    size_t used = 0;
+    bool wrote_any = false;
+
+    while (true) {
+        LogSlot *slot = &slots[dequeue_position & (log_slot_count - 1)];
+        if (slot->sequence.load(std::memory_order_acquire) != dequeue_position + 1)
+            break;
+
+        size_t needed = strlen(level_names[slot->level]) + strlen(slot->text) + 4;
+        if (used + needed >= sizeof(batch)) { // snprintf() needs room for the NUL too
+            write(STDERR_FILENO, batch, used);
+            used = 0;
+        }
+        used += snprintf(batch + used, sizeof(batch) - used, "[%s] %s\n", level_names[slot->level], slot->text);
+
+        slot->sequence.store(dequeue_position + log_slot_count, std::memory_order_release);
+        dequeue_position++;
+        wrote_any = true;
+    }
+
+    size_t lost = dropped.exchange(0);
+    if (lost > 0) {
+        char line[64];
+        size_t needed = snprintf(line, sizeof(line), "[warn] log ring full, dropped %zu messages\n", lost);
+        if (used + needed > sizeof(batch)) {
+            write(STDERR_FILENO, batch, used);
+            used = 0;
+        }
+        memcpy(batch + used, line, needed);
+        used += needed;
+    }
+    if (used > 0)
+        write(STDERR_FILENO, batch, used);
+    return wrote_any;
+}
+
+static void writer_main() {
+    while (!stopping) {
+        if (drain())
+            continue;
+
+        writer_idle = true;
+        // A producer may have published right before we went idle
+        if (drain()) {
+            writer_idle = false;
+            continue;
+        }
+        uint64_t count;
+        if (writer_wakeup_fd < 0 || read(writer_wakeup_fd, &count, sizeof(count)) < 0)
+            usleep(10 * 1000); // No eventfd, poll the ring instead
+    }
+    drain();
+}
+
+void log_init() {
+    for (size_t i = 0; i < log_slot_count; i++)
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    writer_wakeup_fd = eventfd(0, EFD_CLOEXEC);
+    if (writer_wakeup_fd < 0)
+        perror("log: eventfd");
+}
+
+void log_start_writer() {
+    writer = std::thread(writer_main);
+    writer_running = true;
+}
+
+void log_shutdown() {
+    if (!writer_running)
+        return;
+    stopping = true;
+    wake_writer();
+    writer.join();
+    writer_running = false;
+}
@@ -0,0 +1,50 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef FIX_X11_DOCKS_ON_WAYLAND_LOG_H
+#define FIX_X11_DOCKS_ON_WAYLAND_LOG_H
+
+/**
+ * Leveled logging that never blocks the caller.
+ *
+ * Messages are formatted straight into a slot of a fixed, lock-free ring and
+ * written out by a background thread, so logging from the X or Wayland thread
+ * costs a vsnprintf, plus a write() to an eventfd when the writer is asleep.
+ * No locks anywhere on that path. Below the current level the macros don't
+ * even evaluate their arguments.
+ */
+
+enum LogLevel {
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_INFO,   // Default: startup and shutdown only, nothing per event
+    LOG_LEVEL_DEBUG,  // Toplevel and proxy lifecycle
+    LOG_LEVEL_TRACE,  // Every wakeup and X event
+};
+
+extern int log_level;
+
+/** Parses "error", "warn", "info", "debug" or "trace". Returns false if `name` is none of those. */
+bool log_set_level(const char *name);
+
+/** Set up the ring. Messages wait in it until log_start_writer(). */
+void log_init();
+
+/** Start the writer thread. After lock_the_land(), so it's sandboxed too. */
+void log_start_writer();
+
+/** Write out everything still queued and stop the writer thread. */
+void log_shutdown();
+
+void log_message(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+#define LOG_AT(level, ...) do { if ((level) <= log_level) log_message((level), __VA_ARGS__); } while (0)
+
+#define log_error(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define log_warn(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define log_info(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_debug(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define log_trace(...) LOG_AT(LOG_LEVEL_TRACE, __VA_ARGS__)
+
+#endif //FIX_X11_DOCKS_ON_WAYLAND_LOG_H
@@ -18,6 +18,18 @@
 
 #include "main.h"
 #include "x_proxy_windows.h"
+#include "metrics.h"
+#include "trace.h"
+#include "probes.h"
+#include "log.h"
+#include "journal.h"
+#include "icons.h"
+#include "desktop_entries.h"
+#include "thumbnails.h"
+#include "rules.h"
+#include "config.h"
+#include "workspaces.h"
+#include "outputs.h"
 
 #include <ctype.h>
 #include <signal.h>
@@ -27,7 +39,15 @@
 #include <unistd.h>
 #include <errno.h>
 #include <assert.h>
-#include <setjmp.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <unordered_map>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
 #include <wayland-client.h>
 
 #ifdef __linux__
@@ -54,16 +74,30 @@
 #define max_supported_landlock_abi 3
 
 const char usage[] =
-        "Usage: lswt [options...]\n"
-        "  -h,       --help            Print this helpt text and exit.\n"
+        "Usage: fix_x11_docks [options...]\n"
+        "  -h,       --help            Print this help text and exit.\n"
         "  -v,       --version         Print version and exit.\n"
-        "  -j,       --json            Output data in JSON format.\n"
-        "  -w,       --watch           Run continously and log title, identifier\n"
-        "                              and app-id events.\n"
-        "  -W,       --verbose-watch   Like --watch, but also log activated, fullscreen,\n"
-        "                              minimized and maximized state.\n"
-        "  -c <fmt>, --custom <fmt>    Define a custom line-based output format.\n"
-        "  --force-protocol <name>     Use specified protocol, do not fall back onto others.";
+        "  -d,       --debug           Same as --log-level debug.\n"
+        "  --log-level <level>         One of error, warn, info (default), debug or trace.\n"
+        "  --metrics <path>            Serve Prometheus metrics on a Unix socket at <path>.\n"
+        "  --journal <file>            Keep the last events in a crash-proof memory-mapped\n"
+        "                              journal at <file> (the previous one moves to <file>.1).\n"
+        "  --dump-journal <file>       Print a journal as text and exit.\n"
+        "  --icon-theme <name>         Icon theme for proxy icons, instead of gtk's setting.\n"
+        "  --previews                  Let docks request window thumbnails from proxies\n"
+        "                              (needs ext-image-copy-capture-v1 and MIT-SHM).\n"
+        "  --keep-proxies              Leave the proxies up on exit, for the next run to\n"
+        "                              adopt (restarts without docks redrawing).\n"
+        "  --rules <file>              Which windows get a proxy, instead of\n"
+        "                              $XDG_CONFIG_HOME/fix_x11_docks/rules.\n"
+        "  --config <file>             Proxy tag and geometry, instead of\n"
+        "                              $XDG_CONFIG_HOME/fix_x11_docks/config.\n"
+        "  --current-workspace         Unmap the proxies of windows on workspaces that\n"
+        "                              aren't shown (needs ext-workspace-v1).\n"
+        "  --skip-transients           No proxies for dialogs and other child windows,\n"
+        "                              instead of ones with WM_TRANSIENT_FOR.\n"
+        "  --trace <file>              Record a Chrome trace-event timeline, written to <file>\n"
+        "                              on exit and whenever SIGUSR1 is received.\n";
 
 enum Output_format {
     NORMAL,
@@ -85,9 +119,8 @@ enum Mode mode = WATCH;
 size_t longest_app_id = 7; // strlen("app-id:")
 const size_t max_app_id_padding = 40;
 
-int ret = EXIT_SUCCESS;
-bool loop = true;
-bool debug_log = false;
+volatile sig_atomic_t ret = EXIT_SUCCESS;
+volatile sig_atomic_t loop = true; // Cleared by handle_interrupt() too
 
 struct wl_display *wl_display = NULL;
 struct wl_registry *wl_registry = NULL;
@@ -112,12 +145,9 @@ bool force_protocol = true;
 
 struct wl_list toplevels;
 
-/* We want to cleanly exit on SIGINT (f.e. when Ctrl-C is pressed in WATCH mode)
- * however after exiting the signal handler wl_display_dispatch() will just
- * continue until the next event from the server. We can not sync in the signal
- * handler, so let's just long-jump to right before the main-loop and skip it.
- */
-jmp_buf skip_main_loop;
+/** Toplevels by their ext-foreign-toplevel identifier, for exact matching. */
+static std::unordered_map<std::string, Toplevel *> toplevels_by_identifier;
+
 
 /**********************
  *                    *
@@ -139,6 +169,8 @@ static void update_capabilities(void) {
             support_activated = true;
             support_maximized = true;
             support_minimized = true;
+            // Joined in from the ext list if the compositor has both, see join_ext_records()
+            support_identifier = ext_toplevel_list != NULL;
             break;
         
         case EXT_FOREIGN_TOPLEVEL:
@@ -154,6 +186,9 @@ static void update_capabilities(void) {
         print_state = true;
 }
 
+/** Whether the toplevels open when we connected have all been announced. */
+static bool toplevels_announced = false;
+
 /** Allocate a new Toplevel and initialize it. Returns pointer to the Toplevel. */
 Toplevel *toplevel_new(void) {
     auto toplevel = new Toplevel;
@@ -172,22 +207,40 @@ Toplevel *toplevel_new(void) {
     toplevel->identifier = "";
     toplevel->listed = false;
     
+    toplevel->preexisting = !toplevels_announced;
     toplevel->fullscreen = false;
     toplevel->activated = false;
     toplevel->maximized = false;
     toplevel->minimized = false;
     
-    if (mode == WATCH || mode == VERBOSE_WATCH || debug_log)
-        fprintf(stdout, "toplevel %ld: created\n", toplevel->id);
+    if (mode == WATCH || mode == VERBOSE_WATCH)
+        log_debug("toplevel %ld: created", toplevel->id);
+    metrics_gauge_add(metrics.live_toplevels, 1);
+    PROBE1(toplevel_create, toplevel->id);
+    journal_record(JOURNAL_TOPLEVEL_NEW, toplevel->id);
     
     return toplevel;
 }
 
+static void unjoin_ext_record(Toplevel *toplevel);
+static void orphan_children(Toplevel *toplevel);
+
 /** Destroys a toplevel and removes it from the list, if it is listed. */
 static void toplevel_destroy(struct Toplevel *self) {
+    unjoin_ext_record(self);
+    workspaces_forget(self);
+    outputs_forget(self);
+    orphan_children(self);
+    auto indexed = toplevels_by_identifier.find(self->identifier);
+    if (indexed != toplevels_by_identifier.end() && indexed->second == self)
+        toplevels_by_identifier.erase(indexed);
     destroy_proxy_for(self);
-    if (mode == WATCH || mode == VERBOSE_WATCH || debug_log)
-        fprintf(stdout, "toplevel %ld: destroyed\n", self->id);
+    thumbnails_forget(self);
+    if (mode == WATCH || mode == VERBOSE_WATCH)
+        log_debug("toplevel %ld: destroyed", self->id);
+    metrics_gauge_add(metrics.live_toplevels, -1);
+    PROBE1(toplevel_destroy, self->id);
+    journal_record(JOURNAL_TOPLEVEL_CLOSED, self->id);
     
     if (self->zwlr_handle != NULL)
         zwlr_foreign_toplevel_handle_v1_destroy(self->zwlr_handle);
@@ -200,19 +253,18 @@ static void toplevel_destroy(struct Toplevel *self) {
 
 /** Set the title of the toplevel. Called from protocol implementations. */
 static void toplevel_set_title(struct Toplevel *self, const char *title) {
+    journal_record(JOURNAL_TOPLEVEL_TITLE, self->id, 0, title);
     self->old_title = self->title;
-    if (mode == WATCH || mode == VERBOSE_WATCH || debug_log) {
+    if (mode == WATCH || mode == VERBOSE_WATCH) {
         if (self->title.empty())
-            fprintf(
-                    stdout,
-                    "toplevel %ld: set title: '%s'\n",
+            log_debug(
+                    "toplevel %ld: set title: '%s'",
                     self->id, title
             );
         
         else
-            fprintf(
-                    stdout,
-                    "toplevel %ld: change title: '%s' -> '%s'\n",
+            log_debug(
+                    "toplevel %ld: change title: '%s' -> '%s'",
                     self->id, self->title.c_str(), title
             );
     }
@@ -229,24 +281,23 @@ static void toplevel_set_title(struct Toplevel *self, const char *title) {
 static size_t real_strlen(const char *str);
 
 static void toplevel_set_app_id(struct Toplevel *self, const char *app_id) {
-    if (mode == WATCH || mode == VERBOSE_WATCH || debug_log) {
+    journal_record(JOURNAL_TOPLEVEL_APP_ID, self->id, 0, app_id);
+    if (mode == WATCH || mode == VERBOSE_WATCH) {
         if (self->app_id.empty())
-            fprintf(
-                    stdout,
-                    "toplevel %ld: set app-id: '%s'\n",
+            log_debug(
+                    "toplevel %ld: set app-id: '%s'",
                     self->id, app_id
             );
         
         else
-            fprintf(
-                    stdout,
-                    "toplevel %ld: change app-id: '%s' -> '%s'\n",
+            log_debug(
+                    "toplevel %ld: change app-id: '%s' -> '%s'",
                     self->id, self->app_id.c_str(), app_id
             );
     }
     
     if (!self->app_id.empty())
-        self->app_id;
+        self->app_id = "";
     self->app_id = strdup(app_id);
     if (self->app_id.empty()) {
         fprintf(stderr, "ERROR: strdup(): %s\n", strerror(errno));
@@ -257,16 +308,14 @@ static void toplevel_set_app_id(struct Toplevel *self, const char *app_id) {
     const size_t len = real_strlen(app_id);
     if (len > longest_app_id && max_app_id_padding > len)
         longest_app_id = len;
-    
-    create_proxy_for(self);
 }
 
 /** Set the identifier of the toplevel. Called from protocol implementations. */
 static void toplevel_set_identifier(struct Toplevel *self, const char *identifier) {
-    if (mode == WATCH || mode == VERBOSE_WATCH || debug_log)
-        fprintf(
-                stdout,
-                "toplevel %ld: set identifier: %s\n",
+    journal_record(JOURNAL_TOPLEVEL_IDENTIFIER, self->id, 0, identifier);
+    if (mode == WATCH || mode == VERBOSE_WATCH)
+        log_debug(
+                "toplevel %ld: set identifier: %s",
                 self->id, identifier
         );
     
@@ -281,58 +330,94 @@ static void toplevel_set_identifier(struct Toplevel *self, const char *identifie
     self->identifier = strdup(identifier);
     if (self->identifier.empty())
         fprintf(stderr, "ERROR: strdup(): %s\n", strerror(errno));
+    else
+        toplevels_by_identifier[self->identifier] = self;
 }
 
 static void toplevel_set_fullscreen(struct Toplevel *self, bool fullscreen) {
-    if (mode == VERBOSE_WATCH || debug_log)
-        fprintf(
-                stdout,
-                "toplevel %ld: fullscreen: %s\n",
-                self->id, BOOL_TO_STR(fullscreen)
-        );
+    log_trace("toplevel %ld: fullscreen: %s", self->id, BOOL_TO_STR(fullscreen));
     
     self->fullscreen = fullscreen;
 }
 
 static void toplevel_set_activated(struct Toplevel *self, bool activated) {
-    if (mode == VERBOSE_WATCH || debug_log)
-        fprintf(
-                stdout,
-                "toplevel %ld: activated (focused): %s\n",
-                self->id, BOOL_TO_STR(activated)
-        );
+    log_trace("toplevel %ld: activated (focused): %s", self->id, BOOL_TO_STR(activated));
     self->activated = activated;
 }
 
 static void toplevel_set_maximized(struct Toplevel *self, bool maximized) {
-    if (mode == VERBOSE_WATCH || debug_log)
-        fprintf(
-                stdout,
-                "toplevel %ld: maximized: %s\n",
-                self->id, BOOL_TO_STR(maximized)
-        );
+    log_trace("toplevel %ld: maximized: %s", self->id, BOOL_TO_STR(maximized));
     self->maximized = maximized;
 }
 
 static void toplevel_set_minimized(struct Toplevel *self, bool minimized) {
-    if (mode == VERBOSE_WATCH || debug_log)
-        fprintf(
-                stdout,
-                "toplevel %ld: minimized: %s\n",
-                self->id, BOOL_TO_STR(minimized)
-        );
+    log_trace("toplevel %ld: minimized: %s", self->id, BOOL_TO_STR(minimized));
     self->minimized = minimized;
 }
 
-static void toplevel_done(struct Toplevel *self) {
-    if (debug_log)
-        fprintf(stderr, "[toplevel %ld: done]\n", self->id);
-    
-    if (self->listed)
+static void join_ext_records();
+
+/**
+ * Give the toplevel a proxy or take it away, depending on whether it has an
+ * app_id and a name (see has_proxy_name()) and passes the rules now. Filtered toplevels never reach
+ * the X thread.
+ */
+static void apply_rules(struct Toplevel *self) {
+    bool wanted = !self->app_id.empty() && has_proxy_name(self) && rules_allow(self);
+    if (wanted == self->wants_proxy)
         return;
-    self->listed = true;
+    self->wants_proxy = wanted;
+    if (wanted) {
+        create_proxy_for(self);
+    } else {
+        log_debug("toplevel %ld: excluded by the rules", self->id);
+        destroy_proxy_for(self);
+        self->x11_proxy_window_id = 0;
+        // The X thread forgets its placement along with the proxy
+        self->sent_desktop = -1;
+        self->sent_mapped = true;
+        self->sent_output.clear();
+        self->sent_parent = -1;
+    }
+}
+
+/** Tell the X thread about a new parent, if the toplevel has a proxy for it to be put on. */
+static void apply_parent(struct Toplevel *self) {
+    long parent_id = self->parent ? (long) self->parent->id : -1;
+    if (!self->wants_proxy || parent_id == self->sent_parent)
+        return;
+    log_debug("toplevel %ld: parent is %ld", self->id, parent_id);
+    self->sent_parent = parent_id;
+    set_transient_for(self, parent_id);
+}
+
+/** The children of a toplevel that's going away are on their own now, which may get them a proxy. */
+static void orphan_children(struct Toplevel *self) {
+    struct Toplevel *t;
+    wl_list_for_each(t, &toplevels, link) {
+        if (t->parent != self)
+            continue;
+        t->parent = NULL;
+        apply_rules(t);
+        apply_parent(t);
+    }
+}
+
+static void toplevel_done(struct Toplevel *self) {
+    journal_record(JOURNAL_TOPLEVEL_DONE, self->id);
+    log_debug("toplevel %ld: done", self->id);
     
-    wl_list_insert(&toplevels, &self->link);
+    if (!self->listed) {
+        self->listed = true;
+        wl_list_insert(&toplevels, &self->link);
+    }
+    // Its title may have just become the one an ext handle is waiting for
+    if (self->zwlr_handle != NULL && self->identifier.empty())
+        join_ext_records();
+    apply_rules(self);
+    apply_parent(self);
+    workspaces_toplevel_done(self);
+    outputs_toplevel_done(self);
 }
 
 /*****************************************************
@@ -399,6 +484,220 @@ static const struct ext_foreign_toplevel_handle_v1_listener ext_handle_listener
         .identifier   = ext_foreign_handle_handle_identifier,
 };
 
+/**
+ * An ext-foreign-toplevel-list handle while zwlr is the protocol in use.
+ * zwlr has activate, close and the window states, ext has the stable
+ * identifier (and is what previews capture), but neither says which handle
+ * of the other is the same window. So once done, records are joined in the
+ * order they were created to zwlr toplevels with the same app_id and title,
+ * oldest first. Compositors announce a window on both lists at the same
+ * time, so within an (app_id, title) bucket the orders line up.
+ *
+ * That is still a guess for identical windows, two terminals with the same
+ * title say: if the compositor announces them in a different order on the
+ * two lists, their identifiers are swapped. Closes undo what they can of
+ * that, see unjoin_ext_record() and ext_record_handle_closed(), but while
+ * both windows are open nothing tells them apart.
+ */
+struct ExtRecord {
+    struct ext_foreign_toplevel_handle_v1 *handle;
+    std::string title;
+    std::string app_id;
+    std::string identifier;
+    bool done = false;
+    bool closed = false;   // Handle gone, kept until the zwlr side it was joined to closes too
+    bool orphaned = false; // The zwlr side it was joined to closed first, never joined to a new window
+    Toplevel *joined = nullptr; // Doesn't own the handle, the record does
+};
+static std::vector<ExtRecord *> ext_records; // In the order the compositor announced them
+
+static void join_ext_records() {
+    for (ExtRecord *record: ext_records) {
+        if (record->joined || record->closed || record->orphaned)
+            continue;
+        // Its bucket isn't known yet, and in it it goes ahead of any record after it
+        if (!record->done)
+            break;
+        if (record->identifier.empty())
+            continue;
+        Toplevel *oldest = nullptr;
+        struct Toplevel *t;
+        wl_list_for_each(t, &toplevels, link) {
+            if (t->zwlr_handle == NULL || !t->identifier.empty())
+                continue;
+            if (t->app_id != record->app_id || t->title != record->title)
+                continue;
+            if (!oldest || t->id < oldest->id)
+                oldest = t;
+        }
+        if (!oldest)
+            continue;
+        
+        log_debug("toplevel %ld: joined with ext handle %s", oldest->id, record->identifier.c_str());
+        record->joined = oldest;
+        oldest->ext_handle = record->handle;
+        toplevel_set_identifier(oldest, record->identifier.c_str());
+        update_identifier_for(oldest);
+    }
+}
+
+static void delete_ext_record(ExtRecord *record) {
+    ext_records.erase(std::remove(ext_records.begin(), ext_records.end(), record), ext_records.end());
+    if (record->handle)
+        ext_foreign_toplevel_handle_v1_destroy(record->handle);
+    delete record;
+}
+
+/** First record with `app_id` that `matches`, or nullptr. */
+template<typename Matches>
+static ExtRecord *find_ext_record(const std::string &app_id, Matches matches) {
+    for (ExtRecord *record: ext_records)
+        if (record->app_id == app_id && matches(record))
+            return record;
+    return nullptr;
+}
+
+/** Give `record` to `toplevel` in place of the one it was wrongly joined to. */
+static void rejoin_ext_record(ExtRecord *record, Toplevel *toplevel) {
+    log_debug("toplevel %ld: was joined to the wrong ext handle, now %s", toplevel->id, record->identifier.c_str());
+    record->joined = toplevel;
+    record->orphaned = false;
+    toplevel->ext_handle = record->handle;
+    toplevel_set_identifier(toplevel, record->identifier.c_str());
+    update_identifier_for(toplevel);
+}
+
+/**
+ * The zwlr side of a joined pair is going away. Its record mustn't be joined
+ * to a new window with the same app_id and title, and only that record is
+ * let go of, never another window's.
+ *
+ * If the record already closed, the pair was right and both go. If it's
+ * still open but another record with the same app_id closed while joined to
+ * a window that's still open, the two were swapped: that window gets this
+ * record. Otherwise the ext side may just not have closed yet, the record
+ * waits orphaned for its close, or for a swapped window to claim it.
+ */
+static void unjoin_ext_record(Toplevel *toplevel) {
+    if (toplevel->zwlr_handle == NULL)
+        return;
+    ExtRecord *own = nullptr;
+    for (ExtRecord *record: ext_records)
+        if (record->joined == toplevel)
+            own = record;
+    if (!own)
+        return;
+    // Its capture session is made from the ext handle
+    thumbnails_forget(toplevel);
+    toplevel->ext_handle = NULL;
+    own->joined = nullptr;
+    
+    if (own->closed) {
+        delete_ext_record(own);
+        return;
+    }
+    ExtRecord *swapped = find_ext_record(own->app_id, [&](ExtRecord *r) { return r->closed && r->joined; });
+    if (swapped) {
+        Toplevel *other = swapped->joined;
+        delete_ext_record(swapped);
+        rejoin_ext_record(own, other);
+        return;
+    }
+    own->orphaned = true;
+}
+
+/** Destroy every record and its handle, on disconnect. The toplevels keep their identifiers. */
+static void forget_ext_records() {
+    for (ExtRecord *record: ext_records) {
+        if (record->joined) {
+            thumbnails_forget(record->joined);
+            record->joined->ext_handle = NULL;
+        }
+        if (record->handle)
+            ext_foreign_toplevel_handle_v1_destroy(record->handle);
+        delete record;
+    }
+    ext_records.clear();
+}
+
+static void ext_record_handle_identifier
+        (
+                void *data,
+                struct ext_foreign_toplevel_handle_v1 *handle,
+                const char *identifier
+        ) {
+    auto record = (ExtRecord *) data;
+    record->identifier = identifier;
+}
+
+static void ext_record_handle_title
+        (
+                void *data,
+                struct ext_foreign_toplevel_handle_v1 *handle,
+                const char *title
+        ) {
+    auto record = (ExtRecord *) data;
+    record->title = title;
+}
+
+static void ext_record_handle_app_id
+        (
+                void *data,
+                struct ext_foreign_toplevel_handle_v1 *handle,
+                const char *app_id
+        ) {
+    auto record = (ExtRecord *) data;
+    record->app_id = app_id;
+}
+
+static void ext_record_handle_done
+        (
+                void *data,
+                struct ext_foreign_toplevel_handle_v1 *handle
+        ) {
+    auto record = (ExtRecord *) data;
+    record->done = true;
+    if (!record->joined)
+        join_ext_records();
+}
+
+static void ext_record_handle_closed
+        (
+                void *data,
+                struct ext_foreign_toplevel_handle_v1 *handle
+        ) {
+    auto record = (ExtRecord *) data;
+    Toplevel *t = record->joined;
+    if (!t) {
+        delete_ext_record(record);
+        return;
+    }
+    // The handle is dead either way
+    thumbnails_forget(t);
+    t->ext_handle = NULL;
+    ext_foreign_toplevel_handle_v1_destroy(handle);
+    record->handle = NULL;
+    
+    // Its window's zwlr side already closed, so `t` is another window with the same app_id it was swapped with
+    ExtRecord *orphan = find_ext_record(record->app_id, [](ExtRecord *r) { return r->orphaned; });
+    if (orphan) {
+        record->joined = nullptr;
+        delete_ext_record(record);
+        rejoin_ext_record(orphan, t);
+        return;
+    }
+    // The zwlr side usually closes right along, unjoin_ext_record() takes it from there
+    record->closed = true;
+}
+
+static const struct ext_foreign_toplevel_handle_v1_listener ext_record_listener = {
+        .closed       = ext_record_handle_closed,
+        .done         = ext_record_handle_done,
+        .title        = ext_record_handle_title,
+        .app_id       = ext_record_handle_app_id,
+        .identifier   = ext_record_handle_identifier,
+};
+
 static void ext_toplevel_list_handle_toplevel
         (
                 void *data,
@@ -407,7 +706,10 @@ static void ext_toplevel_list_handle_toplevel
         ) {
     if (used_protocol != EXT_FOREIGN_TOPLEVEL) {
         assert(used_protocol != NONE);
-        ext_foreign_toplevel_handle_v1_destroy(handle);
+        auto record = new ExtRecord;
+        record->handle = handle;
+        ext_records.push_back(record);
+        ext_foreign_toplevel_handle_v1_add_listener(handle, &ext_record_listener, record);
         return;
     }
     
@@ -435,26 +737,39 @@ static const struct ext_foreign_toplevel_list_v1_listener ext_toplevel_list_list
         .finished = ext_toplevel_list_handle_finished,
 };
 
-void activate_toplevel(int window) {
+static void activate_toplevel(int window) {
     struct Toplevel *t, *tmp;
     if (!seat)
         return;
-    printf("search\n");
+    log_trace("activate: searching toplevel for proxy 0x%x", window);
+    TraceSpan span("activate");
     wl_list_for_each_reverse_safe(t, tmp, &toplevels, link) {
         if (t->x11_proxy_window_id == window) {
             if (t->zwlr_handle) {
+                PROBE2(activate, t->id, window);
+                journal_record(JOURNAL_ACTIVATE, t->id, window);
                 zwlr_foreign_toplevel_handle_v1_activate(t->zwlr_handle, seat);
             }
         }
     }
 }
 
-void close_toplevel(int window) {
+Toplevel *find_toplevel_by_proxy(int window) {
+    struct Toplevel *t;
+    wl_list_for_each(t, &toplevels, link) {
+        if (t->x11_proxy_window_id == window)
+            return t;
+    }
+    return NULL;
+}
+
+static void close_toplevel(int window) {
     struct Toplevel *t, *tmp;
     wl_list_for_each_reverse_safe(t, tmp, &toplevels, link) {
         if (t->x11_proxy_window_id == window) {
             if (t->zwlr_handle) {
-                printf("closing...: %d\n", window);
+                log_debug("closing toplevel for proxy 0x%x", window);
+                journal_record(JOURNAL_CLOSE, t->id, window);
                 zwlr_foreign_toplevel_handle_v1_destroy(t->zwlr_handle);
             }
         }
@@ -500,8 +815,11 @@ static void zwlr_foreign_handle_handle_state
     bool maximized = false;
     
     uint32_t *state;
+    uint64_t state_bits = 0;
     for (state = (uint32_t *) (states)->data;
          (states)->size != 0 && (const char *) state < ((const char *) (states)->data + (states)->size); (state)++) {
+        if (*state < 64)
+            state_bits |= 1ull << *state;
         switch (*state) {
             case ZWLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_MAXIMIZED:
                 maximized = true;
@@ -518,6 +836,7 @@ static void zwlr_foreign_handle_handle_state
         }
     }
     
+    journal_record(JOURNAL_TOPLEVEL_STATE, toplevel->id, state_bits);
     toplevel_set_fullscreen(toplevel, fullscreen);
     toplevel_set_activated(toplevel, activated);
     toplevel_set_minimized(toplevel, minimized);
@@ -551,7 +870,7 @@ static void zwlr_foreign_handle_handle_output_enter
                 struct zwlr_foreign_toplevel_handle_v1 *handle,
                 struct wl_output *output
         ) {
-    /* deliberately left empty */
+    outputs_toplevel_enter((struct Toplevel *) data, output);
 }
 
 static void zwlr_foreign_handle_handle_output_leave
@@ -560,7 +879,7 @@ static void zwlr_foreign_handle_handle_output_leave
                 struct zwlr_foreign_toplevel_handle_v1 *handle,
                 struct wl_output *output
         ) {
-    /* deliberately left empty */
+    outputs_toplevel_leave((struct Toplevel *) data, output);
 }
 
 static void zwlr_foreign_handle_handle_parent
@@ -569,7 +888,9 @@ static void zwlr_foreign_handle_handle_parent
                 struct zwlr_foreign_toplevel_handle_v1 *handle,
                 struct zwlr_foreign_toplevel_handle_v1 *parent
         ) {
-    /* deliberately left empty */
+    // Takes effect on the done that follows
+    auto self = (struct Toplevel *) data;
+    self->parent = parent ? (struct Toplevel *) zwlr_foreign_toplevel_handle_v1_get_user_data(parent) : NULL;
 }
 
 static const struct zwlr_foreign_toplevel_handle_v1_listener zwlr_handle_listener = {
@@ -599,7 +920,6 @@ static void zwlr_toplevel_manager_handle_toplevel
     if (toplevel == NULL)
         return;
     toplevel->zwlr_handle = handle;
-    printf("we actually create the handle\n");
     zwlr_foreign_toplevel_handle_v1_add_listener(
             handle,
             &zwlr_handle_listener,
@@ -782,12 +1102,16 @@ static void registry_handle_global
                 const char *interface,
                 uint32_t version
         ) {
+    if (thumbnails_bind(registry, name, interface, version))
+        return;
+    if (workspaces_bind(registry, name, interface, version))
+        return;
+    if (outputs_bind(registry, name, interface, version))
+        return;
     if (strcmp(interface, zwlr_foreign_toplevel_manager_v1_interface.name) == 0) {
-        printf("found zwlr zwlr\n");
         if (version < 3)
             return;
-        if (debug_log)
-            fputs("[Binding zwlr-foreign-toplevel-manager-v1.]\n", stderr);
+        log_debug("Binding zwlr-foreign-toplevel-manager-v1.");
         zwlr_toplevel_manager = static_cast<zwlr_foreign_toplevel_manager_v1 *>(wl_registry_bind(
                 wl_registry,
                 name,
@@ -800,9 +1124,7 @@ static void registry_handle_global
                 NULL
         );
     } else if (strcmp(interface, ext_foreign_toplevel_list_v1_interface.name) == 0) {
-        printf("found ext\n");
-        if (debug_log)
-            fputs("[Binding ext-foreign-toplevel-list-v1.]\n", stderr);
+        log_debug("Binding ext-foreign-toplevel-list-v1.");
         ext_toplevel_list = static_cast<ext_foreign_toplevel_list_v1 *>(wl_registry_bind(
                 wl_registry,
                 name,
@@ -816,7 +1138,7 @@ static void registry_handle_global
         );
     }else if (strcmp(interface, wl_seat_interface.name) == 0 && seat == NULL) {
         seat = static_cast<wl_seat *>(wl_registry_bind(registry, name, &wl_seat_interface, version));
-        printf("seat set\n");
+        log_debug("Bound wl_seat.");
     }
 }
 
@@ -826,7 +1148,7 @@ static void registry_handle_global_remove
                 struct wl_registry *registry,
                 uint32_t name
         ) {
-    /* deliberately left empty */
+    outputs_global_remove(name);
 }
 
 static const struct wl_registry_listener registry_listener = {
@@ -845,20 +1167,101 @@ static const struct wl_callback_listener sync_callback_listener = {
         .done = sync_handle_done,
 };
 
+/** Which of our two syncs sync_handle_done() is answering, starts over on every connection. */
+static int sync_round = 0;
+
+/**
+ * Toplevels of a compositor we lost, kept around so their proxies can be
+ * handed to the matching toplevels once it's back. See reconcile_orphans().
+ */
+static std::vector<Toplevel *> orphans;
+static uint64_t wayland_lost_ms = 0;
+
+static uint64_t monotonic_ms() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Give the proxies of the toplevels we knew before the compositor restarted
+ * to the new toplevels they match, best match first: same identifier (only
+ * if the compositor kept it, i.e. it was our connection that broke), then
+ * same app_id and title, then just the same app_id. Docks
+ * then don't see those windows close and open again, and X only hears about
+ * changed titles, proxies nobody took and toplevels that are really new.
+ */
+static void reconcile_orphans() {
+    if (orphans.empty())
+        return;
+    
+    int reused = 0;
+    auto take_over = [&](Toplevel *t, std::vector<Toplevel *>::iterator it) {
+        Toplevel *o = *it;
+        log_debug("toplevel %ld: takes over proxy 0x%x of toplevel %ld", t->id, o->x11_proxy_window_id, o->id);
+        t->x11_proxy_window_id = o->x11_proxy_window_id;
+        t->old_title = o->old_title;
+        reassign_proxy(o, t);
+        metrics_gauge_add(metrics.live_toplevels, -1);
+        delete o;
+        orphans.erase(it);
+        reused++;
+    };
+    
+    for (auto it = orphans.begin(); it != orphans.end();) {
+        auto same = toplevels_by_identifier.find((*it)->identifier);
+        if ((*it)->x11_proxy_window_id == 0 || (*it)->identifier.empty() || same == toplevels_by_identifier.end() ||
+            same->second->x11_proxy_window_id != 0 || !same->second->wants_proxy) {
+            ++it;
+            continue;
+        }
+        size_t index = it - orphans.begin();
+        take_over(same->second, it);
+        it = orphans.begin() + index;
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        struct Toplevel *t;
+        wl_list_for_each(t, &toplevels, link) {
+            if (t->x11_proxy_window_id != 0 || !t->wants_proxy)
+                continue;
+            for (auto it = orphans.begin(); it != orphans.end(); ++it) {
+                Toplevel *o = *it;
+                if (o->x11_proxy_window_id == 0 || o->app_id != t->app_id)
+                    continue;
+                if (pass == 0 && o->title != t->title)
+                    continue;
+                take_over(t, it);
+                break;
+            }
+        }
+    }
+    
+    // Also takes along creates still on their way for the ones without a proxy yet
+    destroy_proxies(orphans);
+    size_t unclaimed = 0;
+    for (Toplevel *o: orphans) {
+        if (o->x11_proxy_window_id != 0)
+            unclaimed++;
+        metrics_gauge_add(metrics.live_toplevels, -1);
+        delete o;
+    }
+    log_info("reconnected to the compositor after %llu ms: %d proxies reused, %zu destroyed",
+             (unsigned long long) (monotonic_ms() - wayland_lost_ms), reused, unclaimed);
+    orphans.clear();
+}
+
 static void sync_handle_done
         (
                 void *data,
                 struct wl_callback *wl_callback,
                 uint32_t other_data
         ) {
-    static int sync = 0;
-    if (debug_log)
-        fprintf(stderr, "[Sync callback: %d]\n", sync);
+    log_debug("Sync callback: %d", sync_round);
     
     wl_callback_destroy(wl_callback);
     sync_callback = NULL;
     
-    if (sync == 0) {
+    if (sync_round == 0) {
         /* First sync: The registry finished advertising globals.
          * Now we can check whether we have everything we need.
          */
@@ -905,7 +1308,7 @@ static void sync_handle_done
         }
         update_capabilities();
         
-        sync++;
+        sync_round++;
         sync_callback = wl_display_sync(wl_display);
         wl_callback_add_listener(sync_callback, &sync_callback_listener, NULL);
         
@@ -919,6 +1322,13 @@ static void sync_handle_done
          * exit.
          */
         loop = false;
+    } else {
+        /* Second sync: every toplevel that existed when we connected has
+         * been announced, give them all their proxies at once.
+         */
+        toplevels_announced = true;
+        reconcile_orphans();
+        end_startup_burst();
     }
 }
 
@@ -942,9 +1352,20 @@ static void free_data(void) {
     wl_list_for_each_safe(t, tmp, &toplevels, link)toplevel_destroy(t);
 }
 
+/** When SIGINT or SIGTERM came in, to tell how long shutting down took. */
+static volatile uint64_t shutdown_began_ms = 0;
+
+/**
+ * Only async-signal-safe calls in here: the signal can come in while the
+ * Wayland thread holds a lock, be it ours, malloc's or libwayland's. The
+ * eventfd gets dispatch_wayland_events() out of poll() (if EINTR didn't
+ * already) and the main loop ends normally.
+ */
 static void handle_interrupt(int signum) {
-    fputs("Killed.\n", stderr);
+    const char killed[] = "Killed.\n";
+    write(STDERR_FILENO, killed, sizeof(killed) - 1);
     loop = false;
+    shutdown_began_ms = monotonic_ms(); // clock_gettime() is async-signal-safe
     
     /* In WATCH mode, Ctrl-C is the expected way to exit lswt, so don't
      * set the return value to EXIT_FAILURE. However in LIST mode we
@@ -954,7 +1375,295 @@ static void handle_interrupt(int signum) {
     if (mode == LIST)
         ret = EXIT_FAILURE;
     
-    longjmp(skip_main_loop, 1);
+    wakeup_wayland();
+}
+
+/** The actual writing happens on the X thread, a signal handler can't do I/O safely. */
+static void handle_trace_dump(int signum) {
+    trace_dump_requested = true;
+    wakeup();
+}
+
+/** Readable when another thread left work for us, see wakeup_wayland(). */
+static int wayland_wakeup_fd = -1;
+
+void wakeup_wayland() {
+    uint64_t one = 1;
+    write(wayland_wakeup_fd, &one, sizeof(one));
+}
+
+/** Urgent commands the X thread left for us. Thumbnail requests, which are lazy, queue up in thumbnails.cpp. */
+struct WaylandCommand {
+    void (*func)(int window);
+    int window;
+    uint64_t queued_at;
+};
+
+static std::mutex commands_mutex;
+static std::vector<WaylandCommand> urgent_commands;
+static std::vector<std::pair<size_t, int>> created_proxies; // Toplevel id and proxy, see proxy_created()
+
+static void queue_command(void (*func)(int window), int window) {
+    {
+        std::lock_guard<std::mutex> lock(commands_mutex);
+        urgent_commands.push_back({func, window, metrics_now()});
+    }
+    wakeup_wayland();
+}
+
+void request_activate(int window) {
+    queue_command(activate_toplevel, window);
+}
+
+void request_close(int window) {
+    queue_command(close_toplevel, window);
+}
+
+static void resync_titles(int) {
+    struct Toplevel *t;
+    wl_list_for_each(t, &toplevels, link) {
+        if (t->wants_proxy)
+            update_title_for(t);
+    }
+}
+
+/** The X thread caught up after dropping work, give it everything again. */
+static void rebuild_all_proxies(int) {
+    std::vector<Toplevel *> wanted;
+    struct Toplevel *t;
+    wl_list_for_each(t, &toplevels, link) {
+        if (t->wants_proxy)
+            wanted.push_back(t);
+    }
+    rebuild_proxies(wanted, orphans);
+    workspaces_resend();
+    outputs_resend();
+}
+
+void request_resync() {
+    queue_command(rebuild_all_proxies, 0);
+}
+
+static void recreate_all_proxies(int) {
+    std::vector<Toplevel *> all;
+    struct Toplevel *t;
+    wl_list_for_each(t, &toplevels, link) {
+        // Those windows died with the old connection
+        t->x11_proxy_window_id = 0;
+        if (t->wants_proxy)
+            all.push_back(t);
+    }
+    recreate_proxies(std::move(all));
+}
+
+void request_recreate_proxies() {
+    queue_command(recreate_all_proxies, 0);
+}
+
+void proxy_created(size_t toplevel_id, int window) {
+    {
+        std::lock_guard<std::mutex> lock(commands_mutex);
+        created_proxies.emplace_back(toplevel_id, window);
+    }
+    wakeup_wayland();
+}
+
+/** Record proxies the X thread made, for toplevels that are still around and still want one. */
+static void apply_created_proxies(std::vector<std::pair<size_t, int>> &created) {
+    for (auto &[toplevel_id, window]: created) {
+        Toplevel *found = nullptr;
+        struct Toplevel *t;
+        wl_list_for_each(t, &toplevels, link) {
+            if (t->id == toplevel_id)
+                found = t;
+        }
+        for (Toplevel *o: orphans)
+            if (o->id == toplevel_id)
+                found = o;
+        // Gone or excluded since: the destroy queued for it takes the proxy down
+        if (found && found->wants_proxy)
+            found->x11_proxy_window_id = window;
+    }
+}
+
+static void run_urgent_commands() {
+    std::vector<WaylandCommand> commands;
+    std::vector<std::pair<size_t, int>> created;
+    {
+        std::lock_guard<std::mutex> lock(commands_mutex);
+        commands.swap(urgent_commands);
+        created.swap(created_proxies);
+    }
+    // First, so an activate from a proxy that was just made finds its toplevel
+    apply_created_proxies(created);
+    for (auto &command: commands) {
+        metrics_observe(STAGE_COMMAND_RESIDENCY, command.queued_at);
+        command.func(command.window);
+    }
+}
+
+/**
+ * Bring the proxies in line with a reloaded config, touching only what the
+ * change affects: a new tag retitles them, a new geometry moves them, new
+ * rules create and destroy only the proxies whose verdict flipped.
+ */
+static void apply_config_changes() {
+    unsigned changed = config_handle_changes();
+    if (changed & (CONFIG_CHANGED_TAG | CONFIG_CHANGED_GEOMETRY))
+        set_proxy_settings(proxy_settings);
+    if (changed & CONFIG_CHANGED_TAG)
+        resync_titles(0);
+    if (changed & CONFIG_CHANGED_RULES) {
+        struct Toplevel *t;
+        wl_list_for_each(t, &toplevels, link) {
+            apply_rules(t);
+        }
+    }
+}
+
+/**
+ * A toplevel without a title only gets a proxy once a desktop entry names
+ * it, which may be after it was first looked at: the index is built in the
+ * background, and apps get installed.
+ */
+static void apply_desktop_entry_changes() {
+    static uint64_t seen = 0;
+    uint64_t generation = desktop_entries_generation();
+    if (generation == seen)
+        return;
+    seen = generation;
+    struct Toplevel *t;
+    wl_list_for_each(t, &toplevels, link) {
+        if (t->title.empty())
+            apply_rules(t);
+    }
+}
+
+/**
+ * Like wl_display_dispatch(), except that the time spent waiting for the
+ * compositor is kept out of the traced "wayland_dispatch" spans, and that
+ * work other threads queued for us through wakeup_wayland() is picked up,
+ * as are edits to the config and rules files. Proxy moves outputs_flush()
+ * is holding back wake us up through its timer.
+ */
+static int dispatch_wayland_events(void) {
+    int dispatched = 0;
+    while (wl_display_prepare_read(wl_display) != 0) {
+        TraceSpan span("wayland_dispatch");
+        int n = wl_display_dispatch_pending(wl_display);
+        if (n < 0)
+            return -1;
+        dispatched += n;
+    }
+    if (dispatched > 0) {
+        wl_display_cancel_read(wl_display);
+        return dispatched;
+    }
+    
+    wl_display_flush(wl_display);
+    struct pollfd fds[4] = {
+            {wl_display_get_fd(wl_display), POLLIN, 0},
+            {wayland_wakeup_fd,             POLLIN, 0},
+            {config_watch_fd(),             POLLIN, 0}, // Ignored by poll() when -1
+            {outputs_timer_fd(),            POLLIN, 0}, // A debounced proxy move is due, see outputs_flush()
+    };
+    if (poll(fds, 4, -1) < 0) {
+        wl_display_cancel_read(wl_display);
+        return errno == EINTR ? 0 : -1;
+    }
+    if (fds[0].revents) {
+        if (wl_display_read_events(wl_display) < 0)
+            return -1;
+    } else {
+        wl_display_cancel_read(wl_display);
+    }
+    
+    if (fds[1].revents & POLLIN) {
+        uint64_t count;
+        read(wayland_wakeup_fd, &count, sizeof(count));
+        // Activations and closes first, captures for previews can wait
+        run_urgent_commands();
+        thumbnails_handle_requests();
+        apply_desktop_entry_changes();
+    }
+    if (fds[2].revents & POLLIN)
+        apply_config_changes();
+    
+    TraceSpan span("wayland_dispatch");
+    return wl_display_dispatch_pending(wl_display);
+}
+
+/** Ask for the globals, sync_handle_done() takes it from there. */
+static void start_registry() {
+    sync_round = 0;
+    wl_registry = wl_display_get_registry(wl_display);
+    wl_registry_add_listener(wl_registry, &registry_listener, NULL);
+    
+    sync_callback = wl_display_sync(wl_display);
+    wl_callback_add_listener(sync_callback, &sync_callback_listener, NULL);
+}
+
+/**
+ * The compositor went away (crashed or restarted). Rather than exiting and
+ * taking every proxy with us, keep our toplevels as orphans, connect again
+ * with a backoff and let reconcile_orphans() sort them out once the new
+ * toplevel list is in.
+ */
+static void reconnect_wayland(const char *display_name) {
+    log_warn("lost the connection to the compositor: %s, reconnecting", strerror(wl_display_get_error(wl_display)));
+    wayland_lost_ms = monotonic_ms();
+    
+    forget_ext_records();
+    toplevels_by_identifier.clear();
+    struct Toplevel *t, *tmp;
+    wl_list_for_each_safe(t, tmp, &toplevels, link) {
+        thumbnails_forget(t);
+        if (t->zwlr_handle != NULL)
+            zwlr_foreign_toplevel_handle_v1_destroy(t->zwlr_handle);
+        if (t->ext_handle != NULL)
+            ext_foreign_toplevel_handle_v1_destroy(t->ext_handle);
+        t->zwlr_handle = NULL;
+        t->ext_handle = NULL;
+        t->outputs.clear();
+        t->parent = NULL; // The new handles come with their parent events again
+        wl_list_remove(&t->link);
+        t->listed = false;
+        orphans.push_back(t);
+    }
+    
+    thumbnails_unbind();
+    workspaces_unbind();
+    outputs_unbind();
+    toplevels_announced = false;
+    if (sync_callback != NULL)
+        wl_callback_destroy(sync_callback);
+    if (zwlr_toplevel_manager != NULL)
+        zwlr_foreign_toplevel_manager_v1_destroy(zwlr_toplevel_manager);
+    if (ext_toplevel_list != NULL)
+        ext_foreign_toplevel_list_v1_destroy(ext_toplevel_list);
+    if (seat != NULL)
+        wl_seat_destroy(seat);
+    wl_registry_destroy(wl_registry);
+    wl_display_disconnect(wl_display);
+    wl_display = NULL;
+    sync_callback = NULL;
+    zwlr_toplevel_manager = NULL;
+    ext_toplevel_list = NULL;
+    seat = NULL;
+    wl_registry = NULL;
+    
+    int delay_ms = 100;
+    while ((wl_display = wl_display_connect(display_name)) == NULL) {
+        if (!loop)
+            return; // Interrupted, main() shuts down without a compositor
+        log_warn("could not connect to the compositor, trying again in %d ms", delay_ms);
+        usleep(delay_ms * 1000);
+        delay_ms = std::min(delay_ms * 2, 5000);
+    }
+    
+    // Creates wait for the new toplevel list, so they can be matched against the orphans first
+    begin_startup_burst();
+    start_registry();
 }
 
 /**
@@ -982,6 +1691,39 @@ static void handle_error(int signum) {
     kill(getpid(), signum);
 }
 
+struct LandlockException {
+    std::string path;
+    bool writable;
+};
+static std::vector<LandlockException> landlock_exceptions;
+
+void allow_path_after_landlock(const std::string &path, bool writable) {
+    landlock_exceptions.push_back({path, writable});
+}
+
+std::vector<std::string> xdg_data_dirs() {
+    std::vector<std::string> dirs;
+    const char *data_home = getenv("XDG_DATA_HOME");
+    const char *home = getenv("HOME");
+    if (data_home && *data_home)
+        dirs.push_back(data_home);
+    else if (home)
+        dirs.push_back(std::string(home) + "/.local/share");
+    
+    const char *data_dirs = getenv("XDG_DATA_DIRS");
+    std::string list = data_dirs && *data_dirs ? data_dirs : "/usr/local/share:/usr/share";
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(':', start);
+        if (end == std::string::npos)
+            end = list.size();
+        if (end > start)
+            dirs.push_back(list.substr(start, end - start));
+        start = end + 1;
+    }
+    return dirs;
+}
+
 #ifdef __linux__
 
 static void lock_the_land(void) {
@@ -1026,6 +1768,28 @@ static void lock_the_land(void) {
         return;
     }
     
+    for (auto &exception: landlock_exceptions) {
+        int path_fd = open(exception.path.c_str(), O_PATH | O_CLOEXEC);
+        if (path_fd < 0)
+            continue; /* Doesn't exist (yet), nothing to allow. */
+        
+        uint64_t allowed = LANDLOCK_ACCESS_FS_READ_FILE | LANDLOCK_ACCESS_FS_READ_DIR;
+        if (exception.writable)
+            allowed |= LANDLOCK_ACCESS_FS_WRITE_FILE | LANDLOCK_ACCESS_FS_REMOVE_FILE |
+                       LANDLOCK_ACCESS_FS_MAKE_REG | LANDLOCK_ACCESS_FS_MAKE_DIR | (1ULL << 14) /* TRUNCATE, ABI 3 */;
+        /* A single file (the Xauthority) only takes the rights that apply to files. */
+        struct stat st;
+        if (fstat(path_fd, &st) == 0 && !S_ISDIR(st.st_mode))
+            allowed &= LANDLOCK_ACCESS_FS_READ_FILE | LANDLOCK_ACCESS_FS_WRITE_FILE | (1ULL << 14);
+        struct landlock_path_beneath_attr rule = {
+                .allowed_access = allowed & landlock_access_rights[abi - 1],
+                .parent_fd = path_fd,
+        };
+        if (syscall(SYS_landlock_add_rule, ruleset_fd, LANDLOCK_RULE_PATH_BENEATH, &rule, 0) != 0)
+            fprintf(stderr, "ERROR: landlock_add_rule(%s): %s\n", exception.path.c_str(), strerror(errno));
+        close(path_fd);
+    }
+    
     if (syscall(SYS_landlock_restrict_self, ruleset_fd, 0) != 0)
         fprintf(stderr, "ERROR: landlock_restrict_self: %s\n", strerror(errno));
     
@@ -1034,16 +1798,139 @@ static void lock_the_land(void) {
 
 #endif
 
+static const char *icon_theme_override = NULL;
+static const char *rules_path = NULL;
+static const char *config_path = NULL;
+
+/**
+ * Returns false if we should exit right away, in which case ret has
+ * already been set accordingly.
+ */
+static bool handle_command_flags(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            fputs(usage, stdout);
+            return false;
+        } else if (strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "--version") == 0) {
+            fputs("fix_x11_docks " VERSION "\n", stdout);
+            return false;
+        } else if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--debug") == 0) {
+            log_level = LOG_LEVEL_DEBUG;
+        } else if (strcmp(argv[i], "--log-level") == 0) {
+            if (i + 1 >= argc || !log_set_level(argv[++i])) {
+                fputs("ERROR: --log-level requires one of error, warn, info, debug or trace.\n", stderr);
+                ret = EXIT_FAILURE;
+                return false;
+            }
+        } else if (strcmp(argv[i], "--metrics") == 0) {
+            if (i + 1 >= argc) {
+                fputs("ERROR: --metrics requires a socket path.\n", stderr);
+                ret = EXIT_FAILURE;
+                return false;
+            }
+            /* Has to happen before lock_the_land(), binding creates a file. */
+            if (!metrics_open_socket(argv[++i])) {
+                ret = EXIT_FAILURE;
+                return false;
+            }
+        } else if (strcmp(argv[i], "--journal") == 0) {
+            if (i + 1 >= argc) {
+                fputs("ERROR: --journal requires a file path.\n", stderr);
+                ret = EXIT_FAILURE;
+                return false;
+            }
+            if (!journal_open(argv[++i])) {
+                ret = EXIT_FAILURE;
+                return false;
+            }
+        } else if (strcmp(argv[i], "--dump-journal") == 0) {
+            if (i + 1 >= argc) {
+                fputs("ERROR: --dump-journal requires a file path.\n", stderr);
+                ret = EXIT_FAILURE;
+                return false;
+            }
+            ret = journal_dump(argv[++i]);
+            return false;
+        } else if (strcmp(argv[i], "--icon-theme") == 0) {
+            if (i + 1 >= argc) {
+                fputs("ERROR: --icon-theme requires a theme name.\n", stderr);
+                ret = EXIT_FAILURE;
+                return false;
+            }
+            icon_theme_override = argv[++i];
+        } else if (strcmp(argv[i], "--previews") == 0) {
+            thumbnails_enabled = true;
+        } else if (strcmp(argv[i], "--keep-proxies") == 0) {
+            keep_proxies_on_exit = true;
+        } else if (strcmp(argv[i], "--current-workspace") == 0) {
+            current_workspace_only = true;
+        } else if (strcmp(argv[i], "--skip-transients") == 0) {
+            skip_transients = true;
+        } else if (strcmp(argv[i], "--rules") == 0) {
+            if (i + 1 >= argc) {
+                fputs("ERROR: --rules requires a file.\n", stderr);
+                ret = EXIT_FAILURE;
+                return false;
+            }
+            rules_path = argv[++i];
+        } else if (strcmp(argv[i], "--config") == 0) {
+            if (i + 1 >= argc) {
+                fputs("ERROR: --config requires a file.\n", stderr);
+                ret = EXIT_FAILURE;
+                return false;
+            }
+            config_path = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            if (i + 1 >= argc) {
+                fputs("ERROR: --trace requires a file path.\n", stderr);
+                ret = EXIT_FAILURE;
+                return false;
+            }
+            if (!trace_open(argv[++i])) {
+                ret = EXIT_FAILURE;
+                return false;
+            }
+        } else {
+            fprintf(stderr, "ERROR: Unknown option: %s\n%s", argv[i], usage);
+            ret = EXIT_FAILURE;
+            return false;
+        }
+    }
+    return true;
+}
+
 int main(int argc, char *argv[]) {
-    open_x_connection();
+    if (!handle_command_flags(argc, argv))
+        return ret;
+    log_init();
+    icons_init(icon_theme_override);
+    desktop_entries_init();
+    allow_x_connection_paths();
+    rules_init(rules_path);
+    config_init(config_path);
+    set_proxy_settings(proxy_settings);
+    
+    wayland_wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wayland_wakeup_fd < 0) {
+        fprintf(stderr, "ERROR: eventfd: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
     
     signal(SIGSEGV, handle_error);
     signal(SIGFPE, handle_error);
     signal(SIGINT, handle_interrupt);
+    signal(SIGTERM, handle_interrupt);
+    if (trace_enabled)
+        signal(SIGUSR1, handle_trace_dump);
 
 #ifdef __linux__
     lock_the_land();
 #endif
+    // Landlock only covers the threads created after it, so these wait for it
+    log_start_writer();
+    icons_start_workers();
+    desktop_entries_start();
+    open_x_connection();
     const char *display_name = getenv("WAYLAND_DISPLAY");
     
     used_protocol = ZWLR_FOREIGN_TOPLEVEL;
@@ -1066,8 +1953,7 @@ int main(int argc, char *argv[]) {
         goto cleanup;
     }
     
-    if (debug_log)
-        fprintf(stderr, "[Trying to connect to display: '%s']\n", display_name);
+    log_debug("Trying to connect to display: '%s'", display_name);
     
     /* Behold: If this succeeds, we may no longer goto cleanup, because
      * Wayland magic happens, which can cause Toplevels to be allocated.
@@ -1080,18 +1966,31 @@ int main(int argc, char *argv[]) {
     }
     
     wl_list_init(&toplevels);
-    wl_registry = wl_display_get_registry(wl_display);
-    wl_registry_add_listener(wl_registry, &registry_listener, NULL);
+    start_registry();
     
-    sync_callback = wl_display_sync(wl_display);
-    wl_callback_add_listener(sync_callback, &sync_callback_listener, NULL);
-    
-    if (debug_log)
-        fputs("[Entering main loop.]\n", stderr);
-    if (setjmp(skip_main_loop) == 0)
-        while (loop && wl_display_dispatch(wl_display) > 0);
+    log_debug("Entering main loop.");
+    while (loop) {
+        if (dispatch_wayland_events() != -1) {
+            workspaces_flush();
+            outputs_flush();
+            continue;
+        }
+        if (mode == LIST || !loop)
+            break;
+        reconnect_wayland(display_name);
+    }
     
-    stop_x_connection();
+    if (shutdown_began_ms == 0)
+        shutdown_began_ms = monotonic_ms();
+    if (!stop_x_connection()) {
+        // The X thread is still in there, leave before anything it uses is torn down under it
+        trace_dump();
+        log_info("shut down in %llu ms, without the X thread", (unsigned long long) (monotonic_ms() - shutdown_began_ms));
+        log_shutdown();
+        fflush(stdout);
+        _exit(ret);
+    }
+    trace_dump();
     /* If nothing went wrong in the main loop we can print and free all data,
      * otherwise just free it.
      */
@@ -1099,9 +1998,9 @@ int main(int argc, char *argv[]) {
         dump_and_free_data();
     else
         free_data();
+    forget_ext_records();
     
-    if (debug_log)
-        fputs("[Cleaning up Wayland interfaces.]\n", stderr);
+    log_debug("Cleaning up Wayland interfaces.");
     if (sync_callback != NULL)
         wl_callback_destroy(sync_callback);
     if (zwlr_toplevel_manager != NULL)
@@ -1110,11 +2009,14 @@ int main(int argc, char *argv[]) {
         ext_foreign_toplevel_list_v1_destroy(ext_toplevel_list);
     if (wl_registry != NULL)
         wl_registry_destroy(wl_registry);
-    wl_display_disconnect(wl_display);
+    if (wl_display != NULL)
+        wl_display_disconnect(wl_display);
+    log_info("shut down in %llu ms", (unsigned long long) (monotonic_ms() - shutdown_began_ms));
 
 cleanup:
     if (custom_output_format != NULL)
         free(custom_output_format);
+    log_shutdown();
     
     return ret;
 }
@@ -5,7 +5,9 @@
 #ifndef FIX_X11_DOCKS_ON_WAYLAND_MAIN_H
 #define FIX_X11_DOCKS_ON_WAYLAND_MAIN_H
 
+#include <cstdint>
 #include <string>
+#include <vector>
 #include <wayland-util.h>
 
 /******************
@@ -20,11 +22,35 @@ public:
     /** Internal id, used in WATCH mode. */
     size_t id;
     
+    /** Its proxy, as last reported through proxy_created(); 0 if none (yet). Wayland thread only. */
     int x11_proxy_window_id = 0;
     
+    /** create_proxy_for() was called and the rules haven't excluded it since. See apply_rules(). */
+    bool wants_proxy = false;
+    
+    /** Already open when we connected, rather than opened while we watched. */
+    bool preexisting = false;
+    
+    /** Our serial of the workspace it's on, 0 if unknown; see workspaces.h. */
+    uint32_t workspace = 0;
+    bool workspace_focus = false; // activated, as of the last workspaces_toplevel_done()
+    int sent_desktop = -1;        // What workspaces_flush() last told the X thread
+    bool sent_mapped = true;
+    
+    /** Outputs it's on, the one entered last at the back; see outputs.h. */
+    std::vector<struct wl_output *> outputs;
+    std::string sent_output;      // Which output outputs_flush() last told the X thread, "" if none
+    
+    /** The toplevel this one is a dialog (or other child) of, from zwlr's parent event; nullptr if none. */
+    Toplevel *parent = nullptr;
+    long sent_parent = -1;        // Id of the parent set_transient_for() last told the X thread, -1 if none
+    
     struct zwlr_foreign_toplevel_handle_v1 *zwlr_handle;
     struct ext_foreign_toplevel_handle_v1 *ext_handle;
     
+    /** Capture session for --previews, created on the first request. */
+    struct ThumbnailSession *thumbnail = nullptr;
+    
     std::string old_title;
     std::string title;
     std::string app_id;
@@ -47,9 +73,51 @@ public:
     bool listed;
 };
 
-void activate_toplevel(int window);
+/**
+ * How urgent a command crossing between the Wayland and X threads is. Each
+ * class gets its own queue; urgent ones always go first, and prompt ones
+ * can't starve lazy ones forever.
+ */
+enum CommandPriority {
+    PRIORITY_URGENT, // The user did something: activate, close
+    PRIORITY_PROMPT, // Proxies appearing and disappearing
+    PRIORITY_LAZY,   // Titles, icons, previews
+    PRIORITY_COUNT,
+};
+
+/** Have the Wayland thread activate the toplevel `window` is the proxy of. Any thread. */
+void request_activate(int window);
+
+/** Have the Wayland thread close the toplevel `window` is the proxy of. Any thread. */
+void request_close(int window);
+
+/** Have the Wayland thread rebuild every proxy from its toplevel list, after work had to be dropped. Any thread. */
+void request_resync();
+
+/** Have the Wayland thread recreate every proxy, after the X server restarted. Any thread. */
+void request_recreate_proxies();
+
+/** The X thread made or adopted `window` as the proxy of toplevel `toplevel_id`. Any thread. */
+void proxy_created(size_t toplevel_id, int window);
+
+/** Every listed Toplevel, through Toplevel::link. Wayland thread. */
+extern struct wl_list toplevels;
+
+/** The toplevel `window` is the proxy of, or nullptr. Wayland thread. */
+Toplevel *find_toplevel_by_proxy(int window);
+
+/** Wake the Wayland thread up from its poll. Any thread. */
+void wakeup_wayland();
+
+/**
+ * Keep read (and if `writable`, create/write) access to everything under
+ * `path` once landlock has locked the filesystem. Only has an effect when
+ * called before lock_the_land() runs in main().
+ */
+void allow_path_after_landlock(const std::string &path, bool writable);
 
-void close_toplevel(int window);
+/** $XDG_DATA_HOME followed by $XDG_DATA_DIRS, with the spec's defaults filled in. */
+std::vector<std::string> xdg_data_dirs();
 
 
 #endif //FIX_X11_DOCKS_ON_WAYLAND_MAIN_H
@@ -0,0 +1,172 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#include "metrics.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+bool metrics_enabled = false;
+
+Metrics metrics{};
+
+int metrics_fd = -1;
+
+void metrics_observe(MetricStage stage, uint64_t start) {
+    if (!metrics_enabled)
+        return;
+    uint64_t elapsed = metrics_now() - start;
+    int bucket = 63 - __builtin_clzll(elapsed | 1);
+    if (bucket >= histogram_buckets)
+        bucket = histogram_buckets - 1;
+
+    Histogram &h = metrics.stages[stage];
+    h.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    h.count.fetch_add(1, std::memory_order_relaxed);
+    h.sum_ns.fetch_add(elapsed, std::memory_order_relaxed);
+}
+
+bool metrics_open_socket(const char *path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "ERROR: metrics socket path is too long: %s\n", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+
+    // Remove a stale socket left behind by a previous run, but never anything else
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: socket(): %s\n", strerror(errno));
+        return false;
+    }
+    if (bind(fd, (sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+        fprintf(stderr, "ERROR: could not listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    metrics_fd = fd;
+    metrics_enabled = true;
+    return true;
+}
+
+static void write_value(std::string &out, const char *name, const char *type, const char *help, double value) {
+    char line[256];
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n%s %.17g\n", name, help, name, type, name, value);
+    out += line;
+}
+
+/** Upper bound (in seconds) of the bucket containing the q-th quantile. */
+static double estimate_quantile(uint64_t *buckets, uint64_t count, double q) {
+    if (count == 0)
+        return 0;
+    uint64_t wanted = (uint64_t) (q * (double) count);
+    if (wanted == 0)
+        wanted = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < histogram_buckets; i++) {
+        seen += buckets[i];
+        if (seen >= wanted)
+            return (double) (1ull << (i + 1)) / 1e9;
+    }
+    return (double) (1ull << histogram_buckets) / 1e9;
+}
+
+static void write_stages(std::string &out) {
+    const char *name = "fix_x11_docks_stage_latency_seconds";
+    const char *stage_names[STAGE_COUNT] = {"queue_residency", "work", "x_events", "command_residency"};
+    const double quantiles[] = {0.5, 0.9, 0.99};
+    char line[256];
+
+    out += "# HELP fix_x11_docks_stage_latency_seconds Time spent per pipeline stage.\n";
+    out += "# TYPE fix_x11_docks_stage_latency_seconds summary\n";
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        Histogram &h = metrics.stages[s];
+        uint64_t buckets[histogram_buckets];
+        for (int i = 0; i < histogram_buckets; i++)
+            buckets[i] = h.buckets[i].load(std::memory_order_relaxed);
+        uint64_t count = h.count.load(std::memory_order_relaxed);
+
+        for (double q: quantiles) {
+            snprintf(line, sizeof(line), "%s{stage=\"%s\",quantile=\"%g\"} %.9f\n",
+                     name, stage_names[s], q, estimate_quantile(buckets, count, q));
+            out += line;
+        }
+        snprintf(line, sizeof(line), "%s_sum{stage=\"%s\"} %.9f\n%s_count{stage=\"%s\"} %llu\n",
+                 name, stage_names[s], (double) h.sum_ns.load(std::memory_order_relaxed) / 1e9,
+                 name, stage_names[s], (unsigned long long) count);
+        out += line;
+    }
+}
+
+void metrics_serve() {
+    int client = accept4(metrics_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client < 0)
+        return;
+
+    std::string body;
+    write_value(body, "fix_x11_docks_live_toplevels", "gauge", "Wayland toplevels we are tracking.",
+                (double) metrics.live_toplevels.load(std::memory_order_relaxed));
+    write_value(body, "fix_x11_docks_live_proxies", "gauge", "X11 proxy windows currently alive.",
+                (double) metrics.live_proxies.load(std::memory_order_relaxed));
+    write_value(body, "fix_x11_docks_queued_work", "gauge", "FutureWork waiting for the X thread.",
+                (double) metrics.queued_work.load(std::memory_order_relaxed));
+    write_value(body, "fix_x11_docks_queued_work_high_watermark", "gauge",
+                "Most FutureWork ever waiting for the X thread to pick it up.",
+                (double) metrics.queued_work_high_watermark.load(std::memory_order_relaxed));
+    write_value(body, "fix_x11_docks_updates_merged_total", "counter", "Updates folded into an already queued one.",
+                (double) metrics.updates_merged.load(std::memory_order_relaxed));
+    write_value(body, "fix_x11_docks_updates_suppressed_total", "counter", "Updates that needed no X work at all.",
+                (double) metrics.updates_suppressed.load(std::memory_order_relaxed));
+    write_value(body, "fix_x11_docks_x_round_trips_total", "counter", "Blocking requests made to the X server.",
+                (double) metrics.x_round_trips.load(std::memory_order_relaxed));
+    write_value(body, "fix_x11_docks_wakeups_total", "counter", "Times the X thread returned from poll.",
+                (double) metrics.wakeups.load(std::memory_order_relaxed));
+    write_value(body, "fix_x11_docks_work_slices_yielded_total", "counter",
+                "Times the X thread put queued work off to handle X events first.",
+                (double) metrics.work_slices_yielded.load(std::memory_order_relaxed));
+    write_value(body, "fix_x11_docks_startup_to_ready_seconds", "gauge",
+                "From starting up to having proxies for every toplevel that already existed.",
+                (double) metrics.startup_to_ready_ms.load(std::memory_order_relaxed) / 1e3);
+    write_value(body, "fix_x11_docks_x_reconnects_total", "counter", "Times the connection to the X server was lost.",
+                (double) metrics.x_reconnects.load(std::memory_order_relaxed));
+    write_value(body, "fix_x11_docks_reconnect_to_restored_seconds", "gauge",
+                "From losing the X server to having recreated every proxy, for the last reconnect.",
+                (double) metrics.reconnect_to_restored_ms.load(std::memory_order_relaxed) / 1e3);
+    write_stages(body);
+
+    // Answer with a minimal HTTP response so `curl --unix-socket` and
+    // Prometheus-style scrapers work, while `socat`/`nc` still get readable text.
+    char header[160];
+    snprintf(header, sizeof(header),
+             "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n",
+             body.size());
+    std::string response = header + body;
+
+    size_t written = 0;
+    while (written < response.size()) {
+        ssize_t n = write(client, response.data() + written, response.size() - written);
+        if (n <= 0)
+            break;
+        written += n;
+    }
+
+    // Drain whatever request the scraper sent so close() doesn't reset the connection
+    char buffer[512];
+    while (read(client, buffer, sizeof(buffer)) > 0);
+    close(client);
+}
@@ -0,0 +1,97 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef FIX_X11_DOCKS_ON_WAYLAND_METRICS_H
+#define FIX_X11_DOCKS_ON_WAYLAND_METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+/**
+ * Stages we keep latency histograms for. Each one is exported as a
+ * Prometheus summary with a "stage" label.
+ */
+enum MetricStage {
+    STAGE_QUEUE_RESIDENCY, // FutureWork enqueued -> picked up by x_main
+    STAGE_WORK,            // Running a single FutureWork
+    STAGE_X_EVENTS,        // Draining pending X events
+    STAGE_COMMAND_RESIDENCY, // Activate/close queued by the X thread -> run on the Wayland thread
+    STAGE_COUNT,
+};
+
+/** Log2 buckets in nanoseconds, bucket i holds [2^i, 2^(i+1)). */
+const int histogram_buckets = 40;
+
+struct Histogram {
+    std::atomic<uint64_t> buckets[histogram_buckets];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum_ns;
+};
+
+struct Metrics {
+    std::atomic<int64_t> live_toplevels;
+    std::atomic<int64_t> live_proxies;
+    std::atomic<int64_t> queued_work;
+    std::atomic<int64_t> queued_work_high_watermark;
+    std::atomic<uint64_t> updates_merged;
+    std::atomic<uint64_t> updates_suppressed;
+    std::atomic<uint64_t> x_round_trips;
+    std::atomic<uint64_t> wakeups;
+    std::atomic<uint64_t> work_slices_yielded;
+    std::atomic<int64_t> startup_to_ready_ms;
+    std::atomic<uint64_t> x_reconnects;
+    std::atomic<int64_t> reconnect_to_restored_ms;
+    Histogram stages[STAGE_COUNT];
+};
+
+/**
+ * Set once from main() before any thread is started, never changed after.
+ * Every helper below bails out on it first, so with metrics disabled the
+ * hot paths pay for a single predictable branch and nothing else.
+ */
+extern bool metrics_enabled;
+
+extern Metrics metrics;
+
+/** Listening socket, or -1 when metrics are disabled. Polled by x_main. */
+extern int metrics_fd;
+
+inline void metrics_add(std::atomic<uint64_t> &counter, uint64_t amount = 1) {
+    if (metrics_enabled)
+        counter.fetch_add(amount, std::memory_order_relaxed);
+}
+
+inline void metrics_gauge_add(std::atomic<int64_t> &gauge, int64_t amount) {
+    if (metrics_enabled)
+        gauge.fetch_add(amount, std::memory_order_relaxed);
+}
+
+inline void metrics_gauge_set(std::atomic<int64_t> &gauge, int64_t value) {
+    if (metrics_enabled)
+        gauge.store(value, std::memory_order_relaxed);
+}
+
+/** Monotonic time in nanoseconds, or 0 when metrics are disabled. */
+inline uint64_t metrics_now() {
+    if (!metrics_enabled)
+        return 0;
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/** Record the time passed since `start` (a value from metrics_now()) into the stage's histogram. */
+void metrics_observe(MetricStage stage, uint64_t start);
+
+/**
+ * Create the Unix socket at `path` and start listening on it. Must be called
+ * before lock_the_land() since binding creates a file. Returns false on error.
+ */
+bool metrics_open_socket(const char *path);
+
+/** Accept one pending scraper connection on metrics_fd and answer it. */
+void metrics_serve();
+
+#endif //FIX_X11_DOCKS_ON_WAYLAND_METRICS_H
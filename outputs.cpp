@@ -0,0 +1,339 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#include "outputs.h"
+#include "x_proxy_windows.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <wayland-client.h>
+
+#include "xdg-output-unstable-v1.h"
+
+struct Output {
+    struct wl_output *output;
+    uint32_t global;
+    struct zxdg_output_v1 *xdg_output = nullptr;
+    std::string name;
+    int x = 0;                  // Logical position from xdg-output, or wl_output's geometry without it
+    int y = 0;
+    std::string announced;      // key() as of the last done
+};
+
+struct PendingMove {
+    Toplevel *toplevel;
+    uint64_t first_ms;          // The change that started the wait, for output_move_max_delay_ms
+    uint64_t due_ms;
+};
+
+static struct zxdg_output_manager_v1 *xdg_output_manager = nullptr;
+static std::vector<Output *> outputs;
+static std::vector<PendingMove> pending;
+static int timer_fd = -1;
+
+static uint64_t monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/** Have the timer fire `wait_ms` from now, or never for 0. */
+static void arm_timer(uint64_t wait_ms) {
+    if (timer_fd == -1)
+        return;
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = wait_ms / 1000;
+    spec.it_value.tv_nsec = (wait_ms % 1000) * 1000000;
+    // All zeroes disarms it
+    timerfd_settime(timer_fd, 0, &spec, nullptr);
+}
+
+/** What Toplevel::sent_output compares against: the name, and the position for outputs placed by it. */
+static std::string key(Output *o) {
+    return o->name + "@" + std::to_string(o->x) + "," + std::to_string(o->y);
+}
+
+static Output *find_output(struct wl_output *output) {
+    for (Output *o: outputs)
+        if (o->output == output)
+            return o;
+    return nullptr;
+}
+
+/** Have the toplevel's proxy follow it, right away for its first placement and debounced after that. */
+static void schedule(Toplevel *toplevel, bool now) {
+    uint64_t ms = monotonic_ms();
+    for (auto &p: pending) {
+        if (p.toplevel == toplevel) {
+            p.due_ms = now ? ms : std::min(ms + output_move_debounce_ms, p.first_ms + output_move_max_delay_ms);
+            return;
+        }
+    }
+    pending.push_back({toplevel, ms, now ? ms : ms + output_move_debounce_ms});
+}
+
+/** An output's name or position is known or changed: its toplevels' proxies follow right away. */
+static void output_done(Output *o) {
+    std::string k = key(o);
+    if (k == o->announced)
+        return;
+    log_debug("output %s at %d,%d", o->name.c_str(), o->x, o->y);
+    o->announced = k;
+    struct Toplevel *t;
+    wl_list_for_each(t, &toplevels, link)
+        if (!t->outputs.empty() && t->outputs.back() == o->output)
+            schedule(t, true);
+}
+
+/************************
+ *                      *
+ *    zxdg_output_v1    *
+ *                      *
+ ************************/
+static void xdg_output_handle_logical_position(void *data, struct zxdg_output_v1 *xdg_output, int32_t x, int32_t y) {
+    auto o = (Output *) data;
+    o->x = x;
+    o->y = y;
+}
+
+static void xdg_output_handle_logical_size(void *data, struct zxdg_output_v1 *xdg_output,
+                                           int32_t width, int32_t height) {
+    /* deliberately left empty */
+}
+
+static void xdg_output_handle_done(void *data, struct zxdg_output_v1 *xdg_output) {
+    // From version 3 on, wl_output.done covers xdg-output too
+    if (zxdg_output_v1_get_version(xdg_output) < 3)
+        output_done((Output *) data);
+}
+
+static void xdg_output_handle_name(void *data, struct zxdg_output_v1 *xdg_output, const char *name) {
+    auto o = (Output *) data;
+    o->name = name;
+}
+
+static void xdg_output_handle_description(void *data, struct zxdg_output_v1 *xdg_output, const char *description) {
+    /* deliberately left empty */
+}
+
+static const struct zxdg_output_v1_listener xdg_output_listener = {
+        .logical_position = xdg_output_handle_logical_position,
+        .logical_size     = xdg_output_handle_logical_size,
+        .done             = xdg_output_handle_done,
+        .name             = xdg_output_handle_name,
+        .description      = xdg_output_handle_description,
+};
+
+static void get_xdg_output(Output *o) {
+    o->xdg_output = zxdg_output_manager_v1_get_xdg_output(xdg_output_manager, o->output);
+    zxdg_output_v1_add_listener(o->xdg_output, &xdg_output_listener, o);
+}
+
+/*******************
+ *                 *
+ *    wl_output    *
+ *                 *
+ *******************/
+static void output_handle_geometry(void *data, struct wl_output *output, int32_t x, int32_t y,
+                                   int32_t physical_width, int32_t physical_height, int32_t subpixel,
+                                   const char *make, const char *model, int32_t transform) {
+    auto o = (Output *) data;
+    // xdg-output's logical position is the one that accounts for scaling
+    if (!o->xdg_output) {
+        o->x = x;
+        o->y = y;
+    }
+    // Version 1 has no done event
+    if (wl_output_get_version(output) < 2)
+        output_done(o);
+}
+
+static void output_handle_mode(void *data, struct wl_output *output, uint32_t flags,
+                               int32_t width, int32_t height, int32_t refresh) {
+    /* deliberately left empty */
+}
+
+static void output_handle_done(void *data, struct wl_output *output) {
+    output_done((Output *) data);
+}
+
+static void output_handle_scale(void *data, struct wl_output *output, int32_t factor) {
+    /* deliberately left empty */
+}
+
+static void output_handle_name(void *data, struct wl_output *output, const char *name) {
+    auto o = (Output *) data;
+    o->name = name;
+}
+
+static void output_handle_description(void *data, struct wl_output *output, const char *description) {
+    /* deliberately left empty */
+}
+
+static const struct wl_output_listener output_listener = {
+        .geometry    = output_handle_geometry,
+        .mode        = output_handle_mode,
+        .done        = output_handle_done,
+        .scale       = output_handle_scale,
+        .name        = output_handle_name,
+        .description = output_handle_description,
+};
+
+static void release_output(Output *o) {
+    if (o->xdg_output)
+        zxdg_output_v1_destroy(o->xdg_output);
+    if (wl_output_get_version(o->output) >= 3)
+        wl_output_release(o->output);
+    else
+        wl_output_destroy(o->output);
+    delete o;
+}
+
+bool outputs_bind(wl_registry *registry, uint32_t name, const char *interface, uint32_t version) {
+    bool is_output = strcmp(interface, wl_output_interface.name) == 0;
+    bool is_manager = strcmp(interface, zxdg_output_manager_v1_interface.name) == 0;
+    if (!is_output && !is_manager)
+        return false;
+    if (timer_fd == -1) {
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer_fd == -1)
+            log_warn("outputs: no timerfd, proxies follow their toplevel across outputs without debouncing");
+    }
+    
+    if (is_manager) {
+        log_debug("Binding zxdg-output-manager-v1.");
+        xdg_output_manager = static_cast<zxdg_output_manager_v1 *>(wl_registry_bind(
+                registry, name, &zxdg_output_manager_v1_interface, std::min(version, 3u)));
+        for (Output *o: outputs)
+            if (!o->xdg_output)
+                get_xdg_output(o);
+        return true;
+    }
+    
+    auto o = new Output;
+    o->global = name;
+    o->output = static_cast<wl_output *>(wl_registry_bind(
+            registry, name, &wl_output_interface, std::min(version, 4u)));
+    wl_output_add_listener(o->output, &output_listener, o);
+    if (xdg_output_manager)
+        get_xdg_output(o);
+    outputs.push_back(o);
+    return true;
+}
+
+void outputs_global_remove(uint32_t name) {
+    auto found = std::find_if(outputs.begin(), outputs.end(), [name](Output *o) { return o->global == name; });
+    if (found == outputs.end())
+        return;
+    Output *o = *found;
+    log_debug("output %s removed", o->name.c_str());
+    struct Toplevel *t;
+    wl_list_for_each(t, &toplevels, link) {
+        auto on = std::find(t->outputs.begin(), t->outputs.end(), o->output);
+        if (on == t->outputs.end())
+            continue;
+        t->outputs.erase(on);
+        schedule(t, false);
+    }
+    outputs.erase(found);
+    release_output(o);
+}
+
+void outputs_toplevel_enter(Toplevel *toplevel, wl_output *output) {
+    auto &on = toplevel->outputs;
+    on.erase(std::remove(on.begin(), on.end(), output), on.end());
+    on.push_back(output);
+    schedule(toplevel, toplevel->sent_output.empty());
+}
+
+void outputs_toplevel_leave(Toplevel *toplevel, wl_output *output) {
+    auto &on = toplevel->outputs;
+    on.erase(std::remove(on.begin(), on.end(), output), on.end());
+    schedule(toplevel, false);
+}
+
+void outputs_toplevel_done(Toplevel *toplevel) {
+    // Its enter came while the rules still kept it from having a proxy
+    if (toplevel->wants_proxy && toplevel->sent_output.empty() && !toplevel->outputs.empty())
+        schedule(toplevel, true);
+}
+
+void outputs_forget(Toplevel *toplevel) {
+    pending.erase(std::remove_if(pending.begin(), pending.end(), [toplevel](const PendingMove &p) {
+        return p.toplevel == toplevel;
+    }), pending.end());
+    // Otherwise it fires for nothing, and outputs_flush() disarms it then
+    if (pending.empty())
+        arm_timer(0);
+}
+
+int outputs_timer_fd() {
+    return timer_fd;
+}
+
+void outputs_flush() {
+    // Drained even with nothing pending, or a readable timer keeps the poll spinning
+    uint64_t expirations;
+    if (timer_fd != -1)
+        read(timer_fd, &expirations, sizeof(expirations));
+    if (pending.empty())
+        return;
+    
+    uint64_t now = monotonic_ms();
+    uint64_t next_due = 0;
+    std::vector<ProxyOutput> moves;
+    for (auto it = pending.begin(); it != pending.end();) {
+        // Without a timer nothing would come back for it, so it goes now
+        if (it->due_ms > now && timer_fd != -1) {
+            next_due = next_due == 0 ? it->due_ms : std::min(next_due, it->due_ms);
+            ++it;
+            continue;
+        }
+        Toplevel *t = it->toplevel;
+        it = pending.erase(it);
+        // On no output (minimized, or its output went away) it stays where it was
+        Output *o = t->outputs.empty() ? nullptr : find_output(t->outputs.back());
+        if (!t->wants_proxy || !o || key(o) == t->sent_output)
+            continue;
+        t->sent_output = key(o);
+        log_debug("toplevel %ld: on output %s", t->id, o->name.c_str());
+        ProxyOutput move;
+        move.toplevel_id = t->id;
+        move.name = o->name;
+        move.x = o->x;
+        move.y = o->y;
+        moves.push_back(move);
+    }
+    
+    arm_timer(next_due == 0 ? 0 : next_due - now);
+    if (!moves.empty())
+        move_proxies_to_outputs(std::move(moves));
+}
+
+void outputs_resend() {
+    struct Toplevel *t;
+    wl_list_for_each(t, &toplevels, link) {
+        if (!t->wants_proxy || t->outputs.empty())
+            continue;
+        t->sent_output.clear();
+        schedule(t, true);
+    }
+}
+
+void outputs_unbind() {
+    for (Output *o: outputs)
+        release_output(o);
+    if (xdg_output_manager)
+        zxdg_output_manager_v1_destroy(xdg_output_manager);
+    outputs.clear();
+    pending.clear();
+    arm_timer(0);
+    xdg_output_manager = nullptr;
+}
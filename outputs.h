@@ -0,0 +1,59 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef FIX_X11_DOCKS_ON_WAYLAND_OUTPUTS_H
+#define FIX_X11_DOCKS_ON_WAYLAND_OUTPUTS_H
+
+#include "main.h"
+
+#include <cstdint>
+
+struct wl_registry;
+struct wl_output;
+
+/**
+ * Which monitor each toplevel is on, so its proxy sits on the same monitor
+ * and per-monitor docks only list the windows shown there. Outputs are
+ * named through wl_output v4 or xdg-output; the X thread finds the RandR
+ * output of the same name (XWayland uses the compositor's names) and falls
+ * back to the output's logical position when there is none.
+ */
+
+/**
+ * How long a toplevel has to stay on an output before its proxy follows,
+ * so a window dragged across several screens moves its proxy once. Every
+ * enter or leave restarts the wait, up to output_move_max_delay_ms.
+ */
+const int output_move_debounce_ms = 200;
+const int output_move_max_delay_ms = 1000;
+
+/** Bind wl_output or zxdg_output_manager_v1. Returns true if `interface` was one of them. Wayland thread. */
+bool outputs_bind(wl_registry *registry, uint32_t name, const char *interface, uint32_t version);
+
+/** The global `name` went away; if it was an output, its toplevels are moved off it. Wayland thread. */
+void outputs_global_remove(uint32_t name);
+
+/** The toplevel entered or left `output`, schedule its proxy to follow. Wayland thread. */
+void outputs_toplevel_enter(Toplevel *toplevel, wl_output *output);
+void outputs_toplevel_leave(Toplevel *toplevel, wl_output *output);
+
+/** A toplevel is done; one that just got a proxy is placed on its output right away. Wayland thread. */
+void outputs_toplevel_done(Toplevel *toplevel);
+
+/** Forget a toplevel that's going away. Wayland thread. */
+void outputs_forget(Toplevel *toplevel);
+
+/** Becomes readable when a debounced move is due, then call outputs_flush(). -1 until outputs_bind() bound something. */
+int outputs_timer_fd();
+
+/** Send the X thread every move that's due as one batch, and arm the timer for the rest. Wayland thread. */
+void outputs_flush();
+
+/** Have the next outputs_flush() send every toplevel's output again, the X thread dropped them. */
+void outputs_resend();
+
+/** Let go of everything bound by outputs_bind(), the connection is gone. */
+void outputs_unbind();
+
+#endif //FIX_X11_DOCKS_ON_WAYLAND_OUTPUTS_H
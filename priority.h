@@ -0,0 +1,35 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef FIX_X11_DOCKS_ON_WAYLAND_PRIORITY_H
+#define FIX_X11_DOCKS_ON_WAYLAND_PRIORITY_H
+
+#include "main.h"
+
+/** Prompt work run in a row while lazy work is waiting, before the lazy work gets a turn. */
+const int prompt_work_per_lazy = 4;
+
+/**
+ * Which of `queues`, one per CommandPriority, x_main takes from next: urgent
+ * first, then prompt, letting lazy in every prompt_work_per_lazy items.
+ * `prompt_streak` carries over between calls. Returns PRIORITY_COUNT if all
+ * of them are empty. See test2/priority_flood_test.cpp.
+ */
+template<typename Queue>
+CommandPriority next_priority(const Queue (&queues)[PRIORITY_COUNT], int &prompt_streak) {
+    bool lazy_waiting = !queues[PRIORITY_LAZY].empty();
+    if (!queues[PRIORITY_URGENT].empty())
+        return PRIORITY_URGENT;
+    if (!queues[PRIORITY_PROMPT].empty() && (!lazy_waiting || prompt_streak < prompt_work_per_lazy)) {
+        prompt_streak++;
+        return PRIORITY_PROMPT;
+    }
+    if (lazy_waiting) {
+        prompt_streak = 0;
+        return PRIORITY_LAZY;
+    }
+    return PRIORITY_COUNT;
+}
+
+#endif //FIX_X11_DOCKS_ON_WAYLAND_PRIORITY_H
@@ -0,0 +1,40 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef FIX_X11_DOCKS_ON_WAYLAND_PROBES_H
+#define FIX_X11_DOCKS_ON_WAYLAND_PROBES_H
+
+/**
+ * USDT tracepoints under the "fix_x11_docks" provider. When nobody is attached
+ * a probe is a single nop, so they stay in release builds. List them with
+ *
+ *     bpftrace -l 'usdt:/usr/bin/fix_x11_docks:*'
+ *
+ * and, for example, measure queue latency with
+ *
+ *     bpftrace -e 'usdt:/usr/bin/fix_x11_docks:work_enqueue { @t[arg0] = nsecs; }
+ *                  usdt:/usr/bin/fix_x11_docks:work_dequeue /@t[arg0]/ {
+ *                      @us = hist((nsecs - @t[arg0]) / 1000); delete(@t[arg0]); }'
+ *
+ * Without <sys/sdt.h> (systemtap-sdt-dev / systemtap-devel) they compile to nothing.
+ */
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HAVE_USDT_PROBES
+#endif
+#endif
+
+#ifdef HAVE_USDT_PROBES
+#define PROBE1(name, a) DTRACE_PROBE1(fix_x11_docks, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(fix_x11_docks, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(fix_x11_docks, name, a, b, c)
+#else
+#define PROBE1(name, a) do {} while (0)
+#define PROBE2(name, a, b) do {} while (0)
+#define PROBE3(name, a, b, c) do {} while (0)
+#endif
+
+#endif //FIX_X11_DOCKS_ON_WAYLAND_PROBES_H
@@ -0,0 +1,127 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#include "resample.h"
+
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void premultiply(uint32_t *pixels, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t p = pixels[i];
+        uint32_t a = p >> 24;
+        if (a == 255)
+            continue;
+        uint32_t r = ((p >> 16) & 0xff) * a / 255;
+        uint32_t g = ((p >> 8) & 0xff) * a / 255;
+        uint32_t b = (p & 0xff) * a / 255;
+        pixels[i] = a << 24 | r << 16 | g << 8 | b;
+    }
+}
+
+void unpremultiply(uint32_t *pixels, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t p = pixels[i];
+        uint32_t a = p >> 24;
+        if (a == 255)
+            continue;
+        if (a == 0) {
+            pixels[i] = 0;
+            continue;
+        }
+        uint32_t r = std::min<uint32_t>(255, (((p >> 16) & 0xff) * 255 + a / 2) / a);
+        uint32_t g = std::min<uint32_t>(255, (((p >> 8) & 0xff) * 255 + a / 2) / a);
+        uint32_t b = std::min<uint32_t>(255, ((p & 0xff) * 255 + a / 2) / a);
+        pixels[i] = a << 24 | r << 16 | g << 8 | b;
+    }
+}
+
+/** Average of the [x0, x1) x [y0, y1) box, one channel at a time. */
+static uint32_t box_average_scalar(const uint32_t *src, int stride, int x0, int x1, int y0, int y1) {
+    uint32_t a = 0, r = 0, g = 0, b = 0;
+    for (int y = y0; y < y1; y++) {
+        const uint32_t *row = src + (size_t) y * stride;
+        for (int x = x0; x < x1; x++) {
+            uint32_t p = row[x];
+            a += p >> 24;
+            r += (p >> 16) & 0xff;
+            g += (p >> 8) & 0xff;
+            b += p & 0xff;
+        }
+    }
+    uint32_t n = (uint32_t) ((x1 - x0) * (y1 - y0));
+    a = (a + n / 2) / n;
+    r = (r + n / 2) / n;
+    g = (g + n / 2) / n;
+    b = (b + n / 2) / n;
+    return a << 24 | r << 16 | g << 8 | b;
+}
+
+#ifdef __SSE2__
+
+/** Average of the [x0, x1) x [y0, y1) box, all four channels at once. */
+static uint32_t box_average(const uint32_t *src, int stride, int x0, int x1, int y0, int y1) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum = zero; // Four 32-bit lanes: b, g, r, a
+    for (int y = y0; y < y1; y++) {
+        const uint32_t *row = src + (size_t) y * stride;
+        int x = x0;
+        while (x < x1) {
+            // Two pixels side by side in 16-bit lanes, spilled to 32 bits before 255 * 256 overflows them
+            __m128i row_sum = zero;
+            int end = std::min(x1, x + 256);
+            for (; x + 2 <= end; x += 2) {
+                __m128i two = _mm_loadl_epi64((const __m128i *) (row + x));
+                row_sum = _mm_add_epi16(row_sum, _mm_unpacklo_epi8(two, zero));
+            }
+            if (x < end) {
+                row_sum = _mm_add_epi16(row_sum, _mm_unpacklo_epi8(_mm_cvtsi32_si128((int) row[x]), zero));
+                x++;
+            }
+            row_sum = _mm_add_epi16(row_sum, _mm_srli_si128(row_sum, 8));
+            sum = _mm_add_epi32(sum, _mm_unpacklo_epi16(row_sum, zero));
+        }
+    }
+
+    float n = (float) ((x1 - x0) * (y1 - y0));
+    __m128i average = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(sum), _mm_set1_ps(1.0f / n)));
+    average = _mm_packs_epi32(average, average);
+    average = _mm_packus_epi16(average, average);
+    return (uint32_t) _mm_cvtsi128_si32(average);
+}
+
+#else
+
+static uint32_t box_average(const uint32_t *src, int stride, int x0, int x1, int y0, int y1) {
+    return box_average_scalar(src, stride, x0, x1, y0, y1);
+}
+
+#endif
+
+template<uint32_t (*average)(const uint32_t *, int, int, int, int, int)>
+static void resample_with(const uint32_t *src, int src_width, int src_height,
+                          uint32_t *dst, int dst_width, int dst_height) {
+    for (int y = 0; y < dst_height; y++) {
+        int y0 = (int) ((int64_t) y * src_height / dst_height);
+        int y1 = std::max(y0 + 1, (int) ((int64_t) (y + 1) * src_height / dst_height));
+        for (int x = 0; x < dst_width; x++) {
+            int x0 = (int) ((int64_t) x * src_width / dst_width);
+            int x1 = std::max(x0 + 1, (int) ((int64_t) (x + 1) * src_width / dst_width));
+            dst[(size_t) y * dst_width + x] = average(src, src_width, x0, x1, y0, y1);
+        }
+    }
+}
+
+void resample_box(const uint32_t *src, int src_width, int src_height,
+                  uint32_t *dst, int dst_width, int dst_height) {
+    resample_with<box_average>(src, src_width, src_height, dst, dst_width, dst_height);
+}
+
+void resample_box_scalar(const uint32_t *src, int src_width, int src_height,
+                         uint32_t *dst, int dst_width, int dst_height) {
+    resample_with<box_average_scalar>(src, src_width, src_height, dst, dst_width, dst_height);
+}
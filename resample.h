@@ -0,0 +1,29 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef FIX_X11_DOCKS_ON_WAYLAND_RESAMPLE_H
+#define FIX_X11_DOCKS_ON_WAYLAND_RESAMPLE_H
+
+#include <cstddef>
+#include <cstdint>
+
+/** 0xAARRGGBB with straight alpha -> premultiplied, in place. */
+void premultiply(uint32_t *pixels, size_t count);
+
+/** Premultiplied 0xAARRGGBB -> straight alpha, in place. */
+void unpremultiply(uint32_t *pixels, size_t count);
+
+/**
+ * Box filter (area average) from `src` to `dst`, both premultiplied
+ * 0xAARRGGBB, rows packed. Meant for shrinking; growing degrades to
+ * nearest neighbour. Uses SSE2 where the compiler targets it.
+ */
+void resample_box(const uint32_t *src, int src_width, int src_height,
+                  uint32_t *dst, int dst_width, int dst_height);
+
+/** resample_box() without SSE2, what test2/resample_bench.cpp measures it against. */
+void resample_box_scalar(const uint32_t *src, int src_width, int src_height,
+                         uint32_t *dst, int dst_width, int dst_height);
+
+#endif //FIX_X11_DOCKS_ON_WAYLAND_RESAMPLE_H
@@ -0,0 +1,211 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#include "rules.h"
+#include "log.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <regex>
+#include <string>
+#include <vector>
+
+enum RuleState {
+    RULE_STATE_FULLSCREEN = 1 << 0,
+    RULE_STATE_MAXIMIZED = 1 << 1,
+    RULE_STATE_MINIMIZED = 1 << 2,
+    RULE_STATE_ACTIVATED = 1 << 3,
+};
+
+struct Rule {
+    bool include = false;
+    bool has_app_id = false;
+    bool has_title = false;
+    std::regex app_id;
+    std::regex title;
+    unsigned states = 0; // RuleState bits that must all be set
+};
+
+bool skip_transients = false;
+
+static std::vector<Rule> rules;
+static std::vector<std::string> rule_lines; // What `rules` was compiled from, to tell whether a reload changes anything
+static std::string rules_path;
+
+static std::string default_rules_path() {
+    const char *xdg_config_home = getenv("XDG_CONFIG_HOME");
+    const char *home = getenv("HOME");
+    if (xdg_config_home && *xdg_config_home)
+        return std::string(xdg_config_home) + "/fix_x11_docks/rules";
+    if (home)
+        return std::string(home) + "/.config/fix_x11_docks/rules";
+    return "";
+}
+
+/** Split a rule line into words; a value in double quotes may contain spaces and \" for a quote. */
+static std::vector<std::string> split_words(const char *line) {
+    std::vector<std::string> words;
+    const char *p = line;
+    while (true) {
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == '\0' || *p == '#')
+            break;
+        std::string word;
+        bool quoted = false;
+        for (; *p != '\0' && (quoted || (*p != ' ' && *p != '\t')); p++) {
+            if (*p == '"') {
+                quoted = !quoted;
+            } else if (quoted && p[0] == '\\' && p[1] == '"') {
+                word += '"';
+                p++;
+            } else {
+                word += *p;
+            }
+        }
+        words.push_back(word);
+    }
+    return words;
+}
+
+static bool parse_states(const std::string &value, unsigned *states) {
+    size_t start = 0;
+    while (start <= value.size()) {
+        size_t comma = value.find(',', start);
+        std::string name = value.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        if (name == "fullscreen")
+            *states |= RULE_STATE_FULLSCREEN;
+        else if (name == "maximized")
+            *states |= RULE_STATE_MAXIMIZED;
+        else if (name == "minimized")
+            *states |= RULE_STATE_MINIMIZED;
+        else if (name == "activated")
+            *states |= RULE_STATE_ACTIVATED;
+        else
+            return false;
+        if (comma == std::string::npos)
+            break;
+        start = comma + 1;
+    }
+    return true;
+}
+
+/** Returns false (and says why in `error`) if `words` isn't a rule. */
+static bool parse_rule(const std::vector<std::string> &words, Rule *rule, std::string *error) {
+    if (words[0] == "include") {
+        rule->include = true;
+    } else if (words[0] != "exclude") {
+        *error = "expected include or exclude, got '" + words[0] + "'";
+        return false;
+    }
+    if (words.size() < 2) {
+        *error = "rule without conditions";
+        return false;
+    }
+    
+    auto flags = std::regex::ECMAScript | std::regex::optimize;
+    for (size_t i = 1; i < words.size(); i++) {
+        size_t equals = words[i].find('=');
+        std::string key = words[i].substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : words[i].substr(equals + 1);
+        try {
+            if (key == "app_id") {
+                rule->app_id = std::regex(value, flags);
+                rule->has_app_id = true;
+            } else if (key == "title") {
+                rule->title = std::regex(value, flags);
+                rule->has_title = true;
+            } else if (key == "state") {
+                if (!parse_states(value, &rule->states)) {
+                    *error = "unknown state in '" + value + "'";
+                    return false;
+                }
+            } else {
+                *error = "unknown condition '" + key + "'";
+                return false;
+            }
+        } catch (const std::regex_error &e) {
+            *error = "bad regex '" + value + "': " + e.what();
+            return false;
+        }
+    }
+    return true;
+}
+
+/** The rules in rules_path, none if it's missing. Returns false if it couldn't be opened. */
+static bool load_rules(std::vector<Rule> *loaded, std::vector<std::string> *lines) {
+    if (rules_path.empty())
+        return false;
+    FILE *f = fopen(rules_path.c_str(), "r");
+    if (!f)
+        return false;
+    
+    char line[4096];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line_number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        auto words = split_words(line);
+        if (words.empty())
+            continue;
+        Rule rule;
+        std::string error;
+        if (parse_rule(words, &rule, &error)) {
+            loaded->push_back(std::move(rule));
+            lines->push_back(line);
+        } else {
+            log_warn("rules: %s:%d: %s, skipping it", rules_path.c_str(), line_number, error.c_str());
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+void rules_init(const char *path_override) {
+    rules_path = path_override ? path_override : default_rules_path();
+    if (load_rules(&rules, &rule_lines))
+        log_info("rules: loaded %zu from %s", rules.size(), rules_path.c_str());
+    else if (path_override)
+        log_warn("rules: could not open %s: %s", rules_path.c_str(), strerror(errno));
+}
+
+bool rules_reload() {
+    std::vector<Rule> loaded;
+    std::vector<std::string> lines;
+    load_rules(&loaded, &lines);
+    if (lines == rule_lines)
+        return false;
+    rules = std::move(loaded);
+    rule_lines = std::move(lines);
+    log_info("rules: reloaded %zu from %s", rules.size(), rules_path.c_str());
+    return true;
+}
+
+const std::string &rules_file() {
+    return rules_path;
+}
+
+bool rules_allow(const Toplevel *toplevel) {
+    if (skip_transients && toplevel->parent)
+        return false;
+    if (rules.empty())
+        return true;
+    
+    unsigned states = (toplevel->fullscreen ? RULE_STATE_FULLSCREEN : 0) |
+                      (toplevel->maximized ? RULE_STATE_MAXIMIZED : 0) |
+                      (toplevel->minimized ? RULE_STATE_MINIMIZED : 0) |
+                      (toplevel->activated ? RULE_STATE_ACTIVATED : 0);
+    for (auto &rule: rules) {
+        // Cheapest first, most rules won't get past the app_id
+        if ((rule.states & states) != rule.states)
+            continue;
+        if (rule.has_app_id && !std::regex_search(toplevel->app_id, rule.app_id))
+            continue;
+        if (rule.has_title && !std::regex_search(toplevel->title, rule.title))
+            continue;
+        return rule.include;
+    }
+    return true;
+}
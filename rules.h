@@ -0,0 +1,51 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef FIX_X11_DOCKS_ON_WAYLAND_RULES_H
+#define FIX_X11_DOCKS_ON_WAYLAND_RULES_H
+
+#include "main.h"
+
+/**
+ * Which toplevels get a proxy, from $XDG_CONFIG_HOME/fix_x11_docks/rules
+ * (or --rules <file>). One rule per line:
+ *
+ *     exclude app_id=^org\.gnome\.Shell\.Extensions$
+ *     exclude title="Picture-in-Picture"
+ *     include app_id=firefox title=Library
+ *     exclude app_id=firefox state=fullscreen
+ *
+ * app_id and title are ECMAScript regexes searched anywhere in the string
+ * (anchor them to match the whole of it), state is a comma separated list
+ * of fullscreen, maximized, minimized and activated that must all be set.
+ * A rule matches if all of its conditions do; the first matching rule
+ * decides and toplevels no rule matches get a proxy.
+ */
+
+/**
+ * Read and compile the rules. A missing file means no rules, lines that
+ * don't parse are logged and skipped. Must be called before lock_the_land().
+ */
+void rules_init(const char *path_override);
+
+/**
+ * Read the file again (a missing one means no rules). Returns true if the
+ * rules are different now, in which case every toplevel needs another
+ * rules_allow(). Wayland thread.
+ */
+bool rules_reload();
+
+/** Where the rules are read from, "" if there is no config directory. */
+const std::string &rules_file();
+
+/**
+ * --skip-transients: children (dialogs and the like, see Toplevel::parent)
+ * get no proxy at all instead of one with WM_TRANSIENT_FOR. Set once from main().
+ */
+extern bool skip_transients;
+
+/** Whether `toplevel` should have a proxy as it is now. Wayland thread. */
+bool rules_allow(const Toplevel *toplevel);
+
+#endif //FIX_X11_DOCKS_ON_WAYLAND_RULES_H
@@ -0,0 +1,59 @@
+#!/bin/bash
+#
+# A run that adopted the previous run's proxies and is then stopped must
+# take them down too, they belong to the previous run's retained client and
+# DestroyAll alone doesn't reach them. Against the stand-in compositor, on a
+# throwaway Xvfb. Needs wayland-scanner, wayland-server, Xvfb and a built
+# fix_x11_docks (from install.sh, or point FIX_X11_DOCKS at one).
+set -e
+cd "$(dirname "$0")"
+
+FIX_X11_DOCKS=${FIX_X11_DOCKS:-../newbuild/fix_x11_docks}
+PROTOCOLS=../wayland_protocol
+GENERATED=$(mktemp -d)
+trap 'kill $DOCKS $COMPOSITOR $XVFB 2>/dev/null; rm -rf $GENERATED' EXIT
+
+for protocol in ext-foreign-toplevel-list-v1 ext-image-capture-source-v1 ext-image-copy-capture-v1; do
+    wayland-scanner server-header < $PROTOCOLS/$protocol.xml > $GENERATED/$protocol-server.h
+done
+gcc -o stand_in_compositor stand_in_compositor.c -I$GENERATED \
+    $PROTOCOLS/ext-foreign-toplevel-list-v1.c $PROTOCOLS/ext-image-capture-source-v1.c \
+    $PROTOCOLS/ext-image-copy-capture-v1.c $(pkg-config --cflags --libs wayland-server)
+gcc -o count_proxies count_proxies.c -lX11
+
+Xvfb :96 -screen 0 1280x1024x24 &
+XVFB=$!
+./stand_in_compositor stand-in-96 &
+COMPOSITOR=$!
+sleep 1
+
+# Start fix_x11_docks with "$@", give it a second, stop it the way systemd does
+run_and_stop() {
+    DISPLAY=:96 WAYLAND_DISPLAY=stand-in-96 $FIX_X11_DOCKS --debug "$@" &
+    DOCKS=$!
+    sleep 1
+    UP=$(DISPLAY=:96 ./count_proxies)
+    kill -TERM $DOCKS
+    wait $DOCKS || true
+    DOCKS=
+    sleep 0.5
+    LEFT=$(DISPLAY=:96 ./count_proxies)
+}
+
+expect() {
+    if [ "$1" != "$2" ]; then
+        echo "FAILED: $3: expected $2, got $1"
+        exit 1
+    fi
+    echo "ok: $3"
+}
+
+run_and_stop --keep-proxies
+expect "$UP" 3 "a proxy for each of the stand-in's 3 toplevels"
+expect "$LEFT" 3 "--keep-proxies leaves them up"
+
+run_and_stop
+expect "$UP" 3 "the next run adopts them instead of adding its own"
+expect "$LEFT" 0 "stopping after the adoption takes the adopted proxies down"
+
+echo "adopt and stop test passed"
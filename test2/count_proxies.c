@@ -0,0 +1,44 @@
+// Prints how many proxies are up: top level windows with the
+// IS_WAYLAND_TOPLEVEL_PROXY marker, whichever client they belong to.
+// See adopt_stop_test.sh.
+
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <stdio.h>
+
+static int is_proxy(Display *display, Window window, Atom marker) {
+    Atom type;
+    int format;
+    unsigned long count, after;
+    unsigned char *data = NULL;
+    if (XGetWindowProperty(display, window, marker, 0, 1, False, XA_INTEGER, &type, &format, &count, &after,
+                           &data) != Success)
+        return 0;
+    int found = data != NULL && count == 1;
+    if (data)
+        XFree(data);
+    return found;
+}
+
+int main(void) {
+    Display *display = XOpenDisplay(NULL);
+    if (!display) {
+        fprintf(stderr, "count_proxies: no X display\n");
+        return 1;
+    }
+    Atom marker = XInternAtom(display, "IS_WAYLAND_TOPLEVEL_PROXY", False);
+
+    Window root_return, parent_return, *children = NULL;
+    unsigned int child_count = 0;
+    XQueryTree(display, DefaultRootWindow(display), &root_return, &parent_return, &children, &child_count);
+    int proxies = 0;
+    for (unsigned int i = 0; i < child_count; i++)
+        if (is_proxy(display, children[i], marker))
+            proxies++;
+    if (children)
+        XFree(children);
+
+    printf("%d\n", proxies);
+    XCloseDisplay(display);
+    return 0;
+}
@@ -0,0 +1,140 @@
+// Urgent work has to stay fast however much lazy work is queued ahead of
+// it. Drives next_priority(), the order x_main takes work in, the way
+// take_next_work() does: one item at a time off mutex guarded queues, with
+// the Wayland thread flooding PRIORITY_LAZY and sending the odd urgent item.
+// See priority_flood_test.sh.
+
+#include "../priority.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+struct Item {
+    CommandPriority priority;
+    Clock::time_point queued_at;
+};
+
+// What an item costs x_main, about an icon or title update
+const auto lazy_cost = std::chrono::microseconds(20);
+const int lazy_flood = 50000;
+const int urgent_items = 200;
+
+// An urgent item waits for at most the item running when it comes in; this leaves room for the scheduler
+const auto max_urgent_wait = std::chrono::milliseconds(5);
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    printf("%s: %s\n", ok ? "ok" : "FAILED", what);
+    if (!ok)
+        failures++;
+}
+
+static void spin(Clock::duration d) {
+    auto until = Clock::now() + d;
+    while (Clock::now() < until) {
+    }
+}
+
+/** The order alone, no threads: what comes out of queues filled up front. */
+static void test_order() {
+    std::deque<int> queues[PRIORITY_COUNT];
+    int streak = 0;
+    for (int i = 0; i < 10000; i++)
+        queues[PRIORITY_LAZY].push_back(i);
+    for (int i = 0; i < 100; i++)
+        queues[PRIORITY_PROMPT].push_back(i);
+    queues[PRIORITY_URGENT].push_back(0);
+
+    check(next_priority(queues, streak) == PRIORITY_URGENT, "urgent goes ahead of 10000 lazy and 100 prompt items");
+    queues[PRIORITY_URGENT].pop_front();
+
+    int lazy = 0;
+    for (int i = 0; i < 50; i++) {
+        CommandPriority p = next_priority(queues, streak);
+        if (p == PRIORITY_COUNT)
+            break;
+        queues[p].pop_front();
+        if (p == PRIORITY_LAZY)
+            lazy++;
+    }
+    check(lazy == 50 / (prompt_work_per_lazy + 1), "lazy gets one turn per prompt_work_per_lazy prompt items");
+
+    std::deque<int> empty[PRIORITY_COUNT];
+    check(next_priority(empty, streak) == PRIORITY_COUNT, "nothing comes out of empty queues");
+}
+
+/** Two threads, like the Wayland thread and x_main, with the urgent items' wait measured. */
+static void test_flood() {
+    std::mutex mutex;
+    std::deque<Item> queues[PRIORITY_COUNT];
+    std::atomic<bool> done(false);
+    std::vector<Clock::duration> waits;
+
+    std::thread x_thread([&] {
+        int streak = 0;
+        while (true) {
+            Item item;
+            bool idle = false;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                CommandPriority p = next_priority(queues, streak);
+                if (p == PRIORITY_COUNT) {
+                    if (done)
+                        return;
+                    idle = true;
+                } else {
+                    item = queues[p].front();
+                    queues[p].pop_front();
+                }
+            }
+            // x_main would be in poll() here
+            if (idle)
+                std::this_thread::yield();
+            else if (item.priority == PRIORITY_URGENT)
+                waits.push_back(Clock::now() - item.queued_at);
+            else
+                spin(lazy_cost);
+        }
+    });
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int i = 0; i < lazy_flood; i++)
+            queues[PRIORITY_LAZY].push_back({PRIORITY_LAZY, Clock::now()});
+    }
+    // The flood takes about a second to drain, the urgent items come in while it does
+    for (int i = 0; i < urgent_items; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        std::lock_guard<std::mutex> lock(mutex);
+        queues[PRIORITY_URGENT].push_back({PRIORITY_URGENT, Clock::now()});
+        queues[PRIORITY_LAZY].push_back({PRIORITY_LAZY, Clock::now()});
+    }
+    done = true;
+    x_thread.join();
+
+    check(waits.size() == urgent_items, "every urgent item ran");
+    if (waits.empty())
+        return;
+    std::sort(waits.begin(), waits.end());
+    auto us = [](Clock::duration d) {
+        return (long long) std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+    };
+    printf("urgent wait under a flood of %d lazy items: median %lld us, p99 %lld us, max %lld us\n", lazy_flood,
+           us(waits[waits.size() / 2]), us(waits[waits.size() * 99 / 100]), us(waits.back()));
+    check(waits[waits.size() * 99 / 100] < max_urgent_wait, "urgent items wait less than 5 ms under the flood");
+}
+
+int main() {
+    test_order();
+    test_flood();
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,7 @@
+#!/bin/bash
+#
+# Only needs the wayland-client headers, for main.h
+set -e
+cd "$(dirname "$0")"
+g++ -std=c++17 -O2 -o priority_flood_test priority_flood_test.cpp $(pkg-config --cflags wayland-client) -pthread
+./priority_flood_test
@@ -0,0 +1,103 @@
+// Acts like a dock that shows previews: keeps asking every proxy for a
+// thumbnail and counts the ones published. Exits non-zero if a proxy never
+// got one. See thumbnails_test.sh.
+
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_PROXIES 64
+
+static int is_proxy(Display *display, Window window, Atom marker) {
+    Atom type;
+    int format;
+    unsigned long count, after;
+    unsigned char *data = NULL;
+    if (XGetWindowProperty(display, window, marker, 0, 1, False, XA_INTEGER, &type, &format, &count, &after,
+                           &data) != Success)
+        return 0;
+    int found = data != NULL && count == 1;
+    if (data)
+        XFree(data);
+    return found;
+}
+
+/** The pixmap published on the proxy, None if there is none yet. */
+static Pixmap thumbnail_of(Display *display, Window window, Atom thumbnail) {
+    Atom type;
+    int format;
+    unsigned long count, after;
+    unsigned char *data = NULL;
+    Pixmap pixmap = None;
+    if (XGetWindowProperty(display, window, thumbnail, 0, 1, False, XA_PIXMAP, &type, &format, &count, &after,
+                           &data) == Success && data && count == 1)
+        pixmap = *(Pixmap *) data;
+    if (data)
+        XFree(data);
+    return pixmap;
+}
+
+int main(int argc, char *argv[]) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 10;
+    Display *display = XOpenDisplay(NULL);
+    if (!display) {
+        fprintf(stderr, "request_thumbnails: no X display\n");
+        return 1;
+    }
+    Atom marker = XInternAtom(display, "IS_WAYLAND_TOPLEVEL_PROXY", False);
+    Atom request = XInternAtom(display, "_FIX_X11_DOCKS_THUMBNAIL_REQUEST", False);
+    Atom thumbnail = XInternAtom(display, "_FIX_X11_DOCKS_THUMBNAIL", False);
+
+    Window proxies[MAX_PROXIES];
+    int published[MAX_PROXIES];
+    int proxy_count = 0;
+    memset(published, 0, sizeof(published));
+
+    // Slightly over thumbnail_min_interval_ms, so every request gets through
+    for (int round = 0; round < seconds * 1000 / 600; round++) {
+        Window root_return, parent_return, *children = NULL;
+        unsigned int child_count = 0;
+        XQueryTree(display, DefaultRootWindow(display), &root_return, &parent_return, &children, &child_count);
+        proxy_count = 0;
+        for (unsigned int i = 0; i < child_count && proxy_count < MAX_PROXIES; i++)
+            if (is_proxy(display, children[i], marker))
+                proxies[proxy_count++] = children[i];
+        if (children)
+            XFree(children);
+
+        for (int i = 0; i < proxy_count; i++) {
+            Pixmap pixmap = thumbnail_of(display, proxies[i], thumbnail);
+            if (pixmap != None) {
+                Window root;
+                int x, y;
+                unsigned int width, height, border, depth;
+                if (XGetGeometry(display, pixmap, &root, &x, &y, &width, &height, &border, &depth)) {
+                    printf("proxy 0x%lx: %ux%u thumbnail\n", proxies[i], width, height);
+                    published[i]++;
+                }
+            }
+
+            XEvent event;
+            memset(&event, 0, sizeof(event));
+            event.xclient.type = ClientMessage;
+            event.xclient.window = proxies[i];
+            event.xclient.message_type = request;
+            event.xclient.format = 32;
+            XSendEvent(display, proxies[i], False, NoEventMask, &event);
+        }
+        XFlush(display);
+        usleep(600 * 1000);
+    }
+
+    int failed = proxy_count == 0;
+    for (int i = 0; i < proxy_count; i++) {
+        printf("proxy 0x%lx: %d thumbnails seen\n", proxies[i], published[i]);
+        if (published[i] == 0)
+            failed = 1;
+    }
+    XCloseDisplay(display);
+    return failed;
+}
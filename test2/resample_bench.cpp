@@ -0,0 +1,73 @@
+// resample_box() against resample_box_scalar() at the sizes that come up:
+// icons down to what docks ask for, and window captures down to a
+// thumbnail. Built with -DBUILD_BENCHMARKS=ON, run ./resample_bench.
+
+#include "../resample.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+struct Case {
+    const char *name;
+    int src_width, src_height;
+    int dst_width, dst_height;
+};
+
+static const Case cases[] = {
+    {"icon 256 -> 64", 256, 256, 64, 64},
+    {"icon 256 -> 48", 256, 256, 48, 48},
+    {"icon 128 -> 16", 128, 128, 16, 16},
+    {"capture 1920x1080 -> 256x144", 1920, 1080, 256, 144},
+    {"capture 3840x2160 -> 256x144", 3840, 2160, 256, 144},
+};
+
+/** Nanoseconds per call, over enough calls to take about 200 ms. */
+static double time_per_call(void (*resample)(const uint32_t *, int, int, uint32_t *, int, int),
+                            const Case &c, const std::vector<uint32_t> &src, std::vector<uint32_t> &dst) {
+    int calls = 0;
+    auto start = Clock::now();
+    auto elapsed = Clock::duration::zero();
+    while (elapsed < std::chrono::milliseconds(200)) {
+        resample(src.data(), c.src_width, c.src_height, dst.data(), c.dst_width, c.dst_height);
+        calls++;
+        elapsed = Clock::now() - start;
+    }
+    return (double) std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / calls;
+}
+
+/** Largest difference of any channel of any pixel, the two round differently. */
+static int max_difference(const std::vector<uint32_t> &a, const std::vector<uint32_t> &b) {
+    int largest = 0;
+    for (size_t i = 0; i < a.size(); i++)
+        for (int shift = 0; shift < 32; shift += 8)
+            largest = std::max(largest, std::abs((int) (a[i] >> shift & 0xff) - (int) (b[i] >> shift & 0xff)));
+    return largest;
+}
+
+int main() {
+    int failed = 0;
+    printf("%-30s %12s %12s %8s\n", "", "scalar", "resample_box", "speedup");
+    for (const Case &c: cases) {
+        std::vector<uint32_t> src((size_t) c.src_width * c.src_height);
+        srand(1);
+        for (auto &p: src)
+            p = (uint32_t) rand() << 16 ^ (uint32_t) rand();
+        premultiply(src.data(), src.size());
+        std::vector<uint32_t> fast((size_t) c.dst_width * c.dst_height);
+        std::vector<uint32_t> scalar(fast.size());
+
+        double scalar_ns = time_per_call(resample_box_scalar, c, src, scalar);
+        double fast_ns = time_per_call(resample_box, c, src, fast);
+        printf("%-30s %9.1f us %9.1f us %7.2fx\n", c.name, scalar_ns / 1000, fast_ns / 1000, scalar_ns / fast_ns);
+        if (max_difference(fast, scalar) > 1) {
+            printf("  results differ by more than rounding\n");
+            failed = 1;
+        }
+    }
+    return failed;
+}
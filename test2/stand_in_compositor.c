@@ -0,0 +1,324 @@
+// A stand-in compositor for --previews: it lists a few synthetic toplevels
+// over ext-foreign-toplevel-list-v1 and answers ext-image-copy-capture-v1
+// captures of them with generated buffers. Captures cycle through success
+// and every way a capture can fail, including the constraints changing
+// while a frame is in flight. See thumbnails_test.sh.
+
+#include <wayland-server.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+
+#include "ext-foreign-toplevel-list-v1-server.h"
+#include "ext-image-capture-source-v1-server.h"
+#include "ext-image-copy-capture-v1-server.h"
+
+struct synthetic_toplevel {
+    const char *title;
+    const char *app_id;
+    const char *identifier;
+    uint32_t width;
+    uint32_t height;
+};
+
+static struct synthetic_toplevel toplevels[] = {
+    {"Synthetic window 1", "stand-in", "stand-in-1", 640, 480},
+    {"Synthetic window 2", "stand-in", "stand-in-2", 1920, 1080},
+    {"Synthetic window 3", "stand-in", "stand-in-3", 300, 900},
+};
+#define TOPLEVEL_COUNT (sizeof(toplevels) / sizeof(toplevels[0]))
+
+// What the nth capture of a session does
+enum outcome {
+    OUTCOME_READY,
+    OUTCOME_FAILED,                  // failed(unknown)
+    OUTCOME_RESIZED,                 // New buffer_size and done, then failed(buffer_constraints)
+    OUTCOME_FORMATS_GONE,            // done without any shm_format while the frame is in flight, then ready
+    OUTCOME_STOPPED,                 // failed(stopped) and the session stops
+    OUTCOME_COUNT,
+};
+
+static const char *outcome_names[] = {"ready", "failed", "resized", "formats gone", "stopped"};
+
+struct session {
+    struct wl_resource *resource;
+    int toplevel;
+    uint32_t width;
+    uint32_t height;
+    int captures;
+    struct wl_list frames;       // frame.link
+};
+
+struct frame {
+    struct wl_resource *resource;
+    struct session *session;     // NULL once the session is gone
+    struct wl_list link;
+    struct wl_resource *buffer;
+};
+
+static struct wl_display *display;
+static unsigned long captured_frames = 0;
+
+static void destroy_resource(struct wl_client *client, struct wl_resource *resource) {
+    wl_resource_destroy(resource);
+}
+
+static void send_constraints(struct session *s, int with_format) {
+    ext_image_copy_capture_session_v1_send_buffer_size(s->resource, s->width, s->height);
+    if (with_format)
+        ext_image_copy_capture_session_v1_send_shm_format(s->resource, WL_SHM_FORMAT_ARGB8888);
+    ext_image_copy_capture_session_v1_send_done(s->resource);
+}
+
+/**************************
+ *                        *
+ *    toplevel listing    *
+ *                        *
+ **************************/
+static void list_handle_stop(struct wl_client *client, struct wl_resource *resource) {
+    ext_foreign_toplevel_list_v1_send_finished(resource);
+}
+
+static const struct ext_foreign_toplevel_list_v1_interface list_impl = {
+    .stop = list_handle_stop,
+    .destroy = destroy_resource,
+};
+
+static const struct ext_foreign_toplevel_handle_v1_interface handle_impl = {
+    .destroy = destroy_resource,
+};
+
+static void bind_list(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct wl_resource *list = wl_resource_create(client, &ext_foreign_toplevel_list_v1_interface, 1, id);
+    wl_resource_set_implementation(list, &list_impl, NULL, NULL);
+    for (size_t i = 0; i < TOPLEVEL_COUNT; i++) {
+        struct wl_resource *handle = wl_resource_create(client, &ext_foreign_toplevel_handle_v1_interface, 1, 0);
+        wl_resource_set_implementation(handle, &handle_impl, (void *) (intptr_t) i, NULL);
+        ext_foreign_toplevel_list_v1_send_toplevel(list, handle);
+        ext_foreign_toplevel_handle_v1_send_title(handle, toplevels[i].title);
+        ext_foreign_toplevel_handle_v1_send_app_id(handle, toplevels[i].app_id);
+        ext_foreign_toplevel_handle_v1_send_identifier(handle, toplevels[i].identifier);
+        ext_foreign_toplevel_handle_v1_send_done(handle);
+    }
+}
+
+/************************
+ *                      *
+ *    capture source    *
+ *                      *
+ ************************/
+static const struct ext_image_capture_source_v1_interface source_impl = {
+    .destroy = destroy_resource,
+};
+
+static void source_manager_handle_create_source(struct wl_client *client, struct wl_resource *resource,
+                                                uint32_t id, struct wl_resource *toplevel_handle) {
+    struct wl_resource *source = wl_resource_create(client, &ext_image_capture_source_v1_interface, 1, id);
+    wl_resource_set_implementation(source, &source_impl, wl_resource_get_user_data(toplevel_handle), NULL);
+}
+
+static const struct ext_foreign_toplevel_image_capture_source_manager_v1_interface source_manager_impl = {
+    .create_source = source_manager_handle_create_source,
+    .destroy = destroy_resource,
+};
+
+static void bind_source_manager(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct wl_resource *manager = wl_resource_create(
+            client, &ext_foreign_toplevel_image_capture_source_manager_v1_interface, 1, id);
+    wl_resource_set_implementation(manager, &source_manager_impl, NULL, NULL);
+}
+
+/*****************
+ *               *
+ *    capture    *
+ *               *
+ *****************/
+static void fill(struct frame *f) {
+    struct wl_shm_buffer *shm = wl_shm_buffer_get(f->buffer);
+    uint32_t *pixels = wl_shm_buffer_get_data(shm);
+    int32_t stride = wl_shm_buffer_get_stride(shm) / 4;
+    uint32_t shade = (uint32_t) (captured_frames * 16) & 0xff;
+    wl_shm_buffer_begin_access(shm);
+    for (uint32_t y = 0; y < f->session->height; y++)
+        for (uint32_t x = 0; x < f->session->width; x++)
+            pixels[y * stride + x] = 0xff000000 | (x & 0xff) << 16 | (y & 0xff) << 8 | shade;
+    wl_shm_buffer_end_access(shm);
+}
+
+/** Whether the attached buffer is one the session's constraints allow. */
+static int buffer_fits(struct frame *f) {
+    struct wl_shm_buffer *shm = f->buffer ? wl_shm_buffer_get(f->buffer) : NULL;
+    return shm && (uint32_t) wl_shm_buffer_get_width(shm) == f->session->width &&
+           (uint32_t) wl_shm_buffer_get_height(shm) == f->session->height &&
+           wl_shm_buffer_get_format(shm) == WL_SHM_FORMAT_ARGB8888;
+}
+
+static void send_ready(struct frame *f) {
+    ext_image_copy_capture_frame_v1_send_transform(f->resource, WL_OUTPUT_TRANSFORM_NORMAL);
+    ext_image_copy_capture_frame_v1_send_damage(f->resource, 0, 0, (int32_t) f->session->width,
+                                                (int32_t) f->session->height);
+    ext_image_copy_capture_frame_v1_send_presentation_time(f->resource, 0, 0, 0);
+    ext_image_copy_capture_frame_v1_send_ready(f->resource);
+    captured_frames++;
+}
+
+static void frame_handle_attach_buffer(struct wl_client *client, struct wl_resource *resource,
+                                       struct wl_resource *buffer) {
+    struct frame *f = wl_resource_get_user_data(resource);
+    f->buffer = buffer;
+}
+
+static void frame_handle_damage_buffer(struct wl_client *client, struct wl_resource *resource,
+                                       int32_t x, int32_t y, int32_t width, int32_t height) {
+    /* We always fill the whole buffer. */
+}
+
+static void frame_handle_capture(struct wl_client *client, struct wl_resource *resource) {
+    struct frame *f = wl_resource_get_user_data(resource);
+    struct session *s = f->session;
+    if (!s) {
+        ext_image_copy_capture_frame_v1_send_failed(resource, EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_STOPPED);
+        return;
+    }
+    if (!buffer_fits(f)) {
+        ext_image_copy_capture_frame_v1_send_failed(
+                resource, EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_BUFFER_CONSTRAINTS);
+        return;
+    }
+
+    enum outcome outcome = (enum outcome) (s->captures++ % OUTCOME_COUNT);
+    printf("stand-in: capture %d of %s: %s\n", s->captures, toplevels[s->toplevel].identifier,
+           outcome_names[outcome]);
+    fflush(stdout);
+    switch (outcome) {
+        case OUTCOME_READY:
+            fill(f);
+            send_ready(f);
+            break;
+        case OUTCOME_FAILED:
+            ext_image_copy_capture_frame_v1_send_failed(resource,
+                                                        EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_UNKNOWN);
+            break;
+        case OUTCOME_RESIZED:
+            s->width = s->width / 2 + 1;
+            s->height = s->height / 2 + 1;
+            send_constraints(s, 1);
+            ext_image_copy_capture_frame_v1_send_failed(
+                    resource, EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_BUFFER_CONSTRAINTS);
+            break;
+        case OUTCOME_FORMATS_GONE:
+            // The client gives up on what's waiting, but this frame still comes in
+            send_constraints(s, 0);
+            fill(f);
+            send_ready(f);
+            send_constraints(s, 1);
+            break;
+        case OUTCOME_STOPPED:
+            ext_image_copy_capture_frame_v1_send_failed(resource,
+                                                        EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_STOPPED);
+            ext_image_copy_capture_session_v1_send_stopped(s->resource);
+            break;
+        default:
+            break;
+    }
+}
+
+static const struct ext_image_copy_capture_frame_v1_interface frame_impl = {
+    .destroy = destroy_resource,
+    .attach_buffer = frame_handle_attach_buffer,
+    .damage_buffer = frame_handle_damage_buffer,
+    .capture = frame_handle_capture,
+};
+
+static void frame_destroyed(struct wl_resource *resource) {
+    struct frame *f = wl_resource_get_user_data(resource);
+    wl_list_remove(&f->link);
+    free(f);
+}
+
+static void session_handle_create_frame(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+    struct frame *f = calloc(1, sizeof(struct frame));
+    f->session = wl_resource_get_user_data(resource);
+    wl_list_insert(&f->session->frames, &f->link);
+    f->resource = wl_resource_create(client, &ext_image_copy_capture_frame_v1_interface, 1, id);
+    wl_resource_set_implementation(f->resource, &frame_impl, f, frame_destroyed);
+}
+
+static const struct ext_image_copy_capture_session_v1_interface session_impl = {
+    .create_frame = session_handle_create_frame,
+    .destroy = destroy_resource,
+};
+
+static void session_destroyed(struct wl_resource *resource) {
+    struct session *s = wl_resource_get_user_data(resource);
+    struct frame *f, *tmp;
+    // Frames outlive their session, they only fail from then on
+    wl_list_for_each_safe(f, tmp, &s->frames, link) {
+        f->session = NULL;
+        wl_list_remove(&f->link);
+        wl_list_init(&f->link);
+    }
+    free(s);
+}
+
+static void copy_manager_handle_create_session(struct wl_client *client, struct wl_resource *resource,
+                                               uint32_t id, struct wl_resource *source, uint32_t options) {
+    struct session *s = calloc(1, sizeof(struct session));
+    s->toplevel = (int) (intptr_t) wl_resource_get_user_data(source);
+    s->width = toplevels[s->toplevel].width;
+    s->height = toplevels[s->toplevel].height;
+    wl_list_init(&s->frames);
+    s->resource = wl_resource_create(client, &ext_image_copy_capture_session_v1_interface, 1, id);
+    wl_resource_set_implementation(s->resource, &session_impl, s, session_destroyed);
+    send_constraints(s, 1);
+}
+
+static void copy_manager_handle_create_pointer_cursor_session(struct wl_client *client, struct wl_resource *resource,
+                                                              uint32_t id, struct wl_resource *source,
+                                                              struct wl_resource *pointer) {
+    wl_resource_post_error(resource, EXT_IMAGE_COPY_CAPTURE_MANAGER_V1_ERROR_INVALID_OPTION,
+                           "the stand-in compositor has no cursors");
+}
+
+static const struct ext_image_copy_capture_manager_v1_interface copy_manager_impl = {
+    .create_session = copy_manager_handle_create_session,
+    .create_pointer_cursor_session = copy_manager_handle_create_pointer_cursor_session,
+    .destroy = destroy_resource,
+};
+
+static void bind_copy_manager(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct wl_resource *manager = wl_resource_create(client, &ext_image_copy_capture_manager_v1_interface, 1, id);
+    wl_resource_set_implementation(manager, &copy_manager_impl, NULL, NULL);
+}
+
+static int handle_signal(int signal_number, void *data) {
+    wl_display_terminate(display);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *socket = argc > 1 ? argv[1] : "stand-in-0";
+    display = wl_display_create();
+    if (wl_display_add_socket(display, socket) != 0) {
+        fprintf(stderr, "stand-in: could not listen on %s\n", socket);
+        return 1;
+    }
+    wl_display_init_shm(display);
+    wl_global_create(display, &ext_foreign_toplevel_list_v1_interface, 1, NULL, bind_list);
+    wl_global_create(display, &ext_foreign_toplevel_image_capture_source_manager_v1_interface, 1, NULL,
+                     bind_source_manager);
+    wl_global_create(display, &ext_image_copy_capture_manager_v1_interface, 1, NULL, bind_copy_manager);
+
+    struct wl_event_loop *loop = wl_display_get_event_loop(display);
+    wl_event_loop_add_signal(loop, SIGTERM, handle_signal, NULL);
+    wl_event_loop_add_signal(loop, SIGINT, handle_signal, NULL);
+    printf("stand-in: listening on %s with %zu toplevels\n", socket, TOPLEVEL_COUNT);
+    fflush(stdout);
+    wl_display_run(display);
+
+    printf("stand-in: %lu frames captured\n", captured_frames);
+    wl_display_destroy(display);
+    return 0;
+}
@@ -0,0 +1,39 @@
+#!/bin/bash
+#
+# --previews against the stand-in compositor, on a throwaway Xvfb. Needs
+# wayland-scanner, wayland-server, Xvfb and a built fix_x11_docks (from
+# install.sh, or point FIX_X11_DOCKS at one).
+set -e
+cd "$(dirname "$0")"
+
+FIX_X11_DOCKS=${FIX_X11_DOCKS:-../newbuild/fix_x11_docks}
+PROTOCOLS=../wayland_protocol
+GENERATED=$(mktemp -d)
+trap 'kill $DOCKS $COMPOSITOR $XVFB 2>/dev/null; rm -rf $GENERATED' EXIT
+
+for protocol in ext-foreign-toplevel-list-v1 ext-image-capture-source-v1 ext-image-copy-capture-v1; do
+    wayland-scanner server-header < $PROTOCOLS/$protocol.xml > $GENERATED/$protocol-server.h
+done
+gcc -o stand_in_compositor stand_in_compositor.c -I$GENERATED \
+    $PROTOCOLS/ext-foreign-toplevel-list-v1.c $PROTOCOLS/ext-image-capture-source-v1.c \
+    $PROTOCOLS/ext-image-copy-capture-v1.c $(pkg-config --cflags --libs wayland-server)
+gcc -o request_thumbnails request_thumbnails.c -lX11
+
+Xvfb :97 -screen 0 1280x1024x24 &
+XVFB=$!
+./stand_in_compositor stand-in-97 &
+COMPOSITOR=$!
+sleep 1
+
+DISPLAY=:97 WAYLAND_DISPLAY=stand-in-97 $FIX_X11_DOCKS --previews --debug &
+DOCKS=$!
+sleep 1
+
+DISPLAY=:97 ./request_thumbnails 10
+
+# Every way a capture can fail came up by now, it must have survived all of them
+if ! kill -0 $DOCKS 2>/dev/null; then
+    echo "fix_x11_docks died"
+    exit 1
+fi
+echo "thumbnails test passed"
@@ -0,0 +1,339 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#include "thumbnails.h"
+#include "x_proxy_windows.h"
+#include "resample.h"
+#include "trace.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <wayland-client.h>
+
+#include "ext-foreign-toplevel-list-v1.h"
+#include "ext-image-capture-source-v1.h"
+#include "ext-image-copy-capture-v1.h"
+
+bool thumbnails_enabled = false;
+
+static ext_foreign_toplevel_image_capture_source_manager_v1 *source_manager = nullptr;
+static ext_image_copy_capture_manager_v1 *capture_manager = nullptr;
+static wl_shm *shm = nullptr;
+
+// Filled from any thread, drained by thumbnails_handle_requests()
+static std::mutex requests_mutex;
+static std::vector<ThumbnailRequest> requests;
+
+/** One capture session per toplevel, kept while the toplevel lives so later captures skip the setup. */
+struct ThumbnailSession {
+    Toplevel *toplevel = nullptr;
+    ext_image_capture_source_v1 *source = nullptr;
+    ext_image_copy_capture_session_v1 *session = nullptr;
+    ext_image_copy_capture_frame_v1 *frame = nullptr;
+
+    // Buffer constraints, the pending ones apply on session.done
+    uint32_t width = 0, height = 0;
+    int32_t format = -1;
+    uint32_t pending_width = 0, pending_height = 0;
+    int32_t pending_format = -1;
+
+    wl_buffer *buffer = nullptr;
+    void *data = nullptr;
+    size_t size = 0;
+    uint32_t buffer_width = 0, buffer_height = 0;
+    int32_t buffer_format = -1;
+
+    // At most one per proxy, the X thread doesn't ask again until it's answered
+    std::vector<ThumbnailRequest> waiting;
+    ThumbnailRequest capturing;  // Taken off waiting for `frame`, answered when it's ready or fails
+};
+
+bool thumbnails_bind(wl_registry *registry, uint32_t name, const char *interface, uint32_t version) {
+    if (!thumbnails_enabled)
+        return false;
+    if (strcmp(interface, ext_foreign_toplevel_image_capture_source_manager_v1_interface.name) == 0) {
+        log_debug("Binding ext-foreign-toplevel-image-capture-source-manager-v1.");
+        source_manager = static_cast<ext_foreign_toplevel_image_capture_source_manager_v1 *>(wl_registry_bind(
+                registry, name, &ext_foreign_toplevel_image_capture_source_manager_v1_interface, 1));
+        return true;
+    } else if (strcmp(interface, ext_image_copy_capture_manager_v1_interface.name) == 0) {
+        log_debug("Binding ext-image-copy-capture-manager-v1.");
+        capture_manager = static_cast<ext_image_copy_capture_manager_v1 *>(wl_registry_bind(
+                registry, name, &ext_image_copy_capture_manager_v1_interface, 1));
+        return true;
+    } else if (strcmp(interface, wl_shm_interface.name) == 0 && shm == NULL) {
+        shm = static_cast<wl_shm *>(wl_registry_bind(registry, name, &wl_shm_interface, 1));
+        return true;
+    }
+    return false;
+}
+
+static void fail_waiting(ThumbnailSession *s) {
+    for (auto &request: s->waiting)
+        thumbnail_captured(request.target, 0, 0);
+    s->waiting.clear();
+}
+
+static void destroy_buffer(ThumbnailSession *s) {
+    if (s->buffer)
+        wl_buffer_destroy(s->buffer);
+    if (s->data)
+        munmap(s->data, s->size);
+    s->buffer = nullptr;
+    s->data = nullptr;
+    s->size = 0;
+}
+
+static void destroy_session(ThumbnailSession *s) {
+    fail_waiting(s);
+    if (s->frame) {
+        thumbnail_captured(s->capturing.target, 0, 0);
+        ext_image_copy_capture_frame_v1_destroy(s->frame);
+    }
+    if (s->session)
+        ext_image_copy_capture_session_v1_destroy(s->session);
+    if (s->source)
+        ext_image_capture_source_v1_destroy(s->source);
+    destroy_buffer(s);
+    s->toplevel->thumbnail = nullptr;
+    delete s;
+}
+
+static bool allocate_buffer(ThumbnailSession *s) {
+    destroy_buffer(s);
+    uint32_t stride = s->width * 4;
+    s->size = (size_t) stride * s->height;
+    int fd = memfd_create("fix_x11_docks-thumbnail", MFD_CLOEXEC);
+    if (fd < 0)
+        return false;
+    if (ftruncate(fd, (off_t) s->size) != 0) {
+        close(fd);
+        return false;
+    }
+    s->data = mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (s->data == MAP_FAILED) {
+        s->data = nullptr;
+        close(fd);
+        return false;
+    }
+    wl_shm_pool *pool = wl_shm_create_pool(shm, fd, (int32_t) s->size);
+    s->buffer = wl_shm_pool_create_buffer(pool, 0, (int32_t) s->width, (int32_t) s->height, (int32_t) stride,
+                                          (uint32_t) s->format);
+    wl_shm_pool_destroy(pool);
+    close(fd);
+    s->buffer_width = s->width;
+    s->buffer_height = s->height;
+    s->buffer_format = s->format;
+    return true;
+}
+
+static void try_capture(ThumbnailSession *s);
+
+static void frame_handle_transform(void *data, ext_image_copy_capture_frame_v1 *frame, uint32_t transform) {
+    /* Thumbnails of rotated outputs stay rotated, not worth a second pass. */
+}
+
+static void frame_handle_damage(void *data, ext_image_copy_capture_frame_v1 *frame,
+                                int32_t x, int32_t y, int32_t width, int32_t height) {
+    /* We always scale the whole frame. */
+}
+
+static void frame_handle_presentation_time(void *data, ext_image_copy_capture_frame_v1 *frame,
+                                           uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec) {
+    /* deliberately left empty */
+}
+
+static void frame_handle_ready(void *data, ext_image_copy_capture_frame_v1 *frame) {
+    auto s = (ThumbnailSession *) data;
+    ext_image_copy_capture_frame_v1_destroy(frame);
+    s->frame = nullptr;
+    ThumbnailRequest request = s->capturing;
+
+    int largest = (int) std::max(s->buffer_width, s->buffer_height);
+    int width = (int) s->buffer_width, height = (int) s->buffer_height;
+    if (largest > thumbnail_max_size) {
+        width = std::max(1, width * thumbnail_max_size / largest);
+        height = std::max(1, height * thumbnail_max_size / largest);
+    }
+    {
+        TraceSpan span("thumbnail_scale", s->toplevel->id);
+        // wl_shm's ARGB8888 is premultiplied 0xAARRGGBB words, which is what a depth 32 pixmap wants too
+        resample_box((const uint32_t *) s->data, (int) s->buffer_width, (int) s->buffer_height,
+                     request.pixels, width, height);
+        if (s->buffer_format == WL_SHM_FORMAT_XRGB8888)
+            for (size_t i = 0; i < (size_t) width * height; i++)
+                request.pixels[i] |= 0xff000000;
+    }
+    thumbnail_captured(request.target, width, height);
+
+    try_capture(s);
+}
+
+static void frame_handle_failed(void *data, ext_image_copy_capture_frame_v1 *frame, uint32_t reason) {
+    auto s = (ThumbnailSession *) data;
+    ext_image_copy_capture_frame_v1_destroy(frame);
+    s->frame = nullptr;
+
+    switch (reason) {
+        case EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_BUFFER_CONSTRAINTS:
+            /* Retried on session.done, unless that already came with the new constraints. */
+            s->waiting.insert(s->waiting.begin(), s->capturing);
+            if (s->buffer_width != s->width || s->buffer_height != s->height || s->buffer_format != s->format)
+                try_capture(s);
+            return;
+        case EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_STOPPED:
+            thumbnail_captured(s->capturing.target, 0, 0);
+            destroy_session(s);
+            return;
+        default:
+            log_debug("thumbnails: capture of toplevel %zu failed", s->toplevel->id);
+            thumbnail_captured(s->capturing.target, 0, 0);
+            try_capture(s);
+            return;
+    }
+}
+
+static const struct ext_image_copy_capture_frame_v1_listener frame_listener = {
+        .transform         = frame_handle_transform,
+        .damage            = frame_handle_damage,
+        .presentation_time = frame_handle_presentation_time,
+        .ready             = frame_handle_ready,
+        .failed            = frame_handle_failed,
+};
+
+/** Start a capture if someone is waiting for one and the session is ready for it. */
+static void try_capture(ThumbnailSession *s) {
+    if (s->waiting.empty() || s->frame || s->format < 0 || s->width == 0 || s->height == 0)
+        return;
+    if (!s->buffer || s->buffer_width != s->width || s->buffer_height != s->height ||
+        s->buffer_format != s->format) {
+        if (!allocate_buffer(s)) {
+            log_warn("thumbnails: could not allocate a %ux%u buffer: %s", s->width, s->height, strerror(errno));
+            fail_waiting(s);
+            return;
+        }
+    }
+
+    s->capturing = s->waiting.front();
+    s->waiting.erase(s->waiting.begin());
+    s->frame = ext_image_copy_capture_session_v1_create_frame(s->session);
+    ext_image_copy_capture_frame_v1_add_listener(s->frame, &frame_listener, s);
+    ext_image_copy_capture_frame_v1_attach_buffer(s->frame, s->buffer);
+    ext_image_copy_capture_frame_v1_damage_buffer(s->frame, 0, 0, (int32_t) s->width, (int32_t) s->height);
+    ext_image_copy_capture_frame_v1_capture(s->frame);
+}
+
+static void session_handle_buffer_size(void *data, ext_image_copy_capture_session_v1 *session,
+                                       uint32_t width, uint32_t height) {
+    auto s = (ThumbnailSession *) data;
+    s->pending_width = width;
+    s->pending_height = height;
+}
+
+static void session_handle_shm_format(void *data, ext_image_copy_capture_session_v1 *session, uint32_t format) {
+    auto s = (ThumbnailSession *) data;
+    // ARGB if offered, XRGB otherwise; we can't scale anything else
+    if (format == WL_SHM_FORMAT_ARGB8888 ||
+        (format == WL_SHM_FORMAT_XRGB8888 && s->pending_format != WL_SHM_FORMAT_ARGB8888))
+        s->pending_format = (int32_t) format;
+}
+
+static void session_handle_dmabuf_device(void *data, ext_image_copy_capture_session_v1 *session,
+                                         struct wl_array *device) {
+    /* We only do shm. */
+}
+
+static void session_handle_dmabuf_format(void *data, ext_image_copy_capture_session_v1 *session,
+                                         uint32_t format, struct wl_array *modifiers) {
+    /* We only do shm. */
+}
+
+static void session_handle_done(void *data, ext_image_copy_capture_session_v1 *session) {
+    auto s = (ThumbnailSession *) data;
+    s->width = s->pending_width;
+    s->height = s->pending_height;
+    s->format = s->pending_format;
+    s->pending_format = -1;
+    if (s->format < 0) {
+        log_warn("thumbnails: compositor offers no ARGB8888/XRGB8888 shm buffers for toplevel %zu",
+                 s->toplevel->id);
+        fail_waiting(s);
+        return;
+    }
+    try_capture(s);
+}
+
+static void session_handle_stopped(void *data, ext_image_copy_capture_session_v1 *session) {
+    destroy_session((ThumbnailSession *) data);
+}
+
+static const struct ext_image_copy_capture_session_v1_listener session_listener = {
+        .buffer_size   = session_handle_buffer_size,
+        .shm_format    = session_handle_shm_format,
+        .dmabuf_device = session_handle_dmabuf_device,
+        .dmabuf_format = session_handle_dmabuf_format,
+        .done          = session_handle_done,
+        .stopped       = session_handle_stopped,
+};
+
+void thumbnails_request(const ThumbnailRequest &request) {
+    {
+        std::lock_guard<std::mutex> lock(requests_mutex);
+        requests.push_back(request);
+    }
+    wakeup_wayland();
+}
+
+void thumbnails_handle_requests() {
+    std::vector<ThumbnailRequest> batch;
+    {
+        std::lock_guard<std::mutex> lock(requests_mutex);
+        batch.swap(requests);
+    }
+
+    for (auto &request: batch) {
+        Toplevel *toplevel = find_toplevel_by_proxy(request.window);
+        // The capture source is made from the ext handle, zwlr ones can't be captured
+        if (!toplevel || !toplevel->ext_handle || !source_manager || !capture_manager || !shm) {
+            thumbnail_captured(request.target, 0, 0);
+            continue;
+        }
+
+        ThumbnailSession *s = toplevel->thumbnail;
+        if (!s) {
+            s = new ThumbnailSession;
+            s->toplevel = toplevel;
+            s->source = ext_foreign_toplevel_image_capture_source_manager_v1_create_source(source_manager,
+                                                                                            toplevel->ext_handle);
+            s->session = ext_image_copy_capture_manager_v1_create_session(capture_manager, s->source, 0);
+            ext_image_copy_capture_session_v1_add_listener(s->session, &session_listener, s);
+            toplevel->thumbnail = s;
+        }
+        s->waiting.push_back(request);
+        try_capture(s);
+    }
+}
+
+void thumbnails_forget(Toplevel *toplevel) {
+    if (toplevel->thumbnail)
+        destroy_session(toplevel->thumbnail);
+}
+
+void thumbnails_unbind() {
+    if (source_manager)
+        ext_foreign_toplevel_image_capture_source_manager_v1_destroy(source_manager);
+    if (capture_manager)
+        ext_image_copy_capture_manager_v1_destroy(capture_manager);
+    if (shm)
+        wl_shm_destroy(shm);
+    source_manager = nullptr;
+    capture_manager = nullptr;
+    shm = nullptr;
+}
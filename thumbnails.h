@@ -0,0 +1,57 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef FIX_X11_DOCKS_ON_WAYLAND_THUMBNAILS_H
+#define FIX_X11_DOCKS_ON_WAYLAND_THUMBNAILS_H
+
+#include "main.h"
+
+#include <cstdint>
+
+struct wl_registry;
+
+/**
+ * Window previews for docks (--previews).
+ *
+ * A dock asks for one by sending a _FIX_X11_DOCKS_THUMBNAIL_REQUEST client
+ * message to a proxy. The X thread hands us a piece of MIT-SHM memory, we
+ * capture the toplevel through ext-image-copy-capture-v1, scale it straight
+ * into that memory and the X thread points the proxy's _FIX_X11_DOCKS_THUMBNAIL
+ * property at the shared pixmap backed by it.
+ */
+
+/** Set once from main() before any thread is started. */
+extern bool thumbnails_enabled;
+
+/** Biggest side of a thumbnail, in pixels. */
+const int thumbnail_max_size = 256;
+
+/** A proxy gets a fresh capture at most this often, requests in between are dropped. */
+const int thumbnail_min_interval_ms = 500;
+
+struct ThumbnailRequest {
+    int window = 0;               // The proxy
+    uint32_t *pixels = nullptr;   // thumbnail_max_size^2 words of shared memory to scale into
+    void *target = nullptr;       // Handed back to thumbnail_captured() untouched
+};
+
+/** Bind the capture globals. Returns true if `interface` was one of ours. Wayland thread. */
+bool thumbnails_bind(wl_registry *registry, uint32_t name, const char *interface, uint32_t version);
+
+/**
+ * Capture the toplevel behind `request.window`. Every request is answered
+ * with exactly one thumbnail_captured() call, also when it fails. Any thread.
+ */
+void thumbnails_request(const ThumbnailRequest &request);
+
+/** Start the captures asked for since the last call. Wayland thread. */
+void thumbnails_handle_requests();
+
+/** Drop the capture session of a toplevel that's going away. Wayland thread. */
+void thumbnails_forget(Toplevel *toplevel);
+
+/** Let go of the globals bound by thumbnails_bind(), the connection is gone. Forget every toplevel first. */
+void thumbnails_unbind();
+
+#endif //FIX_X11_DOCKS_ON_WAYLAND_THUMBNAILS_H
@@ -0,0 +1,110 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#include "trace.h"
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+bool trace_enabled = false;
+std::atomic<bool> trace_dump_requested{false};
+
+struct TraceEvent {
+    std::atomic<const char *> name; // Stored last, a slot is only complete once this is set
+    uint64_t start;
+    uint64_t duration;
+    int64_t toplevel;
+    int tid;
+};
+
+// Big enough for a few minutes of a busy session (~10MB), after that we
+// stop recording instead of growing the buffer on the hot path.
+const size_t max_trace_events = 1 << 18;
+
+static TraceEvent *events = nullptr;
+static std::atomic<size_t> next_event{0};
+static FILE *trace_file = nullptr;
+
+bool trace_open(const char *path) {
+    trace_file = fopen(path, "w");
+    if (!trace_file) {
+        fprintf(stderr, "ERROR: could not open trace file %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    events = new TraceEvent[max_trace_events]();
+    trace_enabled = true;
+    return true;
+}
+
+uint64_t trace_now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static int current_tid() {
+    static thread_local int tid = (int) syscall(SYS_gettid);
+    return tid;
+}
+
+void trace_record(const char *name, uint64_t start, int64_t toplevel) {
+    uint64_t end = trace_now();
+    size_t index = next_event.fetch_add(1, std::memory_order_relaxed);
+    if (index >= max_trace_events)
+        return;
+
+    TraceEvent &event = events[index];
+    event.start = start;
+    event.duration = end - start;
+    event.toplevel = toplevel;
+    event.tid = current_tid();
+    event.name.store(name, std::memory_order_release);
+}
+
+void trace_dump() {
+    if (!trace_enabled)
+        return;
+
+    size_t count = next_event.load(std::memory_order_relaxed);
+    size_t dropped = 0;
+    if (count > max_trace_events) {
+        dropped = count - max_trace_events;
+        count = max_trace_events;
+    }
+
+    rewind(trace_file);
+    if (ftruncate(fileno(trace_file), 0) != 0)
+        fprintf(stderr, "ERROR: could not truncate trace file: %s\n", strerror(errno));
+
+    fprintf(trace_file, "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_events\":%zu},\"traceEvents\":[\n",
+            dropped);
+    bool first = true;
+    int pid = getpid();
+    for (size_t i = 0; i < count; i++) {
+        TraceEvent &event = events[i];
+        // Still being written by another thread, it'll make it into the next dump
+        const char *name = event.name.load(std::memory_order_acquire);
+        if (!name)
+            continue;
+
+        fprintf(trace_file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                first ? "" : ",\n", name, pid, event.tid,
+                (double) event.start / 1000.0, (double) event.duration / 1000.0);
+        if (event.toplevel >= 0)
+            fprintf(trace_file, ",\"args\":{\"toplevel\":%lld}", (long long) event.toplevel);
+        fputc('}', trace_file);
+        first = false;
+    }
+    fputs("\n]}\n", trace_file);
+    fflush(trace_file);
+}
+
+void trace_dump_if_requested() {
+    if (trace_dump_requested.exchange(false))
+        trace_dump();
+}
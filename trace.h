@@ -0,0 +1,58 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef FIX_X11_DOCKS_ON_WAYLAND_TRACE_H
+#define FIX_X11_DOCKS_ON_WAYLAND_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Chrome trace-event timeline (loadable in chrome://tracing or ui.perfetto.dev).
+ *
+ * Spans are appended to a buffer that is allocated up front and only turned
+ * into JSON at exit or when SIGUSR1 asks for it, so recording an event is a
+ * clock read and a few stores, no allocation and no I/O.
+ */
+
+/** Set once from main() before any thread is started. */
+extern bool trace_enabled;
+
+/** Set from the SIGUSR1 handler, consumed by trace_dump_if_requested(). */
+extern std::atomic<bool> trace_dump_requested;
+
+/**
+ * Open the output file and allocate the event buffer. Must be called before
+ * lock_the_land(), since it creates a file. Returns false on error.
+ */
+bool trace_open(const char *path);
+
+uint64_t trace_now();
+
+/** Record a finished span. `toplevel` is the Toplevel id, or -1 if it isn't about one. */
+void trace_record(const char *name, uint64_t start, int64_t toplevel);
+
+/** Serialize everything recorded so far, replacing the previous contents of the file. */
+void trace_dump();
+
+void trace_dump_if_requested();
+
+/** Records the lifetime of the enclosing scope. `name` must be a string literal. */
+struct TraceSpan {
+    const char *name;
+    int64_t toplevel;
+    uint64_t start;
+
+    explicit TraceSpan(const char *name, int64_t toplevel = -1) : name(name), toplevel(toplevel) {
+        start = trace_enabled ? trace_now() : 0;
+    }
+
+    ~TraceSpan() {
+        if (trace_enabled)
+            trace_record(name, start, toplevel);
+    }
+};
+
+#endif //FIX_X11_DOCKS_ON_WAYLAND_TRACE_H
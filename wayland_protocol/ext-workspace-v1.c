@@ -0,0 +1,118 @@
+/* Generated by wayland-scanner 1.23.1 */
+
+/*
+ * Copyright © 2019 Christopher Billington
+ * Copyright © 2020 Ilia Bozhinov
+ * Copyright © 2022 Victoria Brekenfeld
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "wayland-util.h"
+
+#ifndef __has_attribute
+# define __has_attribute(x) 0  /* Compatibility with non-clang compilers. */
+#endif
+
+#if (__has_attribute(visibility) || defined(__GNUC__) && __GNUC__ >= 4)
+#define WL_PRIVATE __attribute__ ((visibility("hidden")))
+#else
+#define WL_PRIVATE
+#endif
+
+extern const struct wl_interface ext_workspace_group_handle_v1_interface;
+extern const struct wl_interface ext_workspace_handle_v1_interface;
+extern const struct wl_interface wl_output_interface;
+
+static const struct wl_interface *ext_workspace_v1_types[] = {
+	NULL,
+	&ext_workspace_group_handle_v1_interface,
+	&ext_workspace_handle_v1_interface,
+	&wl_output_interface,
+	&wl_output_interface,
+	&ext_workspace_handle_v1_interface,
+	&ext_workspace_handle_v1_interface,
+	&ext_workspace_group_handle_v1_interface,
+};
+
+static const struct wl_message ext_workspace_manager_v1_requests[] = {
+	{ "commit", "", ext_workspace_v1_types + 0 },
+	{ "stop", "", ext_workspace_v1_types + 0 },
+};
+
+static const struct wl_message ext_workspace_manager_v1_events[] = {
+	{ "workspace_group", "n", ext_workspace_v1_types + 1 },
+	{ "workspace", "n", ext_workspace_v1_types + 2 },
+	{ "done", "", ext_workspace_v1_types + 0 },
+	{ "finished", "", ext_workspace_v1_types + 0 },
+};
+
+WL_PRIVATE const struct wl_interface ext_workspace_manager_v1_interface = {
+	"ext_workspace_manager_v1", 1,
+	2, ext_workspace_manager_v1_requests,
+	4, ext_workspace_manager_v1_events,
+};
+
+static const struct wl_message ext_workspace_group_handle_v1_requests[] = {
+	{ "create_workspace", "s", ext_workspace_v1_types + 0 },
+	{ "destroy", "", ext_workspace_v1_types + 0 },
+};
+
+static const struct wl_message ext_workspace_group_handle_v1_events[] = {
+	{ "capabilities", "u", ext_workspace_v1_types + 0 },
+	{ "output_enter", "o", ext_workspace_v1_types + 3 },
+	{ "output_leave", "o", ext_workspace_v1_types + 4 },
+	{ "workspace_enter", "o", ext_workspace_v1_types + 5 },
+	{ "workspace_leave", "o", ext_workspace_v1_types + 6 },
+	{ "removed", "", ext_workspace_v1_types + 0 },
+};
+
+WL_PRIVATE const struct wl_interface ext_workspace_group_handle_v1_interface = {
+	"ext_workspace_group_handle_v1", 1,
+	2, ext_workspace_group_handle_v1_requests,
+	6, ext_workspace_group_handle_v1_events,
+};
+
+static const struct wl_message ext_workspace_handle_v1_requests[] = {
+	{ "destroy", "", ext_workspace_v1_types + 0 },
+	{ "activate", "", ext_workspace_v1_types + 0 },
+	{ "deactivate", "", ext_workspace_v1_types + 0 },
+	{ "assign", "o", ext_workspace_v1_types + 7 },
+	{ "remove", "", ext_workspace_v1_types + 0 },
+};
+
+static const struct wl_message ext_workspace_handle_v1_events[] = {
+	{ "id", "s", ext_workspace_v1_types + 0 },
+	{ "name", "s", ext_workspace_v1_types + 0 },
+	{ "coordinates", "a", ext_workspace_v1_types + 0 },
+	{ "state", "u", ext_workspace_v1_types + 0 },
+	{ "capabilities", "u", ext_workspace_v1_types + 0 },
+	{ "removed", "", ext_workspace_v1_types + 0 },
+};
+
+WL_PRIVATE const struct wl_interface ext_workspace_handle_v1_interface = {
+	"ext_workspace_handle_v1", 1,
+	5, ext_workspace_handle_v1_requests,
+	6, ext_workspace_handle_v1_events,
+};
+
@@ -10,3 +10,19 @@ wayland-scanner client-header < wlr-foreign-toplevel-management-unstable-v1.xml
 wayland-scanner private-code < ext-foreign-toplevel-list-v1.xml > ext-foreign-toplevel-list-v1.c
 
 wayland-scanner client-header < ext-foreign-toplevel-list-v1.xml > ext-foreign-toplevel-list-v1.h
+
+wayland-scanner private-code < ext-image-capture-source-v1.xml > ext-image-capture-source-v1.c
+
+wayland-scanner client-header < ext-image-capture-source-v1.xml > ext-image-capture-source-v1.h
+
+wayland-scanner private-code < ext-image-copy-capture-v1.xml > ext-image-copy-capture-v1.c
+
+wayland-scanner client-header < ext-image-copy-capture-v1.xml > ext-image-copy-capture-v1.h
+
+wayland-scanner private-code < ext-workspace-v1.xml > ext-workspace-v1.c
+
+wayland-scanner client-header < ext-workspace-v1.xml > ext-workspace-v1.h
+
+wayland-scanner private-code < xdg-output-unstable-v1.xml > xdg-output-unstable-v1.c
+
+wayland-scanner client-header < xdg-output-unstable-v1.xml > xdg-output-unstable-v1.h
@@ -0,0 +1,317 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#include "workspaces.h"
+#include "x_proxy_windows.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <wayland-client.h>
+
+#include "ext-workspace-v1.h"
+
+bool current_workspace_only = false;
+
+struct WorkspaceGroup {
+    struct ext_workspace_group_handle_v1 *handle;
+    uint32_t order; // Desktops are numbered group by group, in the order the groups were announced
+};
+
+struct Workspace {
+    struct ext_workspace_handle_v1 *handle;
+    uint32_t serial;                  // What Toplevel::workspace refers to, never reused
+    WorkspaceGroup *group = nullptr;
+    std::string name;
+    std::vector<uint32_t> coordinates;
+    uint32_t state = 0;
+    uint64_t activated = 0;           // When it last became active, in activations; the latest is current
+};
+
+static struct ext_workspace_manager_v1 *manager = nullptr;
+static std::vector<WorkspaceGroup *> groups;
+static std::vector<Workspace *> workspaces; // In desktop order after every done
+static uint32_t next_serial = 1;
+static uint32_t next_group_order = 0;
+static uint64_t activations = 0;
+static uint32_t current = 0;                // Serial of the workspace that most recently became active, 0 if none
+
+static bool layout_changed = false;         // Since the last workspaces_flush()
+static std::vector<Toplevel *> pending;     // Opened or focused since the last workspaces_flush()
+static std::vector<std::string> sent_names;
+static int sent_current = -1;
+static bool resend_placements = false;      // Since workspaces_resend()
+
+static Workspace *find_workspace(struct ext_workspace_handle_v1 *handle) {
+    for (Workspace *w: workspaces)
+        if (w->handle == handle)
+            return w;
+    return nullptr;
+}
+
+/*******************************
+ *                             *
+ *    ext_workspace_handle_v1  *
+ *                             *
+ *******************************/
+static void workspace_handle_id(void *data, struct ext_workspace_handle_v1 *handle, const char *id) {
+    /* deliberately left empty */
+}
+
+static void workspace_handle_name(void *data, struct ext_workspace_handle_v1 *handle, const char *name) {
+    auto w = (Workspace *) data;
+    w->name = name;
+}
+
+static void workspace_handle_coordinates(void *data, struct ext_workspace_handle_v1 *handle,
+                                         struct wl_array *coordinates) {
+    auto w = (Workspace *) data;
+    auto begin = (uint32_t *) coordinates->data;
+    w->coordinates.assign(begin, begin + coordinates->size / sizeof(uint32_t));
+}
+
+static void workspace_handle_state(void *data, struct ext_workspace_handle_v1 *handle, uint32_t state) {
+    auto w = (Workspace *) data;
+    if ((state & EXT_WORKSPACE_HANDLE_V1_STATE_ACTIVE) && !(w->state & EXT_WORKSPACE_HANDLE_V1_STATE_ACTIVE))
+        w->activated = ++activations;
+    w->state = state;
+}
+
+static void workspace_handle_capabilities(void *data, struct ext_workspace_handle_v1 *handle, uint32_t capabilities) {
+    /* deliberately left empty */
+}
+
+static void workspace_handle_removed(void *data, struct ext_workspace_handle_v1 *handle) {
+    auto w = (Workspace *) data;
+    workspaces.erase(std::remove(workspaces.begin(), workspaces.end(), w), workspaces.end());
+    ext_workspace_handle_v1_destroy(handle);
+    delete w;
+    // Its toplevels keep the serial, which now matches nothing: no desktop until they're focused again
+}
+
+static const struct ext_workspace_handle_v1_listener workspace_listener = {
+        .id           = workspace_handle_id,
+        .name         = workspace_handle_name,
+        .coordinates  = workspace_handle_coordinates,
+        .state        = workspace_handle_state,
+        .capabilities = workspace_handle_capabilities,
+        .removed      = workspace_handle_removed,
+};
+
+/*************************************
+ *                                   *
+ *    ext_workspace_group_handle_v1  *
+ *                                   *
+ *************************************/
+static void group_handle_capabilities(void *data, struct ext_workspace_group_handle_v1 *handle, uint32_t capabilities) {
+    /* deliberately left empty */
+}
+
+static void group_handle_output_enter(void *data, struct ext_workspace_group_handle_v1 *handle,
+                                      struct wl_output *output) {
+    /* deliberately left empty */
+}
+
+static void group_handle_output_leave(void *data, struct ext_workspace_group_handle_v1 *handle,
+                                      struct wl_output *output) {
+    /* deliberately left empty */
+}
+
+static void group_handle_workspace_enter(void *data, struct ext_workspace_group_handle_v1 *handle,
+                                         struct ext_workspace_handle_v1 *workspace) {
+    if (Workspace *w = find_workspace(workspace))
+        w->group = (WorkspaceGroup *) data;
+}
+
+static void group_handle_workspace_leave(void *data, struct ext_workspace_group_handle_v1 *handle,
+                                         struct ext_workspace_handle_v1 *workspace) {
+    Workspace *w = find_workspace(workspace);
+    if (w && w->group == data)
+        w->group = nullptr;
+}
+
+static void group_handle_removed(void *data, struct ext_workspace_group_handle_v1 *handle) {
+    auto group = (WorkspaceGroup *) data;
+    for (Workspace *w: workspaces)
+        if (w->group == group)
+            w->group = nullptr;
+    groups.erase(std::remove(groups.begin(), groups.end(), group), groups.end());
+    ext_workspace_group_handle_v1_destroy(handle);
+    delete group;
+}
+
+static const struct ext_workspace_group_handle_v1_listener group_listener = {
+        .capabilities    = group_handle_capabilities,
+        .output_enter    = group_handle_output_enter,
+        .output_leave    = group_handle_output_leave,
+        .workspace_enter = group_handle_workspace_enter,
+        .workspace_leave = group_handle_workspace_leave,
+        .removed         = group_handle_removed,
+};
+
+/********************************
+ *                              *
+ *    ext_workspace_manager_v1  *
+ *                              *
+ ********************************/
+static void manager_handle_workspace_group(void *data, struct ext_workspace_manager_v1 *m,
+                                           struct ext_workspace_group_handle_v1 *handle) {
+    auto group = new WorkspaceGroup{handle, next_group_order++};
+    groups.push_back(group);
+    ext_workspace_group_handle_v1_add_listener(handle, &group_listener, group);
+}
+
+static void manager_handle_workspace(void *data, struct ext_workspace_manager_v1 *m,
+                                     struct ext_workspace_handle_v1 *handle) {
+    auto w = new Workspace;
+    w->handle = handle;
+    w->serial = next_serial++;
+    workspaces.push_back(w);
+    ext_workspace_handle_v1_add_listener(handle, &workspace_listener, w);
+}
+
+static void manager_handle_done(void *data, struct ext_workspace_manager_v1 *m) {
+    std::stable_sort(workspaces.begin(), workspaces.end(), [](Workspace *a, Workspace *b) {
+        uint32_t a_group = a->group ? a->group->order : UINT32_MAX;
+        uint32_t b_group = b->group ? b->group->order : UINT32_MAX;
+        if (a_group != b_group)
+            return a_group < b_group;
+        if (a->coordinates != b->coordinates)
+            return a->coordinates < b->coordinates;
+        return a->serial < b->serial;
+    });
+    
+    // With a workspace per output several are active, the one switched to last is where focus went
+    Workspace *latest = nullptr;
+    for (Workspace *w: workspaces)
+        if ((w->state & EXT_WORKSPACE_HANDLE_V1_STATE_ACTIVE) && (!latest || w->activated > latest->activated))
+            latest = w;
+    current = latest ? latest->serial : 0;
+    layout_changed = true;
+}
+
+static void manager_handle_finished(void *data, struct ext_workspace_manager_v1 *m) {
+    ext_workspace_manager_v1_destroy(m);
+    if (manager == m)
+        manager = nullptr;
+}
+
+static const struct ext_workspace_manager_v1_listener manager_listener = {
+        .workspace_group = manager_handle_workspace_group,
+        .workspace       = manager_handle_workspace,
+        .done            = manager_handle_done,
+        .finished        = manager_handle_finished,
+};
+
+bool workspaces_bind(wl_registry *registry, uint32_t name, const char *interface, uint32_t version) {
+    if (strcmp(interface, ext_workspace_manager_v1_interface.name) != 0)
+        return false;
+    log_debug("Binding ext-workspace-manager-v1.");
+    manager = static_cast<ext_workspace_manager_v1 *>(wl_registry_bind(
+            registry, name, &ext_workspace_manager_v1_interface, 1));
+    ext_workspace_manager_v1_add_listener(manager, &manager_listener, NULL);
+    return true;
+}
+
+void workspaces_toplevel_done(Toplevel *toplevel) {
+    bool newly_focused = toplevel->activated && !toplevel->workspace_focus;
+    toplevel->workspace_focus = toplevel->activated;
+    if (!manager)
+        return;
+    // Windows open where the user is, but ones that were already there when we came could be anywhere
+    bool opened = toplevel->workspace == 0 && !toplevel->preexisting;
+    if ((opened || newly_focused) && std::find(pending.begin(), pending.end(), toplevel) == pending.end())
+        pending.push_back(toplevel);
+}
+
+void workspaces_forget(Toplevel *toplevel) {
+    pending.erase(std::remove(pending.begin(), pending.end(), toplevel), pending.end());
+}
+
+void workspaces_flush() {
+    if (pending.empty() && !layout_changed)
+        return;
+    
+    bool moved = false;
+    for (Toplevel *t: pending) {
+        if (current != 0 && t->workspace != current) {
+            log_debug("toplevel %ld: on workspace %u", t->id, current);
+            t->workspace = current;
+            moved = true;
+        }
+    }
+    pending.clear();
+    
+    DesktopLayout layout;
+    bool send_layout = false;
+    std::unordered_map<uint32_t, int> desktop_of; // Workspace serial -> desktop number
+    std::unordered_map<uint32_t, bool> shown;
+    for (int i = 0; i < (int) workspaces.size(); i++) {
+        Workspace *w = workspaces[i];
+        desktop_of[w->serial] = i;
+        shown[w->serial] = (w->state & EXT_WORKSPACE_HANDLE_V1_STATE_ACTIVE) != 0;
+        layout.names.push_back(w->name);
+        if (w->serial == current)
+            layout.current = i;
+    }
+    if (layout_changed && (layout.names != sent_names || layout.current != sent_current)) {
+        sent_names = layout.names;
+        sent_current = layout.current;
+        send_layout = true;
+    }
+    
+    std::vector<ProxyPlacement> placements;
+    if (moved || layout_changed) {
+        struct Toplevel *t;
+        wl_list_for_each(t, &toplevels, link) {
+            if (!t->wants_proxy)
+                continue;
+            auto desktop = desktop_of.find(t->workspace);
+            ProxyPlacement placement;
+            placement.toplevel_id = t->id;
+            placement.desktop = desktop == desktop_of.end() ? -1 : desktop->second;
+            placement.mapped = !current_workspace_only || placement.desktop == -1 || shown[t->workspace];
+            if (!resend_placements && placement.desktop == t->sent_desktop && placement.mapped == t->sent_mapped)
+                continue;
+            t->sent_desktop = placement.desktop;
+            t->sent_mapped = placement.mapped;
+            placements.push_back(placement);
+        }
+    }
+    layout_changed = false;
+    resend_placements = false;
+    
+    if (send_layout || !placements.empty())
+        place_proxies(std::move(placements), send_layout ? &layout : nullptr);
+}
+
+void workspaces_resend() {
+    if (!manager)
+        return; // Nothing was ever sent
+    sent_names.clear();
+    sent_current = -1;
+    layout_changed = true;
+    resend_placements = true;
+}
+
+void workspaces_unbind() {
+    for (Workspace *w: workspaces) {
+        ext_workspace_handle_v1_destroy(w->handle);
+        delete w;
+    }
+    for (WorkspaceGroup *group: groups) {
+        ext_workspace_group_handle_v1_destroy(group->handle);
+        delete group;
+    }
+    if (manager)
+        ext_workspace_manager_v1_destroy(manager);
+    workspaces.clear();
+    groups.clear();
+    pending.clear();
+    manager = nullptr;
+    current = 0;
+}
@@ -0,0 +1,50 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef FIX_X11_DOCKS_ON_WAYLAND_WORKSPACES_H
+#define FIX_X11_DOCKS_ON_WAYLAND_WORKSPACES_H
+
+#include "main.h"
+
+#include <cstdint>
+
+struct wl_registry;
+
+/**
+ * Workspaces through ext-workspace-v1, when the compositor has it: the
+ * workspaces become X desktops (_NET_NUMBER_OF_DESKTOPS, _NET_DESKTOP_NAMES,
+ * _NET_CURRENT_DESKTOP on the root) and proxies get _NET_WM_DESKTOP.
+ *
+ * No Wayland protocol says which workspace a toplevel is on, so we go by
+ * focus: a toplevel is on the workspace that was current when it opened or
+ * was last activated. Until then its proxy has no _NET_WM_DESKTOP.
+ */
+
+/** --current-workspace: unmap the proxies of toplevels on workspaces that aren't shown. Set once from main(). */
+extern bool current_workspace_only;
+
+/** Bind ext_workspace_manager_v1. Returns true if `interface` was it. Wayland thread. */
+bool workspaces_bind(wl_registry *registry, uint32_t name, const char *interface, uint32_t version);
+
+/** A toplevel is done; notes whether it opened or got focus, to be placed by workspaces_flush(). Wayland thread. */
+void workspaces_toplevel_done(Toplevel *toplevel);
+
+/** Forget a toplevel that's going away. Wayland thread. */
+void workspaces_forget(Toplevel *toplevel);
+
+/**
+ * Send the X thread what changed since the last call (desktops, which
+ * toplevel is on which, what's shown) as one batch. Call once everything
+ * read from the compositor has been dispatched, so a workspace switch and
+ * the focus change that comes with it are seen together. Wayland thread.
+ */
+void workspaces_flush();
+
+/** Have the next workspaces_flush() send the desktops and every placement again, the X thread dropped them. */
+void workspaces_resend();
+
+/** Let go of everything bound by workspaces_bind(), the connection is gone. */
+void workspaces_unbind();
+
+#endif //FIX_X11_DOCKS_ON_WAYLAND_WORKSPACES_H
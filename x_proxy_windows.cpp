@@ -3,127 +3,790 @@
 //
 
 #include "x_proxy_windows.h"
+#include "config.h"
 
 #include "main.h"
+#include "priority.h"
+#include "metrics.h"
+#include "trace.h"
+#include "probes.h"
+#include "log.h"
+#include "journal.h"
+#include "icons.h"
+#include "desktop_entries.h"
+#include "thumbnails.h"
 
 #include <thread>
+#include <atomic>
+#include <future>
 #include <cstdio>
 #include <X11/X.h>
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
+#include <X11/Xlib-xcb.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <X11/Xutil.h>
 #include <X11/extensions/shape.h>
 #include <X11/extensions/Xfixes.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/Xrandr.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <unistd.h>     // for pipe(), read(), write()
 #include <fcntl.h>      // for fcntl()
 #include <sys/poll.h>
 #include <vector>
+#include <deque>
 #include <mutex>
-#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
 
 Display *display;
-int wakeup_pipe[2];
+int wakeup_pipe[2] = {-1, -1}; // -1 until open_x_connection(), so an early wakeup() goes nowhere
 std::mutex mutex;
 
+// What queue_work() needs to know to merge or shed a FutureWork
+enum WorkKind {
+    WORK_OTHER,
+    WORK_CREATE,
+    WORK_TITLE,
+    WORK_IDENTIFIER,
+    WORK_DESTROY,
+    WORK_PLACE,
+    WORK_OUTPUT,
+    WORK_PARENT,
+    WORK_REASSIGN,
+    WORK_THUMBNAIL,
+    WORK_REBUILD,
+};
+
+/**
+ * What the X thread needs to make a toplevel's proxy, copied on the Wayland
+ * thread: the Toplevel itself may be freed before the work runs.
+ */
+struct ProxyRequest {
+    size_t toplevel_id = 0;
+    std::string title;
+    std::string app_id;
+    std::string identifier;
+};
+
+static ProxyRequest proxy_request(const Toplevel *top_level) {
+    return {top_level->id, top_level->title, top_level->app_id, top_level->identifier};
+}
+
 struct FutureWork {
     void (*func)(FutureWork *w) = nullptr;
-    Toplevel *top_level = nullptr;
+    const char *name = "";
+    WorkKind kind = WORK_OTHER;
+    size_t toplevel_id = 0;
+    size_t from_toplevel_id = 0;
     int id = 0;
     std::string new_title;
+    std::string app_id;
+    std::string identifier;
     Atom wm_delete;
+    uint64_t queued_at = 0;
+    CommandPriority priority = PRIORITY_PROMPT;
+    bool restores_connection = false; // The batch recreating every proxy after an X server restart
+    void *thumbnail = nullptr;
+    int width = 0;
+    int height = 0;
+    ProxyRequest proxy;
+    std::vector<ProxyRequest> burst;
+    bool adopt_leftovers = false; // Take over the proxies a previous run left behind, see find_leftover_proxies()
+    std::vector<size_t> toplevel_ids;
+    ProxySettings proxy_settings;
+    std::vector<ProxyPlacement> placements;
+    DesktopLayout layout;
+    bool has_layout = false;
+    std::vector<ProxyOutput> outputs;
+    long parent_id = -1;
+    std::vector<std::pair<size_t, long>> parents; // Toplevel id and parent id (-1 for none), see rebuild_proxies()
 };
 
-std::vector<FutureWork *> queued_work;
+/**
+ * Work x_main hasn't started yet. It takes one item at a time, so merging
+ * and shedding always see everything that's still waiting. Guarded by mutex.
+ */
+std::deque<FutureWork *> queued_work[PRIORITY_COUNT];
 
-std::string proxy_tag = "[PROXY]";
+/**
+ * Past this many items waiting for the X thread (after merging), queued lazy
+ * and prompt work is thrown away and new work of those priorities ignored
+ * until the X thread catches up. The Wayland thread then rebuilds from its
+ * toplevel list, see rebuild_proxies(). Urgent work, the batches that adopt
+ * or restore proxies and thumbnails (one in flight per proxy) are kept.
+ */
+const size_t work_queue_capacity = 1024;
 
-int x_main() {
-    display = XOpenDisplay(NULL);
-    if (pipe(wakeup_pipe) == -1) {
-        perror("pipe");
-        exit(EXIT_FAILURE);
+// All guarded by mutex
+static size_t queued_count = 0;
+static size_t queued_high_watermark = 0;
+static bool resync_pending = false;
+
+// See next_priority(). X thread only.
+static int prompt_streak = 0;
+
+/**
+ * How much queued work x_main runs before it looks at the X connection
+ * again, so a click on a dock waits for at most one slice of a burst of
+ * creates and not for the whole burst.
+ */
+const uint64_t work_slice_budget_ns = 4 * 1000000;
+const int work_slice_max_items = 32;
+
+// app_id of every live proxy, so icons that finish decoding later can be put on them. X thread only.
+std::unordered_map<Window, std::string> proxy_app_ids;
+
+// What the desktop entries gave live proxies, set again when they change, see refresh_desktop_entry_properties()
+static std::unordered_map<Window, std::string> proxy_wm_classes;
+static std::unordered_map<Window, std::string> untitled_proxies; // WM_NAME of the ones without a title
+static uint64_t desktop_entries_seen = 0;
+
+void set_window_icon(Display *display, Window win, const std::string &app_id, const Icon *icon);
+void forget_icon_pixmaps();
+static void refresh_desktop_entry_properties();
+void force_window_position(Display *display, Window win, int x, int y);
+
+/**
+ * The MIT-SHM memory a proxy's thumbnail is scaled into, so publishing it
+ * is just pointing a property at a pixmap. Double buffered so a capture
+ * never writes into the pixmap a dock is currently being pointed at.
+ */
+struct ThumbnailTarget {
+    Window window = 0;
+    XShmSegmentInfo segments[2];
+    Pixmap pixmaps[2] = {None, None};
+    int widths[2] = {0, 0};
+    int heights[2] = {0, 0};
+    int published = -1;     // The buffer the property points at
+    int writing = 0;        // The buffer the capture in flight scales into
+    bool in_flight = false;
+    bool retired = false;   // Proxy is gone, freed once the capture in flight comes back
+    bool orphaned = false;  // Its X connection is gone, so only the local side is left to free
+    uint64_t last_request_ms = 0;
+};
+
+// X thread only
+std::unordered_map<Window, ThumbnailTarget *> thumbnail_targets;
+bool shm_pixmaps_supported = false;
+Atom thumbnail_atom;
+Atom thumbnail_request_atom;
+
+/*
+ * The connection runs in RetainPermanent close-down mode, so when we exit or
+ * crash the proxies stay up, and the next run takes them over instead of
+ * making docks watch every window close and open again. Each proxy carries
+ * what it takes to match it to a toplevel, and lists the server resources
+ * only it uses so the next run can free them.
+ */
+Atom app_id_atom;       // _FIX_X11_DOCKS_APP_ID, UTF8_STRING
+Atom identifier_atom;   // _FIX_X11_DOCKS_IDENTIFIER, UTF8_STRING, the ext-foreign-toplevel identifier if any
+Atom resources_atom;    // _FIX_X11_DOCKS_RESOURCES, CARDINAL pairs of (ProxyResource, XID)
+Atom wm_protocols_atom;
+Atom net_close_window_atom;
+Atom net_wm_desktop_atom;
+Atom net_number_of_desktops_atom;
+Atom net_desktop_names_atom;
+Atom net_current_desktop_atom;
+
+enum ProxyResource {
+    RESOURCE_PIXMAP = 1,
+    RESOURCE_SHM_SEGMENT = 2,
+};
+
+// X thread only
+bool shm_supported = false;
+Colormap argb_colormap = None; // Shared by every proxy, they all use the same visual
+
+/**
+ * Proxies taken over from a previous run. Client messages sent straight to
+ * them (WM_DELETE_WINDOW, thumbnail requests) go to the dead client that
+ * created them, so for these we go by what's sent to the root window.
+ */
+std::unordered_set<Window> adopted_proxies;
+
+// Icon pixmaps of a previous run, per app_id, freed once our own icon is on its adopted proxies
+std::unordered_map<std::string, std::vector<Pixmap>> stale_icon_pixmaps;
+
+static void free_stale_icon_pixmaps(const std::string &app_id) {
+    auto stale = stale_icon_pixmaps.find(app_id);
+    if (stale == stale_icon_pixmaps.end())
+        return;
+    for (Pixmap pixmap: stale->second)
+        XFreePixmap(display, pixmap);
+    stale_icon_pixmaps.erase(stale);
+}
+
+/** Lets the next run free a thumbnail's pixmaps and shared memory if we don't get to it. */
+static void store_thumbnail_resources(ThumbnailTarget *t) {
+    std::vector<unsigned long> resources;
+    for (int i = 0; i < 2; i++) {
+        resources.push_back(RESOURCE_SHM_SEGMENT);
+        resources.push_back(t->segments[i].shmseg);
+        if (t->pixmaps[i] != None) {
+            resources.push_back(RESOURCE_PIXMAP);
+            resources.push_back(t->pixmaps[i]);
+        }
+    }
+    XChangeProperty(display, t->window, resources_atom, XA_CARDINAL, 32, PropModeReplace,
+                    (unsigned char *) resources.data(), (int) resources.size());
+}
+
+static uint64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static uint64_t now_ms() {
+    return now_ns() / 1000000;
+}
+
+static void free_thumbnail_target(ThumbnailTarget *t) {
+    for (int i = 0; i < 2; i++) {
+        if (!t->orphaned) {
+            if (t->pixmaps[i] != None)
+                XFreePixmap(display, t->pixmaps[i]);
+            XShmDetach(display, &t->segments[i]);
+        }
+        shmdt(t->segments[i].shmaddr);
+    }
+    delete t;
+}
+
+static ThumbnailTarget *create_thumbnail_target(Window window) {
+    auto t = new ThumbnailTarget;
+    t->window = window;
+    size_t size = (size_t) thumbnail_max_size * thumbnail_max_size * 4;
+    for (int i = 0; i < 2; i++) {
+        XShmSegmentInfo &segment = t->segments[i];
+        segment.shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+        segment.shmaddr = segment.shmid < 0 ? (char *) -1 : (char *) shmat(segment.shmid, NULL, 0);
+        if (segment.shmaddr == (char *) -1) {
+            log_warn("thumbnails: could not get shared memory: %s", strerror(errno));
+            if (segment.shmid >= 0)
+                shmctl(segment.shmid, IPC_RMID, NULL);
+            for (int j = 0; j < i; j++) {
+                XShmDetach(display, &t->segments[j]);
+                shmdt(t->segments[j].shmaddr);
+            }
+            delete t;
+            return nullptr;
+        }
+        segment.readOnly = True;
+        XShmAttach(display, &segment);
+    }
+    // Once the server has attached them, the segments can go away with the last detach
+    metrics_add(metrics.x_round_trips);
+    XSync(display, False);
+    for (int i = 0; i < 2; i++)
+        shmctl(t->segments[i].shmid, IPC_RMID, NULL);
+    store_thumbnail_resources(t);
+    return t;
+}
+
+/** A dock sent us _FIX_X11_DOCKS_THUMBNAIL_REQUEST. */
+static void request_thumbnail(Window window) {
+    if (!shm_pixmaps_supported || !proxy_app_ids.count(window))
+        return;
+    ThumbnailTarget *t;
+    auto found = thumbnail_targets.find(window);
+    if (found != thumbnail_targets.end()) {
+        t = found->second;
+    } else {
+        t = create_thumbnail_target(window);
+        if (!t)
+            return;
+        thumbnail_targets[window] = t;
     }
     
+    uint64_t now = now_ms();
+    if (t->in_flight || now - t->last_request_ms < thumbnail_min_interval_ms)
+        return;
+    t->in_flight = true;
+    t->last_request_ms = now;
+    t->writing = t->published == 0 ? 1 : 0;
     
-    // Set read end non-blocking (optional)
-    int flags = fcntl(wakeup_pipe[0], F_GETFL, 0);
-    fcntl(wakeup_pipe[0], F_SETFL, flags | O_NONBLOCK);
+    ThumbnailRequest request;
+    request.window = (int) window;
+    request.pixels = (uint32_t *) t->segments[t->writing].shmaddr;
+    request.target = t;
+    thumbnails_request(request);
+}
+
+static void forget_thumbnail(Window window) {
+    auto found = thumbnail_targets.find(window);
+    if (found == thumbnail_targets.end())
+        return;
+    if (found->second->in_flight)
+        found->second->retired = true;
+    else
+        free_thumbnail_target(found->second);
+    thumbnail_targets.erase(found);
+}
+
+// X thread's copy, see set_proxy_settings()
+static ProxySettings settings;
+
+// X thread only. Placements outlive the connection so recreated proxies go back where they were.
+static std::unordered_map<size_t, ProxyPlacement> placements; // By toplevel id
+static std::unordered_map<size_t, Window> toplevel_proxies;    // Toplevel id -> proxy, what every work item finds its proxy by
+static DesktopLayout desktop_layout;
+static bool have_desktop_layout = false;
+static std::unordered_map<size_t, ProxyOutput> proxy_outputs; // By toplevel id, see move_proxies_to_outputs()
+static std::unordered_map<size_t, size_t> transient_parents;   // Child toplevel id -> parent toplevel id, see set_transient_for()
+
+// Where each RandR output is on the root window, by name; redone on every RandR notify. X thread only.
+struct OutputOrigin {
+    int x;
+    int y;
+};
+static std::unordered_map<std::string, OutputOrigin> randr_outputs;
+static int randr_event_base = -1;
+
+// Toplevels announced before the compositor finished its initial burst. Wayland thread only.
+static bool in_startup_burst = true;
+static std::vector<Toplevel *> startup_burst;
+static uint64_t startup_began_ms = 0;
+static bool first_burst = true;
+
+// Set by the first batch to say how long startup took, later bursts come from compositor restarts. X thread only.
+static bool startup_reported = false;
+
+bool keep_proxies_on_exit = false;
+
+static std::thread x_thread;
+static std::promise<void> x_thread_exited;
+static std::atomic<bool> x_shutdown(false);
+static bool stopping = false; // Wayland thread only
+
+/** stop_x_connection() gives the X thread this long to close the connection before we exit without it. */
+const int x_shutdown_timeout_ms = 500;
+
+// X thread only
+static bool connection_broken = false; // Set by Xlib through handle_x_connection_lost()
+static Atom wm_delete;
+static uint64_t connection_lost_ms = 0;
+static bool recreating = false; // Lost the connection, and the batch recreating the proxies hasn't run yet
+
+// Set while creating the startup burst, whose requests all go out in one flush at the end
+static bool batching = false;
+
+// All flushes go through here so they show up on --trace timelines
+static void flush(Display *display) {
+    if (batching)
+        return;
+    TraceSpan span("x_flush");
+    XFlush(display);
+}
+
+static bool have_queued_work() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return queued_count > 0;
+}
+
+/** The next work item in next_priority() order, or nullptr if there is none. */
+static FutureWork *take_next_work() {
+    std::lock_guard<std::mutex> lock(mutex);
+    CommandPriority priority = next_priority(queued_work, prompt_streak);
+    if (priority == PRIORITY_COUNT)
+        return nullptr;
+    auto work = queued_work[priority].front();
+    queued_work[priority].pop_front();
+    queued_count--;
+    return work;
+}
+
+/**
+ * Run queued work until the slice budget is spent or X events are waiting,
+ * whichever comes first. Always makes progress by at least one item.
+ */
+static void run_work_slice() {
+    uint64_t slice_start = now_ns();
+    int ran = 0;
+    while (have_queued_work()) {
+        if (ran > 0 && (ran >= work_slice_max_items || now_ns() - slice_start >= work_slice_budget_ns ||
+                        XEventsQueued(display, QueuedAfterReading) > 0)) {
+            log_trace("yielding with work left");
+            metrics_add(metrics.work_slices_yielded);
+            return;
+        }
+        auto work = take_next_work();
+        if (!work)
+            return;
+        metrics_gauge_add(metrics.queued_work, -1);
+        if (recreating && (work->kind == WORK_CREATE || work->kind == WORK_TITLE || work->kind == WORK_IDENTIFIER) &&
+            !work->restores_connection) {
+            // Meant for proxies of the previous connection, the batch recreates them all anyway.
+            // The rest still runs, destroys to forget the toplevel and keep the batch from recreating its proxy.
+            delete work;
+            continue;
+        }
+        PROBE3(work_dequeue, work, work->toplevel_id, work->name);
+        metrics_observe(STAGE_QUEUE_RESIDENCY, work->queued_at);
+        if (work->func) {
+            TraceSpan span(work->name, work->toplevel_id);
+            uint64_t work_start = metrics_now();
+            work->wm_delete = wm_delete;
+            work->func(work);
+            metrics_observe(STAGE_WORK, work_start);
+        }
+        delete work;
+        ran++;
+        if (connection_broken)
+            return;
+    }
+}
+
+// Xlib calls this when the connection is gone, then the exit handler below
+static int handle_x_io_error(Display *) {
+    return 0;
+}
+
+// Instead of exiting, note it and return. Xlib calls on the broken Display
+// return right away from then on, so whatever was running winds down normally
+// and run_connection() returns to x_main() to reconnect.
+static void handle_x_connection_lost(Display *, void *) {
+    connection_broken = true;
+}
+
+// Requests for windows that went away under us mustn't take the whole daemon down
+static int handle_x_error(Display *, XErrorEvent *error) {
+    log_debug("X error %d for request %d on 0x%lx", error->error_code, error->request_code, error->resourceid);
+    return 0;
+}
+
+/**
+ * XOpenDisplay() until it works, backing off from 100ms up to 5s between
+ * tries. Returns nullptr if we're asked to shut down in the meantime.
+ */
+static Display *connect_with_backoff() {
+    int delay_ms = 100;
+    while (!x_shutdown) {
+        Display *d = XOpenDisplay(NULL);
+        if (d)
+            return d;
+        log_warn("could not connect to the X server, trying again in %d ms", delay_ms);
+        // Sleep on the wakeup pipe so stop_x_connection() doesn't have to wait out the backoff
+        pollfd fd = {wakeup_pipe[0], POLLIN, 0};
+        poll(&fd, 1, delay_ms);
+        delay_ms = std::min(delay_ms * 2, 5000);
+    }
+    return nullptr;
+}
+
+/**
+ * Leave the X server for good. With DestroyAll the server takes every proxy
+ * we created down with the connection in one go, otherwise (--keep-proxies)
+ * they stay for the next run to adopt.
+ *
+ * DestroyAll doesn't reach adopted proxies: they, and the icon pixmaps still
+ * shown on them, belong to the previous run's retained client. Those go
+ * explicitly. The rest of what that client listed in _FIX_X11_DOCKS_RESOURCES
+ * was freed when its proxies were adopted or destroyed, what's listed there
+ * now is ours.
+ */
+static void close_connection_for_shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &queue: queued_work) {
+            for (auto work: queue)
+                delete work;
+            queue.clear();
+        }
+        queued_count = 0;
+    }
+    size_t proxies = proxy_app_ids.size();
+    if (!keep_proxies_on_exit) {
+        for (Window win: adopted_proxies)
+            XDestroyWindow(display, win);
+        for (auto &[app_id, pixmaps]: stale_icon_pixmaps)
+            for (Pixmap pixmap: pixmaps)
+                XFreePixmap(display, pixmap);
+        log_debug("destroying %zu adopted proxies", adopted_proxies.size());
+        adopted_proxies.clear();
+        stale_icon_pixmaps.clear();
+        // XCloseDisplay() flushes but doesn't wait, be sure they're gone before we are
+        XSync(display, False);
+    }
+    XCloseDisplay(display);
+    display = nullptr;
+    log_debug("closed the X connection, %s %zu proxies", keep_proxies_on_exit ? "leaving" : "destroying", proxies);
+}
+
+/**
+ * Find where every enabled RandR output is. XWayland names its outputs
+ * after the compositor's, which is how move_proxies_to_outputs() matches
+ * them without a round trip per move.
+ */
+static void refresh_randr_outputs() {
+    randr_outputs.clear();
+    if (randr_event_base < 0)
+        return;
+    Window root = DefaultRootWindow(display);
+    XRRScreenResources *resources = XRRGetScreenResourcesCurrent(display, root);
+    if (!resources)
+        return;
+    for (int i = 0; i < resources->noutput; i++) {
+        XRROutputInfo *output = XRRGetOutputInfo(display, resources, resources->outputs[i]);
+        if (!output)
+            continue;
+        if (output->crtc != None) {
+            if (XRRCrtcInfo *crtc = XRRGetCrtcInfo(display, resources, output->crtc)) {
+                randr_outputs[std::string(output->name, output->nameLen)] = {crtc->x, crtc->y};
+                XRRFreeCrtcInfo(crtc);
+            }
+        }
+        XRRFreeOutputInfo(output);
+    }
+    XRRFreeScreenResources(resources);
+    log_debug("randr: %zu outputs enabled", randr_outputs.size());
+}
+
+/** Move a proxy to settings.x/y within its toplevel's output, or the root window if that's unknown. */
+static void position_proxy(size_t toplevel_id, Window win) {
+    int x = settings.x;
+    int y = settings.y;
+    auto on = proxy_outputs.find(toplevel_id);
+    if (on != proxy_outputs.end()) {
+        auto randr = randr_outputs.find(on->second.name);
+        if (randr != randr_outputs.end()) {
+            x += randr->second.x;
+            y += randr->second.y;
+        } else {
+            x += on->second.x;
+            y += on->second.y;
+        }
+    }
+    force_window_position(display, win, x, y);
+}
+
+static void set_up_connection() {
+    wm_delete = XInternAtom(display, "WM_DELETE_WINDOW", False);
+    wm_protocols_atom = XInternAtom(display, "WM_PROTOCOLS", False);
+    net_wm_desktop_atom = XInternAtom(display, "_NET_WM_DESKTOP", False);
+    net_number_of_desktops_atom = XInternAtom(display, "_NET_NUMBER_OF_DESKTOPS", False);
+    net_desktop_names_atom = XInternAtom(display, "_NET_DESKTOP_NAMES", False);
+    net_current_desktop_atom = XInternAtom(display, "_NET_CURRENT_DESKTOP", False);
+    net_close_window_atom = XInternAtom(display, "_NET_CLOSE_WINDOW", False);
+    app_id_atom = XInternAtom(display, "_FIX_X11_DOCKS_APP_ID", False);
+    identifier_atom = XInternAtom(display, "_FIX_X11_DOCKS_IDENTIFIER", False);
+    resources_atom = XInternAtom(display, "_FIX_X11_DOCKS_RESOURCES", False);
+    shm_supported = XShmQueryExtension(display);
+    int randr_error_base;
+    if (XRRQueryExtension(display, &randr_event_base, &randr_error_base)) {
+        XRRSelectInput(display, DefaultRootWindow(display),
+                       RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask | RROutputChangeNotifyMask);
+        refresh_randr_outputs();
+    } else {
+        randr_event_base = -1;
+        log_warn("randr: the X server has no RandR, proxies are placed by the outputs' logical positions");
+    }
+    
+    // Keep the proxies up when we go away, the next run adopts them
+    XSetCloseDownMode(display, RetainPermanent);
+    // _NET_CLOSE_WINDOW and thumbnail requests for adopted proxies are sent to the root window
+    XSelectInput(display, DefaultRootWindow(display), SubstructureNotifyMask);
     
+    if (thumbnails_enabled) {
+        int major, minor;
+        Bool pixmaps = False;
+        shm_pixmaps_supported = XShmQueryVersion(display, &major, &minor, &pixmaps) && pixmaps &&
+                                XShmPixmapFormat(display) == ZPixmap;
+        if (!shm_pixmaps_supported)
+            log_warn("thumbnails: the X server has no MIT-SHM pixmaps, --previews won't do anything");
+        thumbnail_atom = XInternAtom(display, "_FIX_X11_DOCKS_THUMBNAIL", False);
+        thumbnail_request_atom = XInternAtom(display, "_FIX_X11_DOCKS_THUMBNAIL_REQUEST", False);
+    }
+}
+
+/**
+ * Drop everything that belonged to the dead connection. Xlib can't be used
+ * on it anymore, not even to close it, so the Display itself is leaked.
+ */
+static void forget_connection() {
+    // Unset first, destroy_proxies_on_exit() mustn't write to the fd once it's closed and maybe reused
+    Display *dead = display;
+    display = nullptr;
+    close(ConnectionNumber(dead));
+    proxy_app_ids.clear();
+    proxy_wm_classes.clear();
+    untitled_proxies.clear();
+    adopted_proxies.clear();
+    toplevel_proxies.clear();
+    stale_icon_pixmaps.clear();
+    randr_outputs.clear();
+    argb_colormap = None;
+    forget_icon_pixmaps();
+    for (auto &[window, t]: thumbnail_targets) {
+        t->orphaned = true;
+        if (t->in_flight)
+            t->retired = true;
+        else
+            free_thumbnail_target(t);
+    }
+    thumbnail_targets.clear();
+    metrics_gauge_set(metrics.live_proxies, 0);
+    recreating = true;
+}
+
+/**
+ * Serve one X connection until it breaks (connection_broken is set), or
+ * until stop_x_connection() asks us to leave.
+ */
+static void run_connection() {
     // This returns the FD of the X11 display (or something like that)
     int x11_fd = ConnectionNumber(display);
     
-    int MAX_POLLING_EVENTS_AT_THE_SAME_TIME = 1000;
-    pollfd fds[MAX_POLLING_EVENTS_AT_THE_SAME_TIME];
-    
     std::vector<int> descriptors_being_polled;
     descriptors_being_polled.push_back(x11_fd);
     descriptors_being_polled.push_back(wakeup_pipe[0]);
+    if (metrics_fd != -1)
+        descriptors_being_polled.push_back(metrics_fd);
+    std::vector<pollfd> fds(descriptors_being_polled.size());
     
     
     int BUFFER_SIZE = 400;
     char buffer[BUFFER_SIZE];
     XEvent event;
     
-    Atom wm_delete = XInternAtom(display, "WM_DELETE_WINDOW", False);
-    
      // Main loop
     while(1) {
-        memset(fds, 0, sizeof(fds));
-        for (int i = 0; i < descriptors_being_polled.size(); i++) {
+        if (connection_broken)
+            return;
+        for (size_t i = 0; i < descriptors_being_polled.size(); i++) {
             fds[i].fd = descriptors_being_polled[i];
             fds[i].events = POLLIN;
+            fds[i].revents = 0;
         }
         
-        // Wait for X Event or a Timer
-        int num_ready_fds = poll(fds, descriptors_being_polled.size(), -1);
-        printf("woke up\n");
+        // Wait for X Event or a Timer, or just peek if a slice of work is still left over
+        int num_ready_fds = poll(fds.data(), fds.size(), have_queued_work() ? 0 : -1);
+        log_trace("woke up");
+        metrics_add(metrics.wakeups);
         if (num_ready_fds < 0) {
             perror("error in main poll loop\n");
             exit(1);
         }
-        std::lock_guard<std::mutex> lock(mutex);
+        trace_dump_if_requested();
+        if (x_shutdown) {
+            close_connection_for_shutdown();
+            return;
+        }
         
         for (int i = descriptors_being_polled.size() - 1; i >= 0; i--) {
             if (fds[i].revents & POLLIN) {
                 if (fds[i].fd == wakeup_pipe[0]) {
-                    printf("read from wakeup pipe\n");
                     read(wakeup_pipe[0], buffer, BUFFER_SIZE);
+                } else if (fds[i].fd == metrics_fd) {
+                    metrics_serve();
                 }
             }
         }
         // Handle XEvents and flush the input
-        while(XPending(display)) {
+        uint64_t x_events_start = metrics_now();
+        bool randr_changed = false;
+        while(!connection_broken && XPending(display)) {
             XNextEvent(display, &event);
-            printf("xevent type: %d\n", event.type);
-            if (event.type == FocusIn) {
-                activate_toplevel(event.xfocus.window);
+            log_trace("xevent type: %d", event.type);
+            journal_record(JOURNAL_X_EVENT, -1, event.xany.window, nullptr, event.type);
+            if (randr_event_base >= 0 && (event.type == randr_event_base + RRScreenChangeNotify ||
+                                          event.type == randr_event_base + RRNotify)) {
+                XRRUpdateConfiguration(&event);
+                randr_changed = true; // Monitor hotplugs come as a handful of these, look once they're all in
+            } else if (event.type == FocusIn) {
+                TraceSpan span("focus_in");
+                PROBE1(focus_in, event.xfocus.window);
+                request_activate(event.xfocus.window);
             } else if (event.type == ClientMessage) {
-                if ((Atom)event.xclient.data.l[0] == wm_delete) {
-                    printf("handle close\n");
-                    close_toplevel(event.xfocus.window);
+                if (thumbnails_enabled && event.xclient.message_type == thumbnail_request_atom) {
+                    request_thumbnail(event.xclient.window);
+                } else if (event.xclient.message_type == net_close_window_atom) {
+                    // For our own proxies the window manager follows up with WM_DELETE_WINDOW
+                    if (adopted_proxies.count(event.xclient.window)) {
+                        log_debug("close requested for adopted proxy 0x%lx", event.xclient.window);
+                        request_close(event.xclient.window);
+                    }
+                } else if (event.xclient.message_type == wm_protocols_atom &&
+                           (Atom)event.xclient.data.l[0] == wm_delete) {
+                    TraceSpan span("close_request");
+                    log_debug("close requested for proxy 0x%lx", event.xclient.window);
+                    request_close(event.xfocus.window);
                     break;
                 }
             }
         }
+        metrics_observe(STAGE_X_EVENTS, x_events_start);
+        if (randr_changed) {
+            refresh_randr_outputs();
+            for (auto &[toplevel_id, window]: toplevel_proxies)
+                if (proxy_outputs.count(toplevel_id))
+                    position_proxy(toplevel_id, window);
+        }
+        
+        // X events above always go first, bulk work only gets what's left of the slice
+        run_work_slice();
         
-        for (int i = 0; i < queued_work.size(); i++) {
-            auto work = queued_work[i];
-            if (work->func) {
-                work->wm_delete = wm_delete;
-                work->func(work);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (resync_pending && queued_count == 0) {
+                log_info("the X thread caught up, rebuilding the proxies from the toplevel list");
+                resync_pending = false;
+                request_resync();
             }
-            delete work;
         }
-        if (!queued_work.empty())
-            queued_work.clear();
         
-        XFlush(display);
+        for (auto &app_id: icons_take_ready()) {
+            const Icon *icon = icon_for_app_id(app_id);
+            for (auto &[window, window_app_id]: proxy_app_ids)
+                if (window_app_id == app_id)
+                    set_window_icon(display, window, app_id, icon);
+            free_stale_icon_pixmaps(app_id);
+        }
+        
+        uint64_t generation = desktop_entries_generation();
+        if (generation != desktop_entries_seen) {
+            desktop_entries_seen = generation;
+            refresh_desktop_entry_properties();
+        }
+        
+        flush(display);
         
     }
+}
+
+int x_main() {
+    XSetErrorHandler(handle_x_error);
+    XSetIOErrorHandler(handle_x_io_error);
     
+    while (true) {
+        display = connect_with_backoff();
+        if (!display)
+            break;
+        connection_broken = false;
+        XSetIOErrorExitHandler(display, handle_x_connection_lost, nullptr);
+        set_up_connection();
+        if (recreating) {
+            log_info("reconnected to the X server after %llu ms, recreating the proxies",
+                     (unsigned long long) (now_ms() - connection_lost_ms));
+            request_recreate_proxies();
+        }
+        run_connection();
+        if (!connection_broken || x_shutdown)
+            break;
+        
+        log_warn("lost the connection to the X server, reconnecting");
+        metrics_add(metrics.x_reconnects);
+        connection_lost_ms = now_ms();
+        forget_connection();
+    }
+    
+    x_thread_exited.set_value();
     return 0;
 }
 
@@ -132,9 +795,27 @@ void wakeup() {
     write(wakeup_pipe[1], msg, strlen(msg));
 }
 
+void allow_x_connection_paths() {
+    const char *xauthority = getenv("XAUTHORITY");
+    const char *home = getenv("HOME");
+    if (xauthority && *xauthority)
+        allow_path_after_landlock(xauthority, false);
+    else if (home)
+        allow_path_after_landlock(std::string(home) + "/.Xauthority", false);
+}
+
 void open_x_connection() {
-    std::thread t(x_main);
-    t.detach();
+    startup_began_ms = now_ms();
+    if (pipe(wakeup_pipe) == -1) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    // Neither end may block: x_main drains the read end, and wakeup() has to
+    // keep working while the X thread is stuck reconnecting
+    for (int fd: wakeup_pipe)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    
+    x_thread = std::thread(x_main);
 }
 
 /*
@@ -150,7 +831,9 @@ Window create_argb_window(Display *display, int screen, int x, int y, int width,
     }
     
     XSetWindowAttributes attr;
-    attr.colormap = XCreateColormap(display, RootWindow(display, screen), vinfo.visual, AllocNone);
+    if (argb_colormap == None)
+        argb_colormap = XCreateColormap(display, RootWindow(display, screen), vinfo.visual, AllocNone);
+    attr.colormap = argb_colormap;
     attr.background_pixel = 0x00000000;  // fully transparent
     attr.border_pixel = 0;
     attr.override_redirect = False; // optional
@@ -180,7 +863,7 @@ void make_window_click_through(Display *display, Window win) {
     
     // Clean up
     XFixesDestroyRegion(display, region);
-    XFlush(display);
+    flush(display);
 }
 
 void force_window_position(Display *display, Window win, int x, int y) {
@@ -196,7 +879,7 @@ void force_window_position(Display *display, Window win, int x, int y) {
     
     // Also move it in case the WM doesn't use hints
     XMoveWindow(display, win, x, y);
-    XFlush(display);
+    flush(display);
 }
 
 typedef struct {
@@ -227,7 +910,7 @@ void disable_decorations(Display *display, Window win) {
             (unsigned char *)&hints,
             sizeof(MotifWmHints) / 4 // number of 32-bit elements
     );
-    XFlush(display);
+    flush(display);
 }
 
 // Sets WM_CLASS to "stackingname" for both instance and class
@@ -256,7 +939,7 @@ void set_wm_class(Display *display, Window win, const char *stackingname) {
             (unsigned char *)wm_class,
             (int)(len * 2 + 2) // total length including both null terminators
     );
-    XFlush(display);
+    flush(display);
     free(wm_class);
 }
 
@@ -264,7 +947,70 @@ void set_wm_class(Display *display, Window win, const char *stackingname) {
 // Sets the window title using XStoreName
 void set_window_title(Display *display, Window win, std::string title) {
     XStoreName(display, win, title.c_str());
-    XFlush(display);
+    flush(display);
+}
+
+// What the next run matches a leftover proxy against its toplevels by
+void set_identity_properties(Display *display, Window win, const std::string &app_id, const std::string &identifier) {
+    Atom utf8_string = XInternAtom(display, "UTF8_STRING", False);
+    XChangeProperty(display, win, app_id_atom, utf8_string, 8, PropModeReplace,
+                    (const unsigned char *) app_id.data(), (int) app_id.size());
+    if (identifier.empty())
+        XDeleteProperty(display, win, identifier_atom);
+    else
+        XChangeProperty(display, win, identifier_atom, utf8_string, 8, PropModeReplace,
+                        (const unsigned char *) identifier.data(), (int) identifier.size());
+}
+
+/** _NET_WM_DESKTOP, or none for -1. */
+static void set_window_desktop(Window win, int desktop) {
+    if (desktop < 0) {
+        XDeleteProperty(display, win, net_wm_desktop_atom);
+    } else {
+        long d = desktop;
+        XChangeProperty(display, win, net_wm_desktop_atom, XA_CARDINAL, 32, PropModeReplace, (unsigned char *) &d, 1);
+    }
+}
+
+static void apply_desktop_layout() {
+    Window root = DefaultRootWindow(display);
+    long count = (long) desktop_layout.names.size();
+    XChangeProperty(display, root, net_number_of_desktops_atom, XA_CARDINAL, 32, PropModeReplace,
+                    (unsigned char *) &count, 1);
+    std::string names;
+    for (auto &name: desktop_layout.names) {
+        names += name;
+        names += '\0';
+    }
+    Atom utf8_string = XInternAtom(display, "UTF8_STRING", False);
+    XChangeProperty(display, root, net_desktop_names_atom, utf8_string, 8, PropModeReplace,
+                    (const unsigned char *) names.data(), (int) names.size());
+    if (desktop_layout.current >= 0) {
+        long current = desktop_layout.current;
+        XChangeProperty(display, root, net_current_desktop_atom, XA_CARDINAL, 32, PropModeReplace,
+                        (unsigned char *) &current, 1);
+    }
+}
+
+/** Point the proxy's WM_TRANSIENT_FOR at its parent's proxy, or drop it if there's none (yet). */
+static void apply_transient_for(size_t toplevel_id, Window win) {
+    auto parent = transient_parents.find(toplevel_id);
+    auto parent_proxy = parent == transient_parents.end() ? toplevel_proxies.end() : toplevel_proxies.find(parent->second);
+    if (parent_proxy != toplevel_proxies.end())
+        XSetTransientForHint(display, win, parent_proxy->second);
+    else
+        XDeleteProperty(display, win, XA_WM_TRANSIENT_FOR);
+}
+
+/** The toplevel's proxy came or went, its children's WM_TRANSIENT_FOR follows. */
+static void update_transients_of(size_t parent_id) {
+    for (auto &[child_id, child_parent_id]: transient_parents) {
+        if (child_parent_id != parent_id)
+            continue;
+        auto child = toplevel_proxies.find(child_id);
+        if (child != toplevel_proxies.end())
+            apply_transient_for(child_id, child->second);
+    }
 }
 
 // Sets a custom atom property "IS_WAYLAND_TOPLEVEL" of type INTEGER with value 1
@@ -283,38 +1029,99 @@ void set_custom_atom(Display *display, Window win) {
             (unsigned char *)&value,
             1                 // number of elements
     );
-    XFlush(display);
+    flush(display);
 }
 
 
 
-std::string get_window_title(Display* display, Window window) {
-    Atom net_wm_name = XInternAtom(display, "_NET_WM_NAME", False);
-    Atom utf8_string = XInternAtom(display, "UTF8_STRING", False);
-    Atom actual_type;
-    int actual_format;
-    unsigned long nitems, bytes_after;
-    unsigned char* prop = nullptr;
+// Server side copies of an app's icon, shared by all of that app's proxies
+struct IconPixmaps {
+    Pixmap pixmap = None;
+    Pixmap mask = None;
+};
+
+// Keyed by app_id, lives as long as the connection. X thread only.
+std::unordered_map<std::string, IconPixmaps> icon_pixmaps;
+
+void forget_icon_pixmaps() {
+    icon_pixmaps.clear();
+}
+
+IconPixmaps upload_icon_pixmaps(Display *display, const Icon *icon) {
+    IconPixmaps result;
+    int screen = DefaultScreen(display);
+    Window root = RootWindow(display, screen);
+    int depth = DefaultDepth(display, screen);
+    if (depth != 24 && depth != 32)
+        return result; // We only know how to lay out 32 bits per pixel TrueColor
     
-    if (XGetWindowProperty(display, window, net_wm_name, 0, (~0L), False,
-                           utf8_string, &actual_type, &actual_format,
-                           &nitems, &bytes_after, &prop) == Success) {
-        if (prop) {
-            std::string title(reinterpret_cast<char*>(prop));
-            XFree(prop);
-            return title;
-        }
+    // ZPixmap at 32 bits per pixel wants 0x00RRGGBB words, XDestroyImage frees them
+    auto data = static_cast<uint32_t *>(malloc(icon->pixels.size() * sizeof(uint32_t)));
+    if (!data)
+        return result;
+    for (size_t i = 0; i < icon->pixels.size(); i++)
+        data[i] = icon->pixels[i] & 0x00ffffff;
+    XImage *image = XCreateImage(display, DefaultVisual(display, screen), depth, ZPixmap, 0, (char *)data,
+                                 icon->width, icon->height, 32, 0);
+    if (!image) {
+        free(data);
+        return result;
     }
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    image->byte_order = LSBFirst;
+#else
+    image->byte_order = MSBFirst;
+#endif
+    
+    result.pixmap = XCreatePixmap(display, root, icon->width, icon->height, depth);
+    GC gc = XCreateGC(display, result.pixmap, 0, NULL);
+    XPutImage(display, result.pixmap, gc, image, 0, 0, 0, 0, icon->width, icon->height);
+    XFreeGC(display, gc);
+    XDestroyImage(image);
+    
+    // WM_HINTS only knows 1-bit masks, so cut at half alpha
+    int stride = (icon->width + 7) / 8;
+    std::vector<char> bits((size_t)stride * icon->height, 0);
+    for (int y = 0; y < icon->height; y++)
+        for (int x = 0; x < icon->width; x++)
+            if ((icon->pixels[(size_t)y * icon->width + x] >> 24) >= 128)
+                bits[(size_t)y * stride + x / 8] |= (char)(1 << (x % 8));
+    result.mask = XCreateBitmapFromData(display, root, bits.data(), icon->width, icon->height);
+    return result;
+}
+
+// Points WM_HINTS at the app's shared icon pixmap (uploaded on first use) and
+// sets _NET_WM_ICON from the blob prepared once per app
+void set_window_icon(Display *display, Window win, const std::string &app_id, const Icon *icon) {
+    if (!icon)
+        return;
     
-    // Fallback to WM_NAME
-    char* name = nullptr;
-    if (XFetchName(display, window, &name) > 0 && name) {
-        std::string title(name);
-        XFree(name);
-        return title;
+    auto pixmaps = icon_pixmaps.find(app_id);
+    if (pixmaps == icon_pixmaps.end())
+        pixmaps = icon_pixmaps.emplace(app_id, upload_icon_pixmaps(display, icon)).first;
+    
+    XWMHints hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.flags = InputHint;
+    hints.input = True; // We rely on FocusIn to know when the dock activates us
+    if (pixmaps->second.pixmap != None) {
+        hints.flags |= IconPixmapHint | IconMaskHint;
+        hints.icon_pixmap = pixmaps->second.pixmap;
+        hints.icon_mask = pixmaps->second.mask;
     }
+    XSetWMHints(display, win, &hints);
     
-    return "";
+    Atom net_wm_icon = XInternAtom(display, "_NET_WM_ICON", False);
+    XChangeProperty(
+            display,
+            win,
+            net_wm_icon,
+            XA_CARDINAL,
+            32,
+            PropModeReplace,
+            (unsigned char *)icon->net_wm_icon.data(),
+            (int)icon->net_wm_icon.size()
+    );
 }
 
 std::vector<Window> get_window_stack(Display* display, Window root) {
@@ -325,6 +1132,7 @@ std::vector<Window> get_window_stack(Display* display, Window root) {
     unsigned char* prop = nullptr;
     std::vector<Window> windows;
     
+    metrics_add(metrics.x_round_trips);
     if (XGetWindowProperty(display, root, atom, 0, (~0L), False,
                            XA_WINDOW, &actual_type, &actual_format,
                            &nitems, &bytes_after, &prop) == Success) {
@@ -340,104 +1148,1190 @@ std::vector<Window> get_window_stack(Display* display, Window root) {
     return windows;
 }
 
+/**
+ * Titles of every client window, for spotting toplevels that are XWayland
+ * windows already. The property requests for all windows are sent before
+ * the first reply is read, so this costs two round trips however many
+ * windows there are.
+ *
+ * Going by title alone is a guess too: a Wayland window that happens to
+ * share its title with an X window (two terminals in the same directory,
+ * one of them XWayland) gets no proxy.
+ */
+std::unordered_set<std::string> get_window_stack_titles(Display *display) {
+    std::vector<Window> stack = get_window_stack(display, DefaultRootWindow(display));
+    xcb_connection_t *connection = XGetXCBConnection(display);
+    Atom net_wm_name = XInternAtom(display, "_NET_WM_NAME", False);
+    Atom utf8_string = XInternAtom(display, "UTF8_STRING", False);
+    
+    std::vector<xcb_get_property_cookie_t> net_wm_names;
+    std::vector<xcb_get_property_cookie_t> wm_names;
+    for (Window win: stack) {
+        net_wm_names.push_back(xcb_get_property(connection, 0, win, net_wm_name, utf8_string, 0, 1024));
+        wm_names.push_back(xcb_get_property(connection, 0, win, XCB_ATOM_WM_NAME, XCB_GET_PROPERTY_TYPE_ANY, 0, 1024));
+    }
+    if (!stack.empty())
+        metrics_add(metrics.x_round_trips);
+    
+    std::unordered_set<std::string> titles;
+    for (size_t i = 0; i < stack.size(); i++) {
+        xcb_get_property_reply_t *net_wm = xcb_get_property_reply(connection, net_wm_names[i], NULL);
+        xcb_get_property_reply_t *wm = xcb_get_property_reply(connection, wm_names[i], NULL);
+        // Fall back to WM_NAME like XFetchName() would
+        xcb_get_property_reply_t *reply = net_wm && xcb_get_property_value_length(net_wm) > 0 ? net_wm : wm;
+        if (reply && xcb_get_property_value_length(reply) > 0) {
+            std::string title((const char *) xcb_get_property_value(reply), xcb_get_property_value_length(reply));
+            log_trace("window 0x%lx: '%s'", stack[i], title.c_str());
+            titles.insert(title);
+        }
+        free(net_wm);
+        free(wm);
+    }
+    return titles;
+}
+
+/** Name of the desktop entry for `app_id`, "" if there's none. Safe from any thread. */
+static std::string desktop_entry_name(const std::string &app_id) {
+    DesktopEntry entry;
+    if (desktop_entry_for_app_id(app_id, &entry))
+        return entry.name;
+    return "";
+}
+
+/** WM_NAME of a proxy: the title, or the desktop entry's name while there's none, then the tag. X thread only. */
+static std::string proxy_wm_name(const std::string &title, const std::string &app_id) {
+    std::string name = title.empty() ? desktop_entry_name(app_id) : title;
+    return name.empty() ? settings.tag : name + " " + settings.tag;
+}
+
+/** Docks match WM_CLASS against StartupWMClass, which doesn't always equal the app_id. */
+static std::string proxy_wm_class(const std::string &app_id) {
+    DesktopEntry entry;
+    if (desktop_entry_for_app_id(app_id, &entry) && !entry.wm_class.empty())
+        return entry.wm_class;
+    return app_id;
+}
+
+/** Remember the WM_NAME `name` a proxy was given for `title`, so an untitled one can be renamed later. */
+static void note_proxy_name(Window win, const std::string &title, const std::string &name) {
+    if (title.empty())
+        untitled_proxies[win] = name;
+    else
+        untitled_proxies.erase(win);
+}
+
+static void set_proxy_name(Window win, const std::string &title, const std::string &app_id) {
+    std::string name = proxy_wm_name(title, app_id);
+    set_window_title(display, win, name);
+    note_proxy_name(win, title, name);
+}
+
+static void set_proxy_wm_class(Window win, const std::string &app_id) {
+    std::string wm_class = proxy_wm_class(app_id);
+    set_wm_class(display, win, wm_class.c_str());
+    proxy_wm_classes[win] = wm_class;
+}
+
+/**
+ * The desktop entries changed (or finished indexing after the startup
+ * burst went out): give live proxies the WM_CLASS and, without a title, the
+ * name they'd be created with now. Only what differs. X thread only.
+ */
+static void refresh_desktop_entry_properties() {
+    for (auto &[window, app_id]: proxy_app_ids) {
+        auto wm_class = proxy_wm_classes.find(window);
+        if (wm_class == proxy_wm_classes.end() || wm_class->second != proxy_wm_class(app_id))
+            set_proxy_wm_class(window, app_id);
+        auto untitled = untitled_proxies.find(window);
+        if (untitled != untitled_proxies.end() && untitled->second != proxy_wm_name("", app_id))
+            set_proxy_name(window, "", app_id);
+    }
+}
+
+bool has_proxy_name(const Toplevel *top_level) {
+    return !top_level->title.empty() || !desktop_entry_name(top_level->app_id).empty();
+}
+
+/** The proxy itself, once we know the toplevel isn't an XWayland window. X thread only. */
+static void create_proxy_window(const ProxyRequest &top_level, Atom wm_delete) {
+    int screen = DefaultScreen(display);
+    
+    Window my_window = create_argb_window(display, screen, settings.x, settings.y, settings.width, settings.height);
+    XSetWMProtocols(display, my_window, &wm_delete, 1);
+    XSelectInput(display, my_window, StructureNotifyMask | FocusChangeMask );
+    proxy_app_ids[my_window] = top_level.app_id;
+    toplevel_proxies[top_level.toplevel_id] = my_window;
+    proxy_created(top_level.toplevel_id, my_window);
+    metrics_gauge_add(metrics.live_proxies, 1);
+    PROBE2(proxy_create, top_level.toplevel_id, my_window);
+    journal_record(JOURNAL_PROXY_CREATE, top_level.toplevel_id, my_window);
+    
+    log_debug("toplevel %zu: created proxy 0x%lx", top_level.toplevel_id, my_window);
+    
+    // Set title and custom atom
+    set_proxy_name(my_window, top_level.title, top_level.app_id);
+    set_custom_atom(display, my_window);
+    set_identity_properties(display, my_window, top_level.app_id, top_level.identifier);
+    if (transient_parents.count(top_level.toplevel_id))
+        apply_transient_for(top_level.toplevel_id, my_window);
+    update_transients_of(top_level.toplevel_id);
+    set_proxy_wm_class(my_window, top_level.app_id);
+    set_window_icon(display, my_window, top_level.app_id, icon_for_app_id(top_level.app_id));
+    auto placed = placements.find(top_level.toplevel_id);
+    if (placed != placements.end())
+        set_window_desktop(my_window, placed->second.desktop);
+    // Pooled unmapped while its workspace isn't shown, see place_proxies()
+    if (placed == placements.end() || placed->second.mapped)
+        XMapWindow(display, my_window);
+    position_proxy(top_level.toplevel_id, my_window);
+    make_window_click_through(display, my_window);
+    disable_decorations(display, my_window);
+    flush(display);
+}
+
+/** Take the queued (not yet started) work items matching `remove` out of `queue`. Hold mutex. */
+template<typename Predicate>
+static size_t remove_queued(std::deque<FutureWork *> &queue, Predicate remove) {
+    size_t removed = 0;
+    for (auto it = queue.begin(); it != queue.end();) {
+        if (remove(*it)) {
+            delete *it;
+            it = queue.erase(it);
+            removed++;
+        } else {
+            ++it;
+        }
+    }
+    queued_count -= removed;
+    metrics_gauge_add(metrics.queued_work, -(int64_t) removed);
+    return removed;
+}
+
+static void create_proxy_batch(FutureWork *w);
 
+/** The request `queued` makes a proxy from for the toplevel, or nullptr if it's not a create for it. */
+static ProxyRequest *queued_create_for(FutureWork *queued, size_t toplevel_id) {
+    if (queued->kind != WORK_CREATE)
+        return nullptr;
+    if (queued->func != create_proxy_batch)
+        return queued->toplevel_id == toplevel_id ? &queued->proxy : nullptr;
+    for (auto &member: queued->burst)
+        if (member.toplevel_id == toplevel_id)
+            return &member;
+    return nullptr;
+}
+
+/**
+ * Whether `queued` makes, takes down or hands over the toplevel's proxy.
+ * Newer state for the toplevel can't be merged into work ahead of it.
+ */
+static bool changes_proxy_of(FutureWork *queued, size_t toplevel_id) {
+    if (queued->kind == WORK_CREATE)
+        return queued_create_for(queued, toplevel_id) != nullptr;
+    if (queued->kind == WORK_DESTROY) {
+        auto &ids = queued->toplevel_ids;
+        if (ids.empty())
+            return queued->toplevel_id == toplevel_id;
+        return std::find(ids.begin(), ids.end(), toplevel_id) != ids.end();
+    }
+    if (queued->kind == WORK_REASSIGN)
+        return queued->toplevel_id == toplevel_id || queued->from_toplevel_id == toplevel_id;
+    return queued->kind == WORK_REBUILD;
+}
+
+/**
+ * Newer state replaces older: every one of `entries` that queued work of
+ * the same `kind` already has an entry for, with nothing in between that
+ * changes the toplevel's proxy, overwrites that entry and leaves `entries`.
+ * Returns how many did. Hold mutex.
+ */
+template<typename Entry>
+static size_t merge_entries(std::deque<FutureWork *> &queue, WorkKind kind, std::vector<Entry> &entries,
+                            std::vector<Entry> FutureWork::*queued_entries) {
+    size_t merged = 0;
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const Entry &entry) {
+        for (auto it = queue.rbegin(); it != queue.rend(); ++it) {
+            FutureWork *queued = *it;
+            if (changes_proxy_of(queued, entry.toplevel_id))
+                return false;
+            if (queued->kind != kind)
+                continue;
+            for (auto &older: (*queued).*queued_entries) {
+                if (older.toplevel_id == entry.toplevel_id) {
+                    older = entry;
+                    merged++;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }), entries.end());
+    return merged;
+}
+
+/**
+ * Take everything still queued for the toplevels in `ids` off the queue,
+ * their destroy forgets it on the X thread anyway. Their creates, destroys
+ * and hand-overs stay. Hold mutex.
+ */
+static size_t drop_queued_state_of(const std::vector<size_t> &ids) {
+    auto going = [&](size_t toplevel_id) {
+        return std::find(ids.begin(), ids.end(), toplevel_id) != ids.end();
+    };
+    size_t dropped = remove_queued(queued_work[PRIORITY_LAZY], [&](FutureWork *queued) {
+        return (queued->kind == WORK_TITLE || queued->kind == WORK_IDENTIFIER) && going(queued->toplevel_id);
+    });
+    auto &prompt = queued_work[PRIORITY_PROMPT];
+    for (auto queued: prompt) {
+        if (queued->kind == WORK_PLACE) {
+            auto &entries = queued->placements;
+            size_t before = entries.size();
+            entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const ProxyPlacement &placement) {
+                return going(placement.toplevel_id);
+            }), entries.end());
+            dropped += before - entries.size();
+        } else if (queued->kind == WORK_OUTPUT) {
+            auto &entries = queued->outputs;
+            size_t before = entries.size();
+            entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const ProxyOutput &output) {
+                return going(output.toplevel_id);
+            }), entries.end());
+            dropped += before - entries.size();
+        }
+    }
+    dropped += remove_queued(prompt, [&](FutureWork *queued) {
+        if (queued->kind == WORK_PARENT)
+            return going(queued->toplevel_id);
+        if (queued->kind == WORK_PLACE)
+            return queued->placements.empty() && !queued->has_layout;
+        return queued->kind == WORK_OUTPUT && queued->outputs.empty();
+    });
+    return dropped;
+}
+
+/**
+ * Fold `work` into what's already queued for the same toplevel. Returns true
+ * if `work` itself isn't needed anymore. Hold mutex.
+ */
+static bool merge_into_queued(FutureWork *work) {
+    if (work->kind == WORK_TITLE || work->kind == WORK_IDENTIFIER) {
+        // A create that hasn't run yet makes the proxy with the latest title right away
+        for (auto queued: queued_work[PRIORITY_PROMPT]) {
+            ProxyRequest *request = queued_create_for(queued, work->toplevel_id);
+            if (!request)
+                continue;
+            if (work->kind == WORK_TITLE)
+                request->title = work->new_title;
+            else
+                request->identifier = work->identifier;
+            return true;
+        }
+        for (auto queued: queued_work[work->priority]) {
+            if (queued->kind != work->kind || queued->toplevel_id != work->toplevel_id)
+                continue;
+            queued->new_title = work->new_title;
+            queued->app_id = work->app_id;
+            queued->identifier = work->identifier;
+            return true;
+        }
+    } else if (work->kind == WORK_CREATE && work->func != create_proxy_batch) {
+        for (auto queued: queued_work[work->priority])
+            if (queued->func != create_proxy_batch && queued_create_for(queued, work->toplevel_id))
+                return true;
+    } else if (work->kind == WORK_PLACE) {
+        size_t merged = merge_entries(queued_work[work->priority], WORK_PLACE, work->placements,
+                                      &FutureWork::placements);
+        if (work->placements.empty() && !work->has_layout)
+            return true;
+        metrics_add(metrics.updates_merged, merged);
+    } else if (work->kind == WORK_OUTPUT) {
+        size_t merged = merge_entries(queued_work[work->priority], WORK_OUTPUT, work->outputs, &FutureWork::outputs);
+        if (work->outputs.empty())
+            return true;
+        metrics_add(metrics.updates_merged, merged);
+    } else if (work->kind == WORK_PARENT) {
+        auto &queue = queued_work[work->priority];
+        for (auto it = queue.rbegin(); it != queue.rend(); ++it) {
+            if (changes_proxy_of(*it, work->toplevel_id))
+                break;
+            if ((*it)->kind == WORK_PARENT && (*it)->toplevel_id == work->toplevel_id) {
+                (*it)->parent_id = work->parent_id;
+                return true;
+            }
+        }
+    } else if (work->kind == WORK_DESTROY) {
+        std::vector<size_t> ids = work->toplevel_ids;
+        if (ids.empty())
+            ids.push_back(work->toplevel_id);
+        metrics_add(metrics.updates_merged, drop_queued_state_of(ids));
+    }
+    return false;
+}
+
+/** A proxy of a previous run, as found by find_leftover_proxies(). */
+struct LeftoverProxy {
+    Window window = 0;
+    std::string app_id;
+    std::string identifier;
+    std::string wm_name;
+    Colormap colormap = None;
+    std::vector<Pixmap> icon_pixmaps;   // From its WM_HINTS, shared with the other proxies of the app
+    std::vector<uint32_t> resources;    // _FIX_X11_DOCKS_RESOURCES
+};
+
+// The value of a property as raw bytes, "" if it isn't set
+static std::string take_property(xcb_connection_t *connection, xcb_get_property_cookie_t cookie) {
+    std::string value;
+    xcb_get_property_reply_t *reply = xcb_get_property_reply(connection, cookie, NULL);
+    if (reply && xcb_get_property_value_length(reply) > 0)
+        value.assign((const char *) xcb_get_property_value(reply), xcb_get_property_value_length(reply));
+    free(reply);
+    return value;
+}
+
+/**
+ * Proxies that a previous run left behind (they carry IS_WAYLAND_TOPLEVEL_PROXY
+ * but aren't ours), with everything needed to adopt or clean them up. Like
+ * get_window_stack_titles(), every request goes out before the first reply
+ * is read.
+ */
+static std::vector<LeftoverProxy> find_leftover_proxies() {
+    std::vector<Window> stack = get_window_stack(display, DefaultRootWindow(display));
+    xcb_connection_t *connection = XGetXCBConnection(display);
+    Atom marker = XInternAtom(display, "IS_WAYLAND_TOPLEVEL_PROXY", False);
+    
+    struct Cookies {
+        xcb_get_property_cookie_t marker, wm_name, app_id, identifier, hints, resources;
+        xcb_get_window_attributes_cookie_t attributes;
+    };
+    std::vector<Cookies> cookies;
+    for (Window win: stack) {
+        Cookies c;
+        c.marker = xcb_get_property(connection, 0, win, marker, XCB_ATOM_INTEGER, 0, 1);
+        c.wm_name = xcb_get_property(connection, 0, win, XCB_ATOM_WM_NAME, XCB_GET_PROPERTY_TYPE_ANY, 0, 1024);
+        c.app_id = xcb_get_property(connection, 0, win, app_id_atom, XCB_GET_PROPERTY_TYPE_ANY, 0, 1024);
+        c.identifier = xcb_get_property(connection, 0, win, identifier_atom, XCB_GET_PROPERTY_TYPE_ANY, 0, 1024);
+        c.hints = xcb_get_property(connection, 0, win, XCB_ATOM_WM_HINTS, XCB_ATOM_WM_HINTS, 0, 9);
+        c.resources = xcb_get_property(connection, 0, win, resources_atom, XCB_ATOM_CARDINAL, 0, 64);
+        c.attributes = xcb_get_window_attributes(connection, win);
+        cookies.push_back(c);
+    }
+    if (!stack.empty())
+        metrics_add(metrics.x_round_trips);
+    
+    std::vector<LeftoverProxy> leftovers;
+    for (size_t i = 0; i < stack.size(); i++) {
+        LeftoverProxy leftover;
+        leftover.window = stack[i];
+        bool is_proxy = !take_property(connection, cookies[i].marker).empty();
+        leftover.wm_name = take_property(connection, cookies[i].wm_name);
+        leftover.app_id = take_property(connection, cookies[i].app_id);
+        leftover.identifier = take_property(connection, cookies[i].identifier);
+        std::string hints = take_property(connection, cookies[i].hints);
+        std::string resources = take_property(connection, cookies[i].resources);
+        xcb_get_window_attributes_reply_t *attributes =
+                xcb_get_window_attributes_reply(connection, cookies[i].attributes, NULL);
+        if (attributes)
+            leftover.colormap = attributes->colormap;
+        free(attributes);
+        
+        if (!is_proxy || proxy_app_ids.count(leftover.window))
+            continue;
+        // WM_HINTS is flags, input, initial_state, icon_pixmap, icon_window, icon_x, icon_y, icon_mask, window_group
+        if (hints.size() >= 9 * 4) {
+            auto words = (const uint32_t *) hints.data();
+            if ((words[0] & IconPixmapHint) && words[3] != None)
+                leftover.icon_pixmaps.push_back(words[3]);
+            if ((words[0] & IconMaskHint) && words[7] != None)
+                leftover.icon_pixmaps.push_back(words[7]);
+        }
+        leftover.resources.resize(resources.size() / 4);
+        memcpy(leftover.resources.data(), resources.data(), leftover.resources.size() * 4);
+        log_debug("found proxy 0x%lx of a previous run: '%s' (%s)", leftover.window, leftover.wm_name.c_str(),
+                  leftover.app_id.c_str());
+        leftovers.push_back(std::move(leftover));
+    }
+    return leftovers;
+}
+
+/** Free a leftover's thumbnail pixmaps and shared memory, see store_thumbnail_resources(). */
+static void free_leftover_resources(const LeftoverProxy &leftover) {
+    for (size_t i = 0; i + 1 < leftover.resources.size(); i += 2) {
+        if (leftover.resources[i] == RESOURCE_PIXMAP) {
+            XFreePixmap(display, leftover.resources[i + 1]);
+        } else if (leftover.resources[i] == RESOURCE_SHM_SEGMENT && shm_supported) {
+            XShmSegmentInfo segment;
+            memset(&segment, 0, sizeof(segment));
+            segment.shmseg = leftover.resources[i + 1];
+            XShmDetach(display, &segment);
+        }
+    }
+}
+
+static void adopt_proxy(const ProxyRequest &top_level, const LeftoverProxy &leftover) {
+    Window win = leftover.window;
+    XSelectInput(display, win, StructureNotifyMask | FocusChangeMask);
+    proxy_app_ids[win] = top_level.app_id;
+    toplevel_proxies[top_level.toplevel_id] = win;
+    proxy_created(top_level.toplevel_id, win);
+    adopted_proxies.insert(win);
+    metrics_gauge_add(metrics.live_proxies, 1);
+    PROBE2(proxy_create, top_level.toplevel_id, win);
+    journal_record(JOURNAL_PROXY_CREATE, top_level.toplevel_id, win, "adopted");
+    log_debug("toplevel %zu: adopted proxy 0x%lx", top_level.toplevel_id, win);
+    
+    // Only what differs, so docks have nothing to redraw
+    std::string t = proxy_wm_name(top_level.title, top_level.app_id);
+    if (leftover.wm_name != t)
+        set_window_title(display, win, t);
+    note_proxy_name(win, top_level.title, t);
+    set_identity_properties(display, win, top_level.app_id, top_level.identifier);
+    // Also drops one left over from the previous run's parents
+    apply_transient_for(top_level.toplevel_id, win);
+    update_transients_of(top_level.toplevel_id);
+    if (leftover.colormap != None && argb_colormap != None)
+        XSetWindowColormap(display, win, argb_colormap);
+    set_window_icon(display, win, top_level.app_id, icon_for_app_id(top_level.app_id));
+    
+    // A previous --current-workspace run may have left it unmapped
+    auto placed = placements.find(top_level.toplevel_id);
+    if (placed != placements.end())
+        set_window_desktop(win, placed->second.desktop);
+    if (placed == placements.end() || placed->second.mapped)
+        XMapWindow(display, win);
+    else
+        XUnmapWindow(display, win);
+    // Monitors may have been rearranged while we were gone
+    if (proxy_outputs.count(top_level.toplevel_id))
+        position_proxy(top_level.toplevel_id, win);
+    
+    free_leftover_resources(leftover);
+    XDeleteProperty(display, win, resources_atom);
+    if (thumbnails_enabled)
+        XDeleteProperty(display, win, thumbnail_atom);
+}
+
+/**
+ * Hand the leftover proxies to the toplevels in `wanted` they match, best
+ * match first: same identifier (the compositor's, unique and unaffected by
+ * titles changing while we were gone), then same app_id and title, then
+ * just the same app_id. The others are destroyed along with every server
+ * resource a previous run left. Returns how many were adopted.
+ */
+static int adopt_leftover_proxies(std::vector<ProxyRequest> &wanted, std::vector<LeftoverProxy> &leftovers) {
+    // The leftovers' colormaps and icons are replaced by ours, so all of them can go
+    std::unordered_set<Colormap> colormaps;
+    std::unordered_map<std::string, std::unordered_set<Pixmap>> icons;
+    for (auto &leftover: leftovers) {
+        if (leftover.colormap != None)
+            colormaps.insert(leftover.colormap);
+        icons[leftover.app_id].insert(leftover.icon_pixmaps.begin(), leftover.icon_pixmaps.end());
+    }
+    if (argb_colormap == None && !leftovers.empty()) {
+        XVisualInfo vinfo;
+        int screen = DefaultScreen(display);
+        if (XMatchVisualInfo(display, screen, 32, TrueColor, &vinfo))
+            argb_colormap = XCreateColormap(display, RootWindow(display, screen), vinfo.visual, AllocNone);
+    }
+    
+    int adopted = 0;
+    std::unordered_map<std::string, size_t> by_identifier;
+    for (size_t i = 0; i < leftovers.size(); i++)
+        if (!leftovers[i].identifier.empty())
+            by_identifier[leftovers[i].identifier] = i;
+    std::vector<bool> taken(leftovers.size(), false);
+    for (auto &top_level: wanted) {
+        auto same = by_identifier.find(top_level.identifier);
+        if (toplevel_proxies.count(top_level.toplevel_id) || top_level.identifier.empty() ||
+            same == by_identifier.end())
+            continue;
+        adopt_proxy(top_level, leftovers[same->second]);
+        taken[same->second] = true;
+        adopted++;
+    }
+    for (size_t i = leftovers.size(); i-- > 0;)
+        if (taken[i])
+            leftovers.erase(leftovers.begin() + i);
+    
+    for (int pass = 0; pass < 2; pass++) {
+        for (auto &top_level: wanted) {
+            if (toplevel_proxies.count(top_level.toplevel_id))
+                continue;
+            for (auto it = leftovers.begin(); it != leftovers.end(); ++it) {
+                if (it->app_id != top_level.app_id)
+                    continue;
+                if (pass == 0 && it->wm_name != proxy_wm_name(top_level.title, top_level.app_id))
+                    continue;
+                adopt_proxy(top_level, *it);
+                leftovers.erase(it);
+                adopted++;
+                break;
+            }
+        }
+    }
+    
+    for (auto &leftover: leftovers) {
+        log_debug("destroying proxy 0x%lx of a previous run, no toplevel matches it", leftover.window);
+        XDestroyWindow(display, leftover.window);
+        free_leftover_resources(leftover);
+    }
+    if (argb_colormap != None)
+        for (Colormap colormap: colormaps)
+            XFreeColormap(display, colormap);
+    for (auto &[app_id, pixmaps]: icons) {
+        bool still_shown = false;
+        for (auto &[window, window_app_id]: proxy_app_ids)
+            if (window_app_id == app_id && adopted_proxies.count(window))
+                still_shown = true;
+        // An adopted proxy keeps showing the old icon until ours is decoded
+        if (still_shown && !icon_pixmaps.count(app_id)) {
+            stale_icon_pixmaps[app_id].insert(stale_icon_pixmaps[app_id].end(), pixmaps.begin(), pixmaps.end());
+        } else {
+            for (Pixmap pixmap: pixmaps)
+                XFreePixmap(display, pixmap);
+        }
+    }
+    return adopted;
+}
+
+/** Whether `work` may be thrown away once the X thread is too far behind, see work_queue_capacity. */
+static bool is_sheddable(const FutureWork *work) {
+    return work->priority != PRIORITY_URGENT && work->kind != WORK_THUMBNAIL && !work->adopt_leftovers &&
+           !work->restores_connection;
+}
+
+/** Hand work over to x_main. Called from the wayland thread. */
+static void queue_work(FutureWork *work) {
+    if (stopping) {
+        delete work;
+        return;
+    }
+    work->queued_at = metrics_now();
+    PROBE3(work_enqueue, work, work->toplevel_id, work->name);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (resync_pending && is_sheddable(work)) {
+        // The rebuild sends the latest state anyway
+        metrics_add(metrics.updates_suppressed);
+        delete work;
+        return;
+    }
+    if (merge_into_queued(work)) {
+        metrics_add(metrics.updates_merged);
+        delete work;
+        return;
+    }
+    if (queued_count >= work_queue_capacity && !resync_pending) {
+        size_t behind = queued_count;
+        size_t shed = remove_queued(queued_work[PRIORITY_LAZY], is_sheddable);
+        shed += remove_queued(queued_work[PRIORITY_PROMPT], is_sheddable);
+        metrics_add(metrics.updates_suppressed, shed);
+        resync_pending = true;
+        log_warn("the X thread is %zu items behind, dropped %zu and will rebuild from the toplevel list once it catches up",
+                 behind, shed);
+        if (is_sheddable(work)) {
+            delete work;
+            return;
+        }
+    }
+    
+    queued_work[work->priority].push_back(work);
+    queued_count++;
+    metrics_gauge_add(metrics.queued_work, 1);
+    if (queued_count > queued_high_watermark) {
+        queued_high_watermark = queued_count;
+        metrics_gauge_set(metrics.queued_work_high_watermark, (int64_t) queued_high_watermark);
+    }
+    wakeup();
+}
 
 void create_proxy_for(Toplevel *top_level) {
+    if (in_startup_burst) {
+        // Its title may still be on the way, end_startup_burst() looks at it then
+        if (std::find(startup_burst.begin(), startup_burst.end(), top_level) == startup_burst.end())
+            startup_burst.push_back(top_level);
+        return;
+    }
+    
     // TODO: we need a mutex on the queued work
     if (top_level) {
-        if (top_level->title.empty()) {
+        if (!has_proxy_name(top_level)) {
+            metrics_add(metrics.updates_suppressed);
             return;
         }
     }
     
     auto work = new FutureWork;
     work->func = [](FutureWork *w) {
+        if (toplevel_proxies.count(w->toplevel_id))
+            return; // A batch got to it first
+        
         // TODO: if there exists already an x window with the same title
         //  we then assume the toplevel is xwayland surface and we then don't need to do this
         
-        Window root = DefaultRootWindow(display);
-        std::vector<Window> stack = get_window_stack(display, root);
-        
-        for (Window win : stack) {
-            std::string title = get_window_title(display, win);
-            std::cout << "Window ID: " << win << " Title: " << title << "\n";
-            
-            if (title == w->top_level->title) {
-                std::cout << "Found window with title 'asdf': " << win  << "\n";
+        {
+            TraceSpan span("window_stack_dedupe", w->toplevel_id);
+            if (get_window_stack_titles(display).count(w->proxy.title)) {
+                log_debug("toplevel %zu: a window has the same title, assuming it's XWayland and skipping the proxy",
+                          w->toplevel_id);
+                metrics_add(metrics.updates_suppressed);
                 return;
             }
         }
         
-        auto top_level = w->top_level;
-        int screen = DefaultScreen(display);
-        
-        Window my_window = create_argb_window(display, screen, 0, 1, 1, 1);
-        XSetWMProtocols(display, my_window, &w->wm_delete, 1);
-        XSelectInput(display, my_window, StructureNotifyMask | FocusChangeMask );
-        top_level->x11_proxy_window_id = my_window;
-        
-        printf("%d\n", my_window);
-        
-        // Set title and custom atom
-        std::string t;
-        if (top_level->title.empty()) {
-            t = proxy_tag;
+        create_proxy_window(w->proxy, w->wm_delete);
+    };
+    work->name = "create_proxy";
+    work->kind = WORK_CREATE;
+    work->toplevel_id = top_level->id;
+    work->proxy = proxy_request(top_level);
+    queue_work(work);
+}
+
+/**
+ * Create the proxies of `w->burst` against one snapshot of the X windows,
+ * with everything going out in a single flush. X thread only.
+ */
+static void create_proxy_batch(FutureWork *w) {
+    std::unordered_set<std::string> titles;
+    {
+        TraceSpan span("window_stack_dedupe");
+        titles = get_window_stack_titles(display);
+    }
+    std::vector<LeftoverProxy> leftovers;
+    if (w->adopt_leftovers) {
+        TraceSpan span("find_leftover_proxies");
+        leftovers = find_leftover_proxies();
+    }
+    
+    std::vector<ProxyRequest> wanted;
+    for (auto &top_level: w->burst) {
+        if (toplevel_proxies.count(top_level.toplevel_id)) {
+            continue; // Got one from a create that ran before us
+        } else if (top_level.title.empty() && desktop_entry_name(top_level.app_id).empty()) {
+            metrics_add(metrics.updates_suppressed);
+        } else if (titles.count(top_level.title)) {
+            log_debug("toplevel %zu: a window has the same title, assuming it's XWayland and skipping the proxy",
+                      top_level.toplevel_id);
+            metrics_add(metrics.updates_suppressed);
         } else {
-            t = top_level->title + " " + proxy_tag;
+            wanted.push_back(top_level);
         }
-        set_window_title(display, my_window, t);
-        top_level->old_title = t;
-        set_custom_atom(display, my_window);
-        set_wm_class(display, my_window, top_level->app_id.c_str());
-        XMapWindow(display, my_window);
-        force_window_position(display, my_window, 0, 1);
-        make_window_click_through(display, my_window);
-        disable_decorations(display, my_window);
-        XFlush(display);
-    };
-    work->top_level = top_level;
-    std::lock_guard<std::mutex> lock(mutex);
-    queued_work.push_back(work);
-    wakeup();
+    }
+    
+    int created = 0;
+    int adopted = 0;
+    batching = true;
+    if (!leftovers.empty())
+        adopted = adopt_leftover_proxies(wanted, leftovers);
+    for (auto &top_level: wanted) {
+        if (!toplevel_proxies.count(top_level.toplevel_id)) {
+            create_proxy_window(top_level, w->wm_delete);
+            created++;
+        }
+    }
+    batching = false;
+    flush(display);
+    
+    if (w->restores_connection) {
+        if (have_desktop_layout) {
+            apply_desktop_layout();
+            flush(display);
+        }
+        recreating = false;
+        uint64_t restored_ms = now_ms() - connection_lost_ms;
+        metrics_gauge_set(metrics.reconnect_to_restored_ms, (int64_t) restored_ms);
+        log_info("reconnect: %d proxies for %zu toplevels, restored %llu ms after losing the X server",
+                 created, w->burst.size(), (unsigned long long) restored_ms);
+    } else if (startup_reported) {
+        log_debug("burst: %d proxies for %zu toplevels", created, w->burst.size());
+    } else {
+        startup_reported = true;
+        uint64_t ready_ms = now_ms() - startup_began_ms;
+        metrics_gauge_set(metrics.startup_to_ready_ms, (int64_t) ready_ms);
+        log_info("startup: %d proxies created and %d adopted for %zu toplevels, ready %llu ms after start",
+                 created, adopted, w->burst.size(), (unsigned long long) ready_ms);
+    }
+}
+
+void begin_startup_burst() {
+    in_startup_burst = true;
+}
+
+void end_startup_burst() {
+    if (!in_startup_burst)
+        return;
+    in_startup_burst = false;
+    
+    auto work = new FutureWork;
+    work->func = create_proxy_batch;
+    work->name = "create_startup_burst";
+    work->kind = WORK_CREATE;
+    work->adopt_leftovers = first_burst;
+    first_burst = false;
+    // Their titles are in by now
+    for (Toplevel *top_level: startup_burst)
+        work->burst.push_back(proxy_request(top_level));
+    startup_burst.clear();
+    queue_work(work);
+}
+
+void recreate_proxies(std::vector<Toplevel *> toplevels) {
+    auto work = new FutureWork;
+    work->func = create_proxy_batch;
+    work->name = "recreate_proxies";
+    work->kind = WORK_CREATE;
+    work->restores_connection = true;
+    for (Toplevel *top_level: toplevels)
+        work->burst.push_back(proxy_request(top_level));
+    queue_work(work);
 }
 
 void update_title_for(Toplevel *top_level) {
-    if (top_level->x11_proxy_window_id == 0)
+    if (!top_level->wants_proxy) {
+        metrics_add(metrics.updates_suppressed);
         return;
+    }
     auto work = new FutureWork;
     work->func = [](FutureWork *w) {
-        printf("set the title: %s\n", w->new_title.c_str());
-        printf("set the title: %s\n", w->new_title.c_str());
-        if (w->new_title.empty()) {
-            set_window_title(display, w->id, proxy_tag);
-        } else {
-            set_window_title(display, w->id, w->new_title + " " + proxy_tag);
-        }
-        XFlush(display);
+        // Lazy work can come after the destroy that was queued behind it, or for a create that skipped it
+        auto proxy = toplevel_proxies.find(w->toplevel_id);
+        if (proxy == toplevel_proxies.end())
+            return;
+        w->id = (int) proxy->second;
+        log_debug("toplevel %zu: set the title: %s", w->toplevel_id, w->new_title.c_str());
+        PROBE3(title_update, w->toplevel_id, w->id, w->new_title.c_str());
+        journal_record(JOURNAL_PROXY_TITLE, w->toplevel_id, w->id, w->new_title.c_str());
+        set_proxy_name(w->id, w->new_title, w->app_id);
+        flush(display);
     };
-    work->top_level = top_level;
-    work->id = top_level->x11_proxy_window_id;
+    work->name = "update_title";
+    work->kind = WORK_TITLE;
+    work->priority = PRIORITY_LAZY;
+    work->toplevel_id = top_level->id;
     work->new_title = top_level->title;
-    std::lock_guard<std::mutex> lock(mutex);
-    queued_work.push_back(work);
-    wakeup();
+    work->app_id = top_level->app_id;
+    queue_work(work);
+}
+
+void set_proxy_settings(const ProxySettings &new_settings) {
+    auto work = new FutureWork;
+    work->func = [](FutureWork *w) {
+        bool moved = w->proxy_settings.x != settings.x || w->proxy_settings.y != settings.y ||
+                     w->proxy_settings.width != settings.width || w->proxy_settings.height != settings.height;
+        settings = w->proxy_settings;
+        if (!moved)
+            return;
+        for (auto &[toplevel_id, window]: toplevel_proxies) {
+            XResizeWindow(display, window, settings.width, settings.height);
+            position_proxy(toplevel_id, window);
+        }
+        log_debug("moved %zu proxies to %dx%d+%d+%d", toplevel_proxies.size(),
+                  settings.width, settings.height, settings.x, settings.y);
+        flush(display);
+    };
+    work->name = "set_proxy_settings";
+    // Ahead of the title updates that pick up a new tag
+    work->priority = PRIORITY_URGENT;
+    work->proxy_settings = new_settings;
+    queue_work(work);
+}
+
+static void place_proxies_now(FutureWork *w) {
+    if (w->has_layout) {
+        desktop_layout = w->layout;
+        have_desktop_layout = true;
+        apply_desktop_layout();
+    }
+    int moved = 0;
+    for (auto &placement: w->placements) {
+        auto previous = placements.find(placement.toplevel_id);
+        bool was_mapped = previous == placements.end() || previous->second.mapped;
+        placements[placement.toplevel_id] = placement;
+        
+        auto proxy = toplevel_proxies.find(placement.toplevel_id);
+        if (proxy == toplevel_proxies.end())
+            continue; // Its create will place it
+        Window win = proxy->second;
+        set_window_desktop(win, placement.desktop);
+        if (placement.mapped && !was_mapped)
+            XMapWindow(display, win);
+        else if (!placement.mapped && was_mapped)
+            XUnmapWindow(display, win);
+        moved++;
+    }
+    log_debug("placed %d proxies%s", moved, w->has_layout ? ", desktops changed" : "");
+    flush(display);
+}
+
+void place_proxies(std::vector<ProxyPlacement> placements, const DesktopLayout *layout) {
+    auto work = new FutureWork;
+    work->func = place_proxies_now;
+    work->name = "place_proxies";
+    work->kind = WORK_PLACE;
+    work->priority = PRIORITY_PROMPT;
+    work->placements = std::move(placements);
+    if (layout) {
+        work->layout = *layout;
+        work->has_layout = true;
+    }
+    queue_work(work);
+}
+
+static void move_proxies_to_outputs_now(FutureWork *w) {
+    int moved = 0;
+    batching = true;
+    for (auto &output: w->outputs) {
+        proxy_outputs[output.toplevel_id] = output;
+        
+        auto proxy = toplevel_proxies.find(output.toplevel_id);
+        if (proxy == toplevel_proxies.end())
+            continue; // Its create will position it
+        position_proxy(output.toplevel_id, proxy->second);
+        moved++;
+    }
+    batching = false;
+    log_debug("moved %d proxies to their outputs", moved);
+    flush(display);
+}
+
+void move_proxies_to_outputs(std::vector<ProxyOutput> moves) {
+    auto work = new FutureWork;
+    work->func = move_proxies_to_outputs_now;
+    work->name = "move_proxies_to_outputs";
+    work->kind = WORK_OUTPUT;
+    work->priority = PRIORITY_PROMPT;
+    work->outputs = std::move(moves);
+    queue_work(work);
+}
+
+void set_transient_for(Toplevel *top_level, long parent_id) {
+    auto work = new FutureWork;
+    work->func = [](FutureWork *w) {
+        if (w->parent_id < 0)
+            transient_parents.erase(w->toplevel_id);
+        else
+            transient_parents[w->toplevel_id] = w->parent_id;
+        auto proxy = toplevel_proxies.find(w->toplevel_id);
+        if (proxy == toplevel_proxies.end())
+            return; // Its create sets it
+        apply_transient_for(w->toplevel_id, proxy->second);
+        flush(display);
+    };
+    work->name = "set_transient_for";
+    work->kind = WORK_PARENT;
+    // In order with the creates and destroys of both proxies, and it decides whether docks list the proxy at all
+    work->priority = PRIORITY_PROMPT;
+    work->toplevel_id = top_level->id;
+    work->parent_id = parent_id;
+    queue_work(work);
+}
+
+void update_identifier_for(Toplevel *top_level) {
+    if (!top_level->wants_proxy)
+        return;
+    auto work = new FutureWork;
+    work->func = [](FutureWork *w) {
+        auto proxy = toplevel_proxies.find(w->toplevel_id);
+        if (proxy == toplevel_proxies.end())
+            return;
+        Atom utf8_string = XInternAtom(display, "UTF8_STRING", False);
+        XChangeProperty(display, proxy->second, identifier_atom, utf8_string, 8, PropModeReplace,
+                        (const unsigned char *) w->identifier.data(), (int) w->identifier.size());
+        flush(display);
+    };
+    work->name = "update_identifier";
+    work->kind = WORK_IDENTIFIER;
+    work->priority = PRIORITY_LAZY;
+    work->toplevel_id = top_level->id;
+    work->identifier = top_level->identifier;
+    queue_work(work);
+}
+
+void reassign_proxy(Toplevel *from, Toplevel *to) {
+    auto work = new FutureWork;
+    work->func = [](FutureWork *w) {
+        auto proxy = toplevel_proxies.find(w->from_toplevel_id);
+        if (proxy == toplevel_proxies.end())
+            return; // Went with a lost X connection, the batch recreating them covers the new toplevel
+        Window win = proxy->second;
+        toplevel_proxies.erase(proxy);
+        toplevel_proxies[w->toplevel_id] = win;
+        proxy_created(w->toplevel_id, win);
+        // Where the old one was is stale, the new toplevel sends its own
+        placements.erase(w->from_toplevel_id);
+        proxy_outputs.erase(w->from_toplevel_id);
+        transient_parents.erase(w->from_toplevel_id);
+        update_transients_of(w->from_toplevel_id);
+        log_debug("toplevel %zu: took over proxy 0x%lx of toplevel %zu", w->toplevel_id, win, w->from_toplevel_id);
+        journal_record(JOURNAL_PROXY_CREATE, w->toplevel_id, win, "reassigned");
+        
+        if (w->proxy.title != w->new_title)
+            set_proxy_name(win, w->proxy.title, w->proxy.app_id);
+        if (w->proxy.identifier != w->identifier)
+            set_identity_properties(display, win, w->proxy.app_id, w->proxy.identifier);
+        // What the new toplevel sent before it had the proxy
+        auto placed = placements.find(w->toplevel_id);
+        if (placed != placements.end()) {
+            set_window_desktop(win, placed->second.desktop);
+            if (placed->second.mapped)
+                XMapWindow(display, win);
+            else
+                XUnmapWindow(display, win);
+        }
+        if (proxy_outputs.count(w->toplevel_id))
+            position_proxy(w->toplevel_id, win);
+        apply_transient_for(w->toplevel_id, win);
+        update_transients_of(w->toplevel_id);
+        flush(display);
+    };
+    work->name = "reassign_proxy";
+    work->kind = WORK_REASSIGN;
+    // Ahead of the startup burst, which would otherwise make the new toplevel a proxy of its own
+    work->priority = PRIORITY_PROMPT;
+    work->toplevel_id = to->id;
+    work->from_toplevel_id = from->id;
+    work->proxy = proxy_request(to);
+    work->new_title = from->title;
+    work->identifier = from->identifier;
+    queue_work(work);
+}
+
+/**
+ * Take creates of the toplevel that haven't run yet off the queue. Returns
+ * true if that leaves its destroy nothing to do: its own create was still
+ * waiting, so it has no proxy, the destroy of an earlier one is queued ahead
+ * of that create and everything sent for it since is queued behind it,
+ * which goes too. Call with mutex held.
+ */
+static bool cancel_queued_creates(size_t toplevel_id) {
+    size_t cancelled = remove_queued(queued_work[PRIORITY_PROMPT], [&](FutureWork *queued) {
+        return queued->func != create_proxy_batch && queued_create_for(queued, toplevel_id);
+    });
+    metrics_add(metrics.updates_merged, cancelled);
+    bool handed_over = false;
+    for (auto queued: queued_work[PRIORITY_PROMPT]) {
+        if (queued->func != create_proxy_batch)
+            continue;
+        auto &burst = queued->burst;
+        burst.erase(std::remove_if(burst.begin(), burst.end(), [&](const ProxyRequest &member) {
+            return member.toplevel_id == toplevel_id;
+        }), burst.end());
+    }
+    for (auto queued: queued_work[PRIORITY_PROMPT])
+        if (queued->kind == WORK_REASSIGN && changes_proxy_of(queued, toplevel_id))
+            handed_over = true;
+    if (cancelled == 0 || handed_over)
+        return false;
+    metrics_add(metrics.updates_merged, drop_queued_state_of({toplevel_id}));
+    return true;
+}
+
+/** Destroy the toplevel's proxy if it has one, and forget everything about it. X thread only. */
+static void destroy_proxy_now(size_t toplevel_id) {
+    placements.erase(toplevel_id);
+    proxy_outputs.erase(toplevel_id);
+    transient_parents.erase(toplevel_id);
+    auto proxy = toplevel_proxies.find(toplevel_id);
+    if (proxy == toplevel_proxies.end())
+        return; // Never got one, or it went with a lost X connection
+    Window win = proxy->second;
+    toplevel_proxies.erase(proxy);
+    update_transients_of(toplevel_id);
+    XDestroyWindow(display, win);
+    proxy_app_ids.erase(win);
+    proxy_wm_classes.erase(win);
+    untitled_proxies.erase(win);
+    adopted_proxies.erase(win);
+    forget_thumbnail(win);
+    metrics_gauge_add(metrics.live_proxies, -1);
+    PROBE2(proxy_destroy, toplevel_id, win);
+    journal_record(JOURNAL_PROXY_DESTROY, toplevel_id, win);
 }
 
 void destroy_proxy_for(Toplevel *top_level) {
-    if (top_level->x11_proxy_window_id == 0)
+    if (in_startup_burst)
+        startup_burst.erase(std::remove(startup_burst.begin(), startup_burst.end(), top_level), startup_burst.end());
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (cancel_queued_creates(top_level->id))
+            return;
+    }
+    // Queued even without a proxy we know of: one may be on its way, only the X thread can tell
+    auto work = new FutureWork;
+    work->func = [](FutureWork *w) {
+        destroy_proxy_now(w->toplevel_id);
+        flush(display);
+    };
+    work->name = "destroy_proxy";
+    work->kind = WORK_DESTROY;
+    work->toplevel_id = top_level->id;
+    queue_work(work);
+}
+
+void destroy_proxies(const std::vector<Toplevel *> &toplevels) {
+    if (toplevels.empty())
+        return;
+    auto work = new FutureWork;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Toplevel *top_level: toplevels)
+            if (!cancel_queued_creates(top_level->id))
+                work->toplevel_ids.push_back(top_level->id);
+    }
+    if (work->toplevel_ids.empty()) {
+        delete work;
         return;
+    }
+    work->func = [](FutureWork *w) {
+        for (size_t toplevel_id: w->toplevel_ids)
+            destroy_proxy_now(toplevel_id);
+        flush(display);
+    };
+    work->name = "destroy_proxies";
+    work->kind = WORK_DESTROY;
+    queue_work(work);
+}
+
+/**
+ * Bring the X thread in line with `w` after it fell behind and work was
+ * shed: proxies and state of toplevels it doesn't keep go, the kept ones
+ * get their name, identifier and parent again, and the missing ones are
+ * created. X thread only.
+ */
+static void rebuild_proxies_now(FutureWork *w) {
+    std::unordered_set<size_t> keep(w->toplevel_ids.begin(), w->toplevel_ids.end());
+    std::unordered_set<size_t> stale;
+    for (auto &[toplevel_id, window]: toplevel_proxies)
+        if (!keep.count(toplevel_id))
+            stale.insert(toplevel_id);
+    for (auto &[toplevel_id, placement]: placements)
+        if (!keep.count(toplevel_id))
+            stale.insert(toplevel_id);
+    for (auto &[toplevel_id, output]: proxy_outputs)
+        if (!keep.count(toplevel_id))
+            stale.insert(toplevel_id);
+    for (auto &[toplevel_id, parent_id]: transient_parents)
+        if (!keep.count(toplevel_id))
+            stale.insert(toplevel_id);
+    
+    batching = true;
+    for (size_t toplevel_id: stale)
+        destroy_proxy_now(toplevel_id);
+    for (auto &[toplevel_id, parent_id]: w->parents) {
+        if (parent_id < 0)
+            transient_parents.erase(toplevel_id);
+        else
+            transient_parents[toplevel_id] = parent_id;
+    }
+    for (auto &request: w->burst) {
+        auto proxy = toplevel_proxies.find(request.toplevel_id);
+        if (proxy == toplevel_proxies.end())
+            continue; // The batch below makes it
+        set_proxy_name(proxy->second, request.title, request.app_id);
+        set_identity_properties(display, proxy->second, request.app_id, request.identifier);
+    }
+    for (auto &[toplevel_id, window]: toplevel_proxies)
+        apply_transient_for(toplevel_id, window);
+    batching = false;
+    log_info("rebuild: took down %zu stale proxies, kept %zu", stale.size(), toplevel_proxies.size());
+    
+    create_proxy_batch(w);
+}
+
+void rebuild_proxies(const std::vector<Toplevel *> &toplevels, const std::vector<Toplevel *> &orphans) {
+    auto work = new FutureWork;
+    work->func = rebuild_proxies_now;
+    work->name = "rebuild_proxies";
+    work->kind = WORK_REBUILD;
+    for (Toplevel *top_level: toplevels) {
+        work->toplevel_ids.push_back(top_level->id);
+        work->parents.emplace_back(top_level->id, top_level->sent_parent);
+        // Until end_startup_burst() their creates wait for the orphans to be matched first
+        if (!in_startup_burst)
+            work->burst.push_back(proxy_request(top_level));
+    }
+    for (Toplevel *orphan: orphans)
+        work->toplevel_ids.push_back(orphan->id);
+    queue_work(work);
+}
+
+void thumbnail_captured(void *target, int width, int height) {
     auto work = new FutureWork;
     work->func = [](FutureWork *w) {
-        XDestroyWindow(display, w->id);
-        XFlush(display);
+        auto t = (ThumbnailTarget *) w->thumbnail;
+        t->in_flight = false;
+        if (t->retired) {
+            free_thumbnail_target(t);
+            return;
+        }
+        if (w->width == 0)
+            return;
+        
+        // A pixmap is only a view of the segment, so a new size is a new pixmap but no copy
+        int i = t->writing;
+        if (t->pixmaps[i] == None || t->widths[i] != w->width || t->heights[i] != w->height) {
+            if (t->pixmaps[i] != None)
+                XFreePixmap(display, t->pixmaps[i]);
+            t->pixmaps[i] = XShmCreatePixmap(display, DefaultRootWindow(display), t->segments[i].shmaddr,
+                                             &t->segments[i], w->width, w->height, 32);
+            t->widths[i] = w->width;
+            t->heights[i] = w->height;
+            store_thumbnail_resources(t);
+        }
+        t->published = i;
+        XChangeProperty(display, t->window, thumbnail_atom, XA_PIXMAP, 32, PropModeReplace,
+                        (unsigned char *) &t->pixmaps[i], 1);
+        log_trace("thumbnail of proxy 0x%lx: %dx%d", t->window, w->width, w->height);
+        flush(display);
     };
-    work->top_level = top_level;
-    work->id = top_level->x11_proxy_window_id;
-    std::lock_guard<std::mutex> lock(mutex);
-    queued_work.push_back(work);
-    wakeup();
+    work->name = "publish_thumbnail";
+    work->kind = WORK_THUMBNAIL;
+    work->priority = PRIORITY_LAZY;
+    work->thumbnail = target;
+    work->width = width;
+    work->height = height;
+    queue_work(work);
 }
 
-void stop_x_connection() {
+/**
+ * Switch the connection to DestroyAll from the Wayland thread, for when the
+ * X thread is stuck and won't do it. xcb is thread-safe, and gives up its
+ * lock while the X thread waits for a reply; the server applies the mode
+ * when it gets to the request, before it sees the connection close as we
+ * exit. Adopted proxies aren't ours, those stay.
+ */
+static void destroy_proxies_on_exit() {
+    Display *stuck = display;
+    if (!stuck)
+        return; // Between connections, there's nothing of ours up
+    xcb_connection_t *connection = XGetXCBConnection(stuck);
+    xcb_set_close_down_mode(connection, XCB_CLOSE_DOWN_DESTROY_ALL);
+    // A full socket would block the flush, and us with it
+    pollfd fd = {xcb_get_file_descriptor(connection), POLLOUT, 0};
+    if (poll(&fd, 1, 0) == 1 && (fd.revents & POLLOUT))
+        xcb_flush(connection);
+    else
+        log_warn("the X server isn't reading, the proxies may stay up");
+}
 
+bool stop_x_connection() {
+    // No more work from here on, free_data() destroying the toplevels included
+    stopping = true;
+    x_shutdown = true;
+    wakeup();
+    
+    uint64_t began = now_ms();
+    auto exited = x_thread_exited.get_future();
+    if (exited.wait_for(std::chrono::milliseconds(x_shutdown_timeout_ms)) == std::future_status::ready) {
+        x_thread.join();
+        log_debug("X thread stopped in %llu ms", (unsigned long long) (now_ms() - began));
+        return true;
+    }
+    // Stuck on an X server that doesn't answer. The connection is RetainPermanent, so exiting alone would
+    // leave our proxies up as ghosts, see destroy_proxies_on_exit()
+    log_warn("X thread didn't stop within %d ms, exiting without it", x_shutdown_timeout_ms);
+    if (!keep_proxies_on_exit)
+        destroy_proxies_on_exit();
+    x_thread.detach();
+    return false;
 }
\ No newline at end of file
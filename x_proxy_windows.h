@@ -6,18 +6,143 @@
 #define FIX_X11_DOCKS_ON_WAYLAND_X_PROXY_WINDOWS_H
 
 #include "main.h"
+#include "config.h"
 
+/** Set from main() before open_x_connection(): leave the proxies up on exit for the next run to adopt. */
+extern bool keep_proxies_on_exit;
+
+/** Start the X thread. After lock_the_land(), so it's sandboxed too. */
 void open_x_connection();
 
-void stop_x_connection();
+/** Allow what XOpenDisplay() reads, the Xauthority file. Call before lock_the_land(). */
+void allow_x_connection_paths();
+
+/**
+ * Stop taking work, have the X thread close its connection (which destroys
+ * every proxy unless keep_proxies_on_exit) and join it, giving up after
+ * x_shutdown_timeout_ms. Returns false if it gave up: the X thread is still
+ * running, so nothing it shares may be freed, static destructors included;
+ * _exit() instead. Wayland thread, once its loop is done.
+ */
+bool stop_x_connection();
+
+/** Wake x_main up from its poll. Async-signal-safe. */
+void wakeup();
 
 
+/**
+ * Until end_startup_burst() this only remembers the toplevel, so the ones
+ * that exist when we start get their proxies in a single batch.
+ */
 void create_proxy_for(Toplevel *topLevel);
 
+/**
+ * The compositor has told us about every toplevel that existed when we
+ * connected (the second sync). Creates their proxies in one go against a
+ * single snapshot of the X windows. Wayland thread only.
+ */
+void end_startup_burst();
+
+/** Hold creates back again until the next end_startup_burst(), for a reconnect to the compositor. */
+void begin_startup_burst();
+
+/**
+ * Give `toplevels` proxies again in one batch, after the X server went away
+ * and came back. Their x11_proxy_window_id must have been reset to 0.
+ */
+void recreate_proxies(std::vector<Toplevel *> toplevels);
+
 void update_title_for(Toplevel *topLevel);
 
+/**
+ * Whether there's something to call the toplevel's proxy: its title, or
+ * while it has none, the name from its desktop entry.
+ */
+bool has_proxy_name(const Toplevel *top_level);
+
+/**
+ * Hand the X thread new proxy settings. A new geometry moves the existing
+ * proxies right away; a new tag is only used from then on, resend the
+ * titles for it to show on existing proxies.
+ */
+void set_proxy_settings(const ProxySettings &settings);
+
+/** Where a toplevel's proxy goes among the X desktops. */
+struct ProxyPlacement {
+    size_t toplevel_id = 0;
+    int desktop = -1;        // _NET_WM_DESKTOP, -1 for none
+    bool mapped = true;
+};
+
+/** The desktops, for the root window's _NET_NUMBER_OF_DESKTOPS, _NET_DESKTOP_NAMES and _NET_CURRENT_DESKTOP. */
+struct DesktopLayout {
+    std::vector<std::string> names;
+    int current = -1;
+};
+
+/**
+ * Apply `placements` to the proxies (and to ones created later, for
+ * toplevels that don't have one yet) and `layout`, if not null, to the
+ * root window, all in one flush. Wayland thread.
+ */
+void place_proxies(std::vector<ProxyPlacement> placements, const DesktopLayout *layout);
+
+/** Which monitor a toplevel's proxy goes on, see outputs.h. */
+struct ProxyOutput {
+    size_t toplevel_id = 0;
+    std::string name;        // Matched against the RandR output names
+    int x = 0;               // The output's logical position, for when no RandR output has its name
+    int y = 0;
+};
+
+/**
+ * Move the proxies in `moves` (and ones created later, for toplevels that
+ * don't have one yet) onto their monitor, offset by the configured x and
+ * y, all in one flush. Wayland thread.
+ */
+void move_proxies_to_outputs(std::vector<ProxyOutput> moves);
+
+/**
+ * The toplevel's parent changed: its proxy gets WM_TRANSIENT_FOR pointing
+ * at the parent's proxy (once both exist), or loses it if `parent_id` is
+ * -1 or the parent has no proxy. Wayland thread.
+ */
+void set_transient_for(Toplevel *top_level, long parent_id);
+
+/** The toplevel got its identifier after its proxy was made, store it there for the next run to match by. */
+void update_identifier_for(Toplevel *top_level);
+
+/**
+ * Destroy the toplevel's proxy, or keep it from getting one if its create
+ * hasn't run yet. The X thread only goes by the toplevel's id, so the
+ * Toplevel can be freed right after. Wayland thread.
+ */
 void destroy_proxy_for(Toplevel *toplevel);
 
+/** destroy_proxy_for() every one of `toplevels`, all in one flush. */
+void destroy_proxies(const std::vector<Toplevel *> &toplevels);
+
+/**
+ * `to` takes over the proxy of `from`, a toplevel of a compositor we lost;
+ * its title and identifier go on the proxy where they differ. Wayland thread.
+ */
+void reassign_proxy(Toplevel *from, Toplevel *to);
+
+/**
+ * The X thread fell behind and dropped work, see request_resync(): take
+ * down the proxies of toplevels that are neither among `toplevels` (the
+ * ones that want a proxy) nor `orphans`, give `toplevels` their name,
+ * identifier and parent again and create the ones that are missing.
+ * Placements and outputs are resent on their own. Wayland thread.
+ */
+void rebuild_proxies(const std::vector<Toplevel *> &toplevels, const std::vector<Toplevel *> &orphans);
+
+/**
+ * A capture asked for with thumbnails_request() is done; `target` is the
+ * one from the request, a `width` of 0 means it failed. Wayland thread.
+ */
+void thumbnail_captured(void *target, int width, int height);
+
 
 
 #endif //FIX_X11_DOCKS_ON_WAYLAND_X_PROXY_WINDOWS_H